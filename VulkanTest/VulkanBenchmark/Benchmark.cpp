@@ -0,0 +1,1484 @@
+// Frame-time benchmark for VulkanRenderer.
+//
+// Drives VulkanRenderer::draw() headless (no window needed, runs on a software ICD like
+// lavapipe) for a fixed number of frames, in a few preset scenarios, and writes a JSON
+// report: startup time, CPU frame-time percentiles and throughput. Command buffers are
+// recorded every frame, the recording time is reported apart (record_ms).
+// Startup is measured twice per scenario: cold (no pipeline cache on disk) then warm (cache
+// written by the cold run). Driver-side shader caches can make the cold number optimistic.
+//
+// Usage: VulkanBenchmark [--scenario <name>|all] [--frames N] [--warmup N] [--output report.json]
+//                        [--gpu-trace <prefix>] [--cpu-trace <prefix>] [--allocator-stress N]
+//                        [--record-threads N] [--record-scaling] [--present-policy balanced|throughput|low-latency] [--present-policies] [--target-fps N] [--job-bench N] [--cull-bench N]
+// --gpu-trace turns on GPU timestamps: per-zone GPU times are added to the report and a
+// Chrome trace is written to <prefix>_<scenario>.json for each scenario.
+// Debug builds define ENABLE_CPU_TRACING: the report also breaks startup down per init stage
+// and gives the CPU time spent stalled on the GPU. --cpu-trace writes the CPU zones to
+// <prefix>_<scenario>.json. Release leaves the zones compiled out, its times don't pay for them.
+// --allocator-stress N runs N random buffer create/destroy operations through the renderer
+// memory allocator, checks no two live allocations overlap and reports the timings and
+// the per-heap statistics at the peak. Works on lavapipe. Use --scenario none to run it alone.
+// --record-threads sets the command recording threads of every scenario (default: one per core).
+// --record-scaling records the huge-draws frame with 1, 2, 4... threads up to the core count
+// and reports the recording time and speedup of each.
+// --job-bench N times the renderer job system against a plain mutex queue (ThreadPool) with
+// 1, 2, 4... threads: N empty jobs (scheduling overhead), N small jobs (throughput) and a
+// tree of jobs spawning jobs (N leaves). No GPU needed, use --scenario none to run it alone.
+// --cull-bench N culls N instances spread over twice the screen with each FrustumCuller
+// kernel the CPU has, and with a scalar loop over the InstanceData array, on one thread.
+// Reports objects per nanosecond. No GPU needed either.
+// Must be run from the VulkanTest project directory so rsc/ is found. The shaders of
+// rsc/Shader are packed into rsc/assets.pak first, the renderers load them from there.
+
+#include "VulkanRenderer.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+// Kept apart from the application cache so a benchmark run never throws it away
+static const char* BENCHMARK_PIPELINE_CACHE = "benchmark_pipeline_cache.bin";
+
+// The renderers open it by default, the benchmark packs it from the SPIR-V the build compiled
+static const char* SHADER_ARCHIVE = "rsc/assets.pak";
+
+enum class Culling
+{
+	None,
+	Cpu, // SIMD frustum culling on the job threads before recording
+	Gpu // Compute shader culling and indirect draws
+};
+
+
+struct Scenario
+{
+	const char* name;
+	const char* description;
+	DrawSettings drawSettings;
+	uint32_t width;
+	uint32_t height;
+	uint32_t gridSize; // 0: default triangle, otherwise a gridSize x gridSize vertex grid mesh
+	uint32_t streamKiB; // Uploaded to a device local buffer before every frame
+	uint32_t particleCount; // Simulated by a compute shader every frame
+	bool asyncCompute; // Simulation on the compute queue, or on the graphics queue before the frame
+	float instanceSpread; // 0: instances stacked full size, otherwise shrunk on a grid this many screens wide
+	Culling culling; // Of the instances
+	bool depthPrepass;
+};
+
+// Compute shader sub-steps per frame, enough for the simulation to weigh as much as the drawing
+static const uint32_t PARTICLE_STEPS = 32;
+
+// "instances" and "million-instances" draw small copies of the triangle spread over the
+// screen, each with its own offset and color from an instance buffer, in a single draw.
+// "offscreen-instances", "cpu-culling" and "gpu-culling" spread a million copies over twice
+// the screen, so three quarters are off screen: drawn anyway, culled on the CPU before
+// recording, or culled on the GPU before indirect draws.
+// "overdraw" stacks blended copies of the triangle at 1080p to stress fill rate, each one
+// nearer than the last so the depth test passes them all. "depth-prepass" draws the same
+// layers depth only first: only the nearest is shaded (depth_prepass_gain).
+// "big-mesh" uploads a million vertex grid through the staging uploader and draws it.
+// "streaming" keeps the uploader busy while drawing, its p99 shows the upload spikes.
+// "compute-serial" and "compute-async" run the same particle simulation and overdraw, the
+// report gives the async over serial throughput (async_compute_gain). Without a second
+// queue on the device both run serial.
+static const Scenario scenarios[]
+{
+	{ "triangle", "The default scene: one triangle, one draw", { 1, 1 }, 800, 600, 0, 0, 0, false, 0.0f, Culling::None, false },
+	{ "many-draws", "Thousands of small draw calls", { 5000, 1 }, 800, 600, 0, 0, 0, false, 0.0f, Culling::None, false },
+	{ "huge-draws", "Tens of thousands of draw calls, recorded on every core", { 50000, 1 }, 800, 600, 0, 0, 0, false, 0.0f, Culling::None, false },
+	{ "instances", "One draw call with a large instance count", { 1, 20000 }, 800, 600, 0, 0, 0, false, 1.0f, Culling::None, false },
+	{ "million-instances", "A million triangles, each with its own transform and color, in one draw", { 1, 1000000 }, 1920, 1080, 0, 0, 0, false, 1.0f, Culling::None, false },
+	{ "offscreen-instances", "A million instances over twice the screen, all drawn", { 1, 1000000 }, 1920, 1080, 0, 0, 0, false, 2.0f, Culling::None, false },
+	{ "cpu-culling", "The same million instances, culled on the CPU, visible ones drawn in a few calls", { 1, 1000000 }, 1920, 1080, 0, 0, 0, false, 2.0f, Culling::Cpu, false },
+	{ "gpu-culling", "The same million instances, culled by a compute shader and drawn indirectly", { 1, 1000000 }, 1920, 1080, 0, 0, 0, false, 2.0f, Culling::Gpu, false },
+	{ "overdraw", "Blended layers covering the screen at 1080p", { 1, 64 }, 1920, 1080, 0, 0, 0, false, 0.0f, Culling::None, false },
+	{ "depth-prepass", "The same layers after a depth prepass, only the nearest one shaded", { 1, 64 }, 1920, 1080, 0, 0, 0, false, 0.0f, Culling::None, true },
+	{ "big-mesh", "One mesh of a million vertices, two million triangles", { 1, 1 }, 800, 600, 1024, 0, 0, false, 0.0f, Culling::None, false },
+	{ "streaming", "Many draws while 8 MiB are uploaded every frame", { 5000, 1 }, 800, 600, 0, 8192, 0, false, 0.0f, Culling::None, false },
+	{ "compute-serial", "A million particles simulated before the overdraw, on the graphics queue", { 1, 64 }, 1920, 1080, 0, 0, 1u << 20, false, 0.0f, Culling::None, false },
+	{ "compute-async", "A million particles simulated beside the overdraw, on the compute queue", { 1, 64 }, 1920, 1080, 0, 0, 1u << 20, true, 0.0f, Culling::None, false },
+};
+
+struct BenchmarkOptions
+{
+	std::string scenario = "all";
+	uint32_t frames = 1000;
+	uint32_t warmupFrames = 50;
+	std::string outputPath; // Empty: write to stdout
+	std::string gpuTracePrefix; // Empty: no GPU profiling
+	std::string cpuTracePrefix; // Empty: no CPU trace file
+	uint32_t allocatorOperations = 0; // 0: no allocator stress test
+	uint32_t recordThreads = 0; // 0: one per core
+	bool recordScaling = false;
+	PresentPolicy presentPolicy = PresentPolicy::Balanced; // Of every scenario
+	bool presentPolicies = false;
+	double targetFps = 0.0; // 0: no pacing
+	uint32_t jobBenchJobs = 0; // 0: no job system benchmark
+	uint32_t cullBenchObjects = 0; // 0: no frustum culling benchmark
+};
+
+struct ScenarioResult
+{
+	const Scenario* scenario = nullptr;
+	bool failed = false;
+	std::string error;
+	double coldStartupMs = 0.0;
+	double warmStartupMs = 0.0;
+	bool warmCacheHit = false;
+	double uploadMs = 0.0; // Mesh creation until the GPU has the data, big-mesh only
+	const char* uploadQueue = "";
+	uint32_t recordThreads = 0;
+	bool computeAsync = false; // The simulation really ran on its own queue
+	bool gpuDriven = false; // Culling and indirect draws really ran (the device may not support them)
+	uint32_t visibleObjects = 0; // Left by CPU culling
+	RenderGraph::Stats renderGraph; // Of the last frame
+	uint32_t framesInFlight = 0;
+	double latencyMs = 0.0; // Mean, from draw() to the frame's timeline value
+	FramePacer::Stats present; // Headless, the submit stands in for the present
+	double totalSeconds = 0.0;
+	std::vector<double> frameTimesMs;
+	std::vector<double> recordTimesMs; // Command buffer recording, part of the frame time
+	std::vector<GpuProfiler::ZoneSummary> gpuZones;
+	std::vector<CpuTracer::ZoneSummary> coldStartupZones;
+	std::vector<CpuTracer::ZoneSummary> warmStartupZones;
+	std::vector<CpuTracer::ZoneSummary> frameZones;
+	double stallMs = 0.0;
+};
+
+
+struct RecordScalingPoint
+{
+	uint32_t threads = 0;
+	double recordMs = 0.0; // Mean per frame
+};
+
+
+struct PresentPolicyPoint
+{
+	PresentPolicy policy = PresentPolicy::Balanced;
+	uint32_t framesInFlight = 0;
+	double fps = 0.0;
+	double latencyMs = 0.0; // Mean
+};
+
+
+struct JobBenchmarkPoint
+{
+	const char* scheduler = "";
+	const char* test = "";
+	uint32_t threads = 0;
+	uint32_t jobs = 0;
+	double ms = 0.0;
+};
+
+
+struct CullBenchmarkPoint
+{
+	const char* kernel = "";
+	const char* layout = "";
+	uint32_t objects = 0;
+	uint32_t visible = 0;
+	double ms = 0.0; // Best run
+};
+
+
+struct AllocatorStressResult
+{
+	bool failed = false;
+	std::string error;
+	uint32_t operations = 0;
+	double seconds = 0.0;
+	uint32_t peakAllocations = 0;
+	uint32_t peakDeviceAllocations = 0; // vkAllocateMemory alive at the same time
+	uint32_t overlapErrors = 0;
+	bool reBar = false;
+	std::vector<MemoryAllocator::HeapStats> peakHeapStats;
+};
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static double elapsedMs(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static const char* presentPolicyName(PresentPolicy policy)
+{
+	switch (policy)
+	{
+	case PresentPolicy::Throughput: return "throughput";
+	case PresentPolicy::LowLatency: return "low-latency";
+	default: return "balanced";
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static bool parsePresentPolicy(const char* name, PresentPolicy& policy)
+{
+	for (PresentPolicy candidate : { PresentPolicy::Balanced, PresentPolicy::Throughput, PresentPolicy::LowLatency })
+	{
+		if (strcmp(name, presentPolicyName(candidate)) != 0) continue;
+		policy = candidate;
+		return true;
+	}
+	return false;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Flat grid covering most of the screen, gridSize x gridSize vertices
+static void makeGrid(uint32_t gridSize, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	vertices.reserve(static_cast<size_t>(gridSize) * gridSize);
+	for (uint32_t y = 0; y < gridSize; ++y)
+	{
+		for (uint32_t x = 0; x < gridSize; ++x)
+		{
+			float u = static_cast<float>(x) / (gridSize - 1);
+			float v = static_cast<float>(y) / (gridSize - 1);
+			vertices.push_back({ { u * 1.8f - 0.9f, v * 1.8f - 0.9f, 0.0f }, { u, v, 1.0f - u } });
+		}
+	}
+
+	indices.reserve(static_cast<size_t>(gridSize - 1) * (gridSize - 1) * 6);
+	for (uint32_t y = 0; y + 1 < gridSize; ++y)
+	{
+		for (uint32_t x = 0; x + 1 < gridSize; ++x)
+		{
+			uint32_t corner = y * gridSize + x;
+			indices.insert(indices.end(), { corner, corner + 1, corner + gridSize, corner + 1, corner + gridSize + 1, corner + gridSize });
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Spread: a grid of shrunk copies over the screen with varied colors. Otherwise every copy
+// is the mesh itself, stacked back to front: each one nearer than the one before.
+static std::vector<InstanceData> makeInstances(uint32_t count, float spread)
+{
+	std::vector<InstanceData> instances(count, { { 0.0f, 0.0f, 0.0f }, 1.0f, { 1.0f, 1.0f, 1.0f, 1.0f } });
+	if (spread <= 0.0f)
+	{
+		for (uint32_t i = 0; i < count; ++i) instances[i].offset[2] = 1.0f - (i + 0.5f) / count;
+		return instances;
+	}
+
+	// A grid spread screens wide, centred on the screen
+	uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+	float cellSize = 2.0f * spread / side;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t x = i % side;
+		uint32_t y = i / side;
+		InstanceData& instance = instances[i];
+		instance.offset[0] = -spread + (x + 0.5f) * cellSize;
+		instance.offset[1] = -spread + (y + 0.5f) * cellSize;
+		instance.scale = cellSize; // The triangle is 0.8 wide, leaves a small gap
+		instance.color[0] = static_cast<float>(x) / side;
+		instance.color[1] = static_cast<float>(y) / side;
+		instance.color[2] = 1.0f - instance.color[0];
+	}
+	return instances;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Nearest-rank percentile, values must be sorted
+static double percentile(const std::vector<double>& sortedValues, double p)
+{
+	if (sortedValues.empty()) return 0.0;
+	size_t rank = static_cast<size_t>(p / 100.0 * sortedValues.size() + 0.5);
+	rank = std::min(std::max(rank, (size_t)1), sortedValues.size());
+	return sortedValues[rank - 1];
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// The cold and the warm renderer of a scenario: both have to make the same pipelines
+static void configureRenderer(VulkanRenderer& renderer, const Scenario& scenario, const BenchmarkOptions& options)
+{
+	renderer.setDrawSettings(scenario.drawSettings);
+	renderer.setParticleSimulation(scenario.particleCount, PARTICLE_STEPS);
+	renderer.setAsyncCompute(scenario.asyncCompute);
+	renderer.setGpuDriven(scenario.culling == Culling::Gpu);
+	renderer.setCpuCulling(scenario.culling == Culling::Cpu);
+	renderer.setDepthPrepass(scenario.depthPrepass);
+	renderer.setPresentPolicy(options.presentPolicy);
+	renderer.getFramePacer().setTargetFrameRate(options.targetFps);
+	renderer.setThreadCount(options.recordThreads);
+	renderer.setPipelineCachePath(BENCHMARK_PIPELINE_CACHE);
+	renderer.setGpuProfilingEnabled(!options.gpuTracePrefix.empty());
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static ScenarioResult runScenario(const Scenario& scenario, const BenchmarkOptions& options, std::string& deviceName)
+{
+	ScenarioResult result;
+	result.scenario = &scenario;
+
+	// Cold start: no cache on disk, the driver compiles everything. Cleaning the renderer
+	// writes the cache used by the warm start below.
+	std::remove(BENCHMARK_PIPELINE_CACHE);
+	{
+		VulkanRenderer coldRenderer;
+		configureRenderer(coldRenderer, scenario, options);
+
+		CpuTracer::clear();
+		Clock::time_point startupBegin = Clock::now();
+		if (coldRenderer.initHeadless(scenario.width, scenario.height) == EXIT_FAILURE)
+		{
+			result.failed = true;
+			result.error = "renderer initialisation failed";
+			return result;
+		}
+		result.coldStartupMs = elapsedMs(startupBegin, Clock::now());
+		result.coldStartupZones = CpuTracer::summarize();
+		coldRenderer.clean();
+	}
+
+	// A fresh renderer for each scenario, so startup time is measured every time
+	VulkanRenderer renderer;
+	configureRenderer(renderer, scenario, options);
+
+	CpuTracer::clear();
+	Clock::time_point startupBegin = Clock::now();
+	if (renderer.initHeadless(scenario.width, scenario.height) == EXIT_FAILURE)
+	{
+		result.failed = true;
+		result.error = "renderer initialisation failed";
+		return result;
+	}
+	result.warmStartupMs = elapsedMs(startupBegin, Clock::now());
+	result.warmStartupZones = CpuTracer::summarize();
+	result.warmCacheHit = renderer.isPipelineCacheWarm();
+
+	if (scenario.gridSize > 0 || scenario.drawSettings.instanceCount > 1)
+	{
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		if (scenario.gridSize > 0) makeGrid(scenario.gridSize, vertices, indices);
+		std::vector<InstanceData> instances = makeInstances(scenario.drawSettings.instanceCount, scenario.instanceSpread);
+
+		// Until the data is really on the GPU
+		Clock::time_point uploadBegin = Clock::now();
+		DrawSettings drawSettings = scenario.drawSettings;
+		if (scenario.gridSize > 0) drawSettings.meshIndex = renderer.createMesh(vertices, indices);
+		if (scenario.drawSettings.instanceCount > 1) drawSettings.instanceBufferIndex = renderer.createInstanceBuffer(instances);
+		renderer.waitIdle();
+		result.uploadMs = elapsedMs(uploadBegin, Clock::now());
+		renderer.setDrawSettings(drawSettings);
+	}
+	deviceName = renderer.getDeviceName();
+
+	StagingUploader& uploader = renderer.getUploader();
+	result.uploadQueue = !uploader.isAsync() ? "graphics" : uploader.transfersOwnership() ? "transfer-family" : "graphics-family";
+	result.computeAsync = renderer.isComputeAsync();
+	result.gpuDriven = renderer.isGpuDriven();
+	result.recordThreads = renderer.getThreadCount();
+
+	// Streamed data lands in a buffer nothing reads, only the upload cost matters
+	VkBuffer streamBuffer = VK_NULL_HANDLE;
+	MemoryAllocation streamAllocation;
+	std::vector<char> streamData(static_cast<size_t>(scenario.streamKiB) * 1024, 1);
+	auto streamUpload = [&]()
+	{
+		if (streamBuffer == VK_NULL_HANDLE) return;
+		uploader.uploadBuffer(streamBuffer, 0, streamData.data(), streamData.size(),
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	};
+
+	try
+	{
+		if (scenario.streamKiB > 0)
+		{
+			VkBufferCreateInfo bufferCreateInfo{};
+			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferCreateInfo.size = streamData.size();
+			bufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			renderer.getMemoryAllocator().createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, streamBuffer, streamAllocation);
+		}
+
+		// Warmup: first frames pay for lazy driver work we don't want in the percentiles
+		for (uint32_t i = 0; i < options.warmupFrames; ++i)
+		{
+			streamUpload();
+			renderer.draw();
+		}
+		renderer.waitIdle();
+
+		// Warmup timestamps are not part of the measure
+		renderer.getGpuProfiler().collect();
+		renderer.getGpuProfiler().clearResults();
+		renderer.resetLatencyStats();
+		renderer.getFramePacer().resetStats();
+		CpuTracer::clear();
+
+		// Each frame is timed from the start of draw() to the start of the next one. The
+		// per-frame timeline wait is inside draw(), so a GPU-bound frame shows up here too.
+		result.frameTimesMs.reserve(options.frames);
+		result.recordTimesMs.reserve(options.frames);
+		Clock::time_point runBegin = Clock::now();
+		for (uint32_t i = 0; i < options.frames; ++i)
+		{
+			Clock::time_point frameBegin = Clock::now();
+			streamUpload();
+			renderer.draw();
+			result.frameTimesMs.push_back(elapsedMs(frameBegin, Clock::now()));
+			result.recordTimesMs.push_back(renderer.getLastRecordMs());
+		}
+
+		// Taken before the wait: waitIdle doesn't time the frames it waits for
+		result.latencyMs = renderer.getAverageLatencyMs();
+		result.framesInFlight = renderer.getFramesInFlight();
+		result.present = renderer.getFramePacer().getStats();
+
+		// Throughput counts until the GPU has really finished the last frame
+		renderer.waitIdle();
+		result.totalSeconds = elapsedMs(runBegin, Clock::now()) / 1000.0;
+		result.visibleObjects = renderer.getVisibleObjectCount();
+		result.renderGraph = renderer.getRenderGraphStats();
+		result.frameZones = CpuTracer::summarize();
+		result.stallMs = CpuTracer::getStallTimeMs();
+
+		if (!options.cpuTracePrefix.empty())
+		{
+			std::string tracePath = options.cpuTracePrefix + "_" + scenario.name + ".json";
+			if (!CpuTracer::isCompiledIn())
+			{
+				std::cerr << "  CPU tracing is compiled out, " << tracePath << " will be empty" << std::endl;
+			}
+			if (!CpuTracer::exportChromeTrace(tracePath))
+			{
+				std::cerr << "  could not write " << tracePath << std::endl;
+			}
+		}
+
+		// Read the timestamps of the last frames, now that the GPU is idle
+		GpuProfiler& gpuProfiler = renderer.getGpuProfiler();
+		if (gpuProfiler.isEnabled())
+		{
+			gpuProfiler.collect();
+			result.gpuZones = gpuProfiler.summarize();
+
+			std::string tracePath = options.gpuTracePrefix + "_" + scenario.name + ".json";
+			if (!gpuProfiler.exportChromeTrace(tracePath))
+			{
+				std::cerr << "  could not write " << tracePath << std::endl;
+			}
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		result.failed = true;
+		result.error = e.what();
+	}
+
+	if (streamBuffer != VK_NULL_HANDLE)
+	{
+		renderer.waitIdle();
+		renderer.getMemoryAllocator().destroyBuffer(streamBuffer, streamAllocation);
+	}
+	renderer.clean();
+	return result;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Two live allocations sharing bytes of the same VkDeviceMemory is an allocator bug
+static uint32_t countOverlaps(const std::vector<MemoryAllocation>& allocations)
+{
+	std::vector<const MemoryAllocation*> sorted;
+	for (const MemoryAllocation& allocation : allocations) sorted.push_back(&allocation);
+	std::sort(sorted.begin(), sorted.end(), [](const MemoryAllocation* a, const MemoryAllocation* b)
+	{
+		return a->memory != b->memory ? a->memory < b->memory : a->offset < b->offset;
+	});
+
+	uint32_t overlaps = 0;
+	for (size_t i = 1; i < sorted.size(); ++i)
+	{
+		if (sorted[i]->memory == sorted[i - 1]->memory && sorted[i]->offset < sorted[i - 1]->offset + sorted[i - 1]->size) ++overlaps;
+	}
+	return overlaps;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static AllocatorStressResult runAllocatorStress(const BenchmarkOptions& options, std::string& deviceName)
+{
+	AllocatorStressResult result;
+	result.operations = options.allocatorOperations;
+
+	// The renderer is only there for its device and allocator
+	VulkanRenderer renderer;
+	if (renderer.initHeadless(64, 64) == EXIT_FAILURE)
+	{
+		result.failed = true;
+		result.error = "renderer initialisation failed";
+		return result;
+	}
+	deviceName = renderer.getDeviceName();
+	MemoryAllocator& allocator = renderer.getMemoryAllocator();
+	result.reBar = allocator.hasReBar();
+
+	// Fixed seed: every run does the same operations
+	std::mt19937 random{ 1234 };
+	const uint32_t maxLiveBuffers = 4096;
+	const MemoryUsage usages[]{ MemoryUsage::GpuOnly, MemoryUsage::CpuToGpu, MemoryUsage::Staging, MemoryUsage::GpuToCpu };
+
+	std::vector<VkBuffer> buffers;
+	std::vector<MemoryAllocation> allocations;
+	try
+	{
+		Clock::time_point begin = Clock::now();
+		for (uint32_t i = 0; i < options.allocatorOperations; ++i)
+		{
+			bool create = buffers.empty() || (buffers.size() < maxLiveBuffers && random() % 100 < 55);
+			if (create)
+			{
+				// Mostly small buffers, sometimes one big enough to get a dedicated allocation
+				VkBufferCreateInfo bufferCreateInfo{};
+				bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+				bufferCreateInfo.size = random() % 64 == 0 ? (32u << 20) + random() % (8u << 20) : 16 + random() % (256u << 10);
+				bufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+				bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+				VkBuffer buffer;
+				MemoryAllocation allocation;
+				allocator.createBuffer(bufferCreateInfo, usages[random() % 4], buffer, allocation);
+
+				// Host visible memory must really be mapped there
+				if (allocation.mapped != nullptr)
+				{
+					static_cast<char*>(allocation.mapped)[0] = 1;
+					static_cast<char*>(allocation.mapped)[allocation.size - 1] = 1;
+				}
+				buffers.push_back(buffer);
+				allocations.push_back(allocation);
+			}
+			else
+			{
+				size_t index = random() % buffers.size();
+				allocator.destroyBuffer(buffers[index], allocations[index]);
+				buffers[index] = buffers.back();
+				allocations[index] = allocations.back();
+				buffers.pop_back();
+				allocations.pop_back();
+			}
+
+			uint32_t deviceAllocations = 0;
+			std::vector<MemoryAllocator::HeapStats> heapStats = allocator.getHeapStats();
+			for (const MemoryAllocator::HeapStats& heap : heapStats) deviceAllocations += heap.blockCount;
+			if (allocations.size() > result.peakAllocations)
+			{
+				result.peakAllocations = static_cast<uint32_t>(allocations.size());
+				result.peakHeapStats = heapStats;
+			}
+			result.peakDeviceAllocations = std::max(result.peakDeviceAllocations, deviceAllocations);
+		}
+		result.seconds = elapsedMs(begin, Clock::now()) / 1000.0;
+		result.overlapErrors = countOverlaps(allocations);
+	}
+	catch (const std::runtime_error& e)
+	{
+		result.failed = true;
+		result.error = e.what();
+	}
+
+	for (size_t i = 0; i < buffers.size(); ++i) allocator.destroyBuffer(buffers[i], allocations[i]);
+	renderer.clean();
+	return result;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Same frame recorded with more and more threads. Only the recording is timed: the GPU
+// part of the frame doesn't change with the thread count.
+static std::vector<RecordScalingPoint> runRecordScaling(const BenchmarkOptions& options, std::string& deviceName, std::string& error)
+{
+	const Scenario* scenario = nullptr;
+	for (const Scenario& candidate : scenarios)
+	{
+		if (strcmp(candidate.name, "huge-draws") == 0) scenario = &candidate;
+	}
+
+	std::vector<uint32_t> threadCounts;
+	uint32_t coreCount = std::max(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t threads = 1; threads < coreCount; threads *= 2) threadCounts.push_back(threads);
+	threadCounts.push_back(coreCount);
+
+	std::vector<RecordScalingPoint> points;
+	for (uint32_t threads : threadCounts)
+	{
+		VulkanRenderer renderer;
+		renderer.setDrawSettings(scenario->drawSettings);
+		renderer.setPipelineCachePath(BENCHMARK_PIPELINE_CACHE);
+		renderer.setThreadCount(threads);
+		if (renderer.initHeadless(scenario->width, scenario->height) == EXIT_FAILURE)
+		{
+			error = "renderer initialisation failed";
+			return points;
+		}
+		deviceName = renderer.getDeviceName();
+
+		try
+		{
+			for (uint32_t i = 0; i < options.warmupFrames; ++i) renderer.draw();
+
+			double totalMs = 0.0;
+			for (uint32_t i = 0; i < options.frames; ++i)
+			{
+				renderer.draw();
+				totalMs += renderer.getLastRecordMs();
+			}
+			points.push_back({ threads, options.frames > 0 ? totalMs / options.frames : 0.0 });
+		}
+		catch (const std::runtime_error& e)
+		{
+			error = e.what();
+		}
+		renderer.clean();
+		if (!error.empty()) break;
+	}
+	return points;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// The overdraw scenario under each present policy: what the frames in flight give in
+// throughput, and what they cost in latency
+static std::vector<PresentPolicyPoint> runPresentPolicies(const BenchmarkOptions& options, std::string& deviceName, std::string& error)
+{
+	const Scenario* scenario = nullptr;
+	for (const Scenario& candidate : scenarios)
+	{
+		if (strcmp(candidate.name, "overdraw") == 0) scenario = &candidate;
+	}
+
+	std::vector<PresentPolicyPoint> points;
+	for (PresentPolicy policy : { PresentPolicy::LowLatency, PresentPolicy::Balanced, PresentPolicy::Throughput })
+	{
+		VulkanRenderer renderer;
+		renderer.setPipelineCachePath(BENCHMARK_PIPELINE_CACHE);
+		renderer.setPresentPolicy(policy);
+		if (renderer.initHeadless(scenario->width, scenario->height) == EXIT_FAILURE)
+		{
+			error = "renderer initialisation failed";
+			return points;
+		}
+		deviceName = renderer.getDeviceName();
+
+		try
+		{
+			DrawSettings drawSettings = scenario->drawSettings;
+			drawSettings.instanceBufferIndex = renderer.createInstanceBuffer(makeInstances(drawSettings.instanceCount, scenario->instanceSpread));
+			renderer.setDrawSettings(drawSettings);
+			for (uint32_t i = 0; i < options.warmupFrames; ++i) renderer.draw();
+			renderer.waitIdle();
+			renderer.resetLatencyStats();
+
+			Clock::time_point runBegin = Clock::now();
+			for (uint32_t i = 0; i < options.frames; ++i) renderer.draw();
+			double latencyMs = renderer.getAverageLatencyMs();
+			renderer.waitIdle();
+			double seconds = elapsedMs(runBegin, Clock::now()) / 1000.0;
+			points.push_back({ policy, renderer.getFramesInFlight(), seconds > 0.0 ? options.frames / seconds : 0.0, latencyMs });
+		}
+		catch (const std::runtime_error& e)
+		{
+			error = e.what();
+		}
+		renderer.clean();
+		if (!error.empty()) break;
+	}
+	return points;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Both schedulers behind the same three calls, so the tests are the same code for each
+struct MutexQueueScheduler
+{
+	static constexpr const char* NAME = "mutex_queue";
+	ThreadPool pool;
+	void init(uint32_t threads) { pool.init(threads); }
+	void submit(std::function<void()> job) { pool.submit(std::move(job)); }
+	void wait() { pool.wait(); }
+};
+
+
+struct WorkStealingScheduler
+{
+	static constexpr const char* NAME = "work_stealing";
+	JobSystem jobs;
+	JobCounter counter;
+	void init(uint32_t threads) { jobs.init(threads); }
+	void submit(std::function<void()> job) { jobs.run(std::move(job), &counter); }
+	void wait() { jobs.wait(counter); }
+};
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// About a microsecond of arithmetic the compiler can't drop
+static uint32_t busyWork(uint32_t seed)
+{
+	uint32_t x = seed | 1;
+	for (uint32_t i = 0; i < 512; ++i)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+	}
+	return x;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Returns the number of jobs run
+template<typename Scheduler>
+static uint32_t runJobTest(Scheduler& scheduler, const char* test, uint32_t jobCount, std::vector<uint32_t>& results)
+{
+	if (strcmp(test, "empty") == 0)
+	{
+		for (uint32_t i = 0; i < jobCount; ++i) scheduler.submit([]() {});
+		scheduler.wait();
+		return jobCount;
+	}
+	if (strcmp(test, "work") == 0)
+	{
+		for (uint32_t i = 0; i < jobCount; ++i) scheduler.submit([&results, i]() { results[i] = busyWork(i); });
+		scheduler.wait();
+		return jobCount;
+	}
+
+	// Spawn: each job splits its range in two jobs, down to one leaf per item. Jobs are
+	// pushed from every thread at once, not only from the main one.
+	std::function<void(uint32_t, uint32_t)> split = [&](uint32_t first, uint32_t count)
+	{
+		if (count == 1)
+		{
+			results[first] = busyWork(first);
+			return;
+		}
+		uint32_t half = count / 2;
+		scheduler.submit([&split, first, half]() { split(first, half); });
+		scheduler.submit([&split, first, half, count]() { split(first + half, count - half); });
+	};
+	scheduler.submit([&split, jobCount]() { split(0, jobCount); });
+	scheduler.wait();
+	return 2 * jobCount - 1;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+template<typename Scheduler>
+static void runJobTests(uint32_t threads, uint32_t jobCount, std::vector<JobBenchmarkPoint>& points)
+{
+	Scheduler scheduler;
+	scheduler.init(threads);
+	std::vector<uint32_t> results(jobCount);
+
+	for (const char* test : { "empty", "work", "spawn" })
+	{
+		// Once untimed, so the workers are awake and the allocator has its memory
+		runJobTest(scheduler, test, std::min(jobCount, 1000u), results);
+
+		Clock::time_point begin = Clock::now();
+		uint32_t jobsRun = runJobTest(scheduler, test, jobCount, results);
+		points.push_back({ Scheduler::NAME, test, threads, jobsRun, elapsedMs(begin, Clock::now()) });
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static std::vector<JobBenchmarkPoint> runJobBenchmark(const BenchmarkOptions& options)
+{
+	std::vector<uint32_t> threadCounts;
+	uint32_t coreCount = std::max(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t threads = 1; threads < coreCount; threads *= 2) threadCounts.push_back(threads);
+	threadCounts.push_back(coreCount);
+
+	std::vector<JobBenchmarkPoint> points;
+	for (uint32_t threads : threadCounts)
+	{
+		runJobTests<MutexQueueScheduler>(threads, options.jobBenchJobs, points);
+		runJobTests<WorkStealingScheduler>(threads, options.jobBenchJobs, points);
+	}
+	return points;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// The baseline: what culling looks like straight on the instance data, one object at a time
+static uint32_t cullInstances(const Frustum& frustum, const std::vector<InstanceData>& instances, float radiusScale, uint32_t* visible)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < instances.size(); ++i)
+	{
+		const InstanceData& instance = instances[i];
+		float negativeRadius = -instance.scale * radiusScale;
+		bool inside = true;
+		for (const Frustum::Plane& plane : frustum.planes)
+		{
+			float distance = plane.normal[0] * instance.offset[0] + plane.normal[1] * instance.offset[1]
+				+ plane.normal[2] * instance.offset[2] + plane.distance;
+			inside &= distance >= negativeRadius;
+		}
+		if (inside) visible[count++] = i;
+	}
+	return count;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static std::vector<CullBenchmarkPoint> runCullBenchmark(const BenchmarkOptions& options)
+{
+	static const uint32_t RUNS = 20;
+	static const float TRIANGLE_RADIUS = 0.566f; // Bounding radius of the default triangle
+
+	uint32_t objectCount = options.cullBenchObjects;
+	std::vector<InstanceData> instances = makeInstances(objectCount, 2.0f);
+	CullBounds bounds;
+	bounds.resize(objectCount);
+	for (uint32_t i = 0; i < objectCount; ++i)
+	{
+		bounds.centerX[i] = instances[i].offset[0];
+		bounds.centerY[i] = instances[i].offset[1];
+		bounds.centerZ[i] = instances[i].offset[2];
+		bounds.radius[i] = instances[i].scale;
+	}
+
+	Frustum frustum = Frustum::clipSpace();
+	std::vector<uint32_t> visible(objectCount);
+
+	// Best of a few runs, the first one also brings the data into the caches it fits in
+	auto best = [&](const std::function<uint32_t()>& cull, CullBenchmarkPoint& point)
+	{
+		point.objects = objectCount;
+		point.ms = 0.0;
+		for (uint32_t run = 0; run < RUNS; ++run)
+		{
+			Clock::time_point begin = Clock::now();
+			point.visible = cull();
+			double ms = elapsedMs(begin, Clock::now());
+			if (run == 0 || ms < point.ms) point.ms = ms;
+		}
+	};
+
+	std::vector<CullBenchmarkPoint> points;
+	CullBenchmarkPoint aos{ "scalar", "aos" };
+	best([&]() { return cullInstances(frustum, instances, TRIANGLE_RADIUS, visible.data()); }, aos);
+	points.push_back(aos);
+
+	for (FrustumCuller::Kernel kernel : { FrustumCuller::Kernel::Scalar, FrustumCuller::Kernel::Sse, FrustumCuller::Kernel::Avx2 })
+	{
+		if (!FrustumCuller::isSupported(kernel)) continue;
+		FrustumCuller culler;
+		culler.setKernel(kernel);
+		CullBenchmarkPoint point{ FrustumCuller::getKernelName(kernel), "soa" };
+		best([&]() { return culler.cull(frustum, bounds, TRIANGLE_RADIUS, 0, objectCount, visible.data()); }, point);
+		points.push_back(point);
+	}
+	return points;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static std::string escapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\') escaped += '\\';
+		if (static_cast<unsigned char>(c) < 0x20) continue;
+		escaped += c;
+	}
+	return escaped;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static void writeCpuZones(std::ostringstream& json, const char* key, const std::vector<CpuTracer::ZoneSummary>& zones)
+{
+	json << ",\n      \"" << key << "\": [\n";
+	for (size_t z = 0; z < zones.size(); ++z)
+	{
+		const CpuTracer::ZoneSummary& zone = zones[z];
+		json << "        { \"name\": \"" << escapeJson(zone.name) << "\", \"stall\": " << (zone.category == CpuTracer::Category::Stall ? "true" : "false")
+			<< ", \"count\": " << zone.count << ", \"total\": " << zone.totalMs
+			<< ", \"mean\": " << zone.totalMs / zone.count << ", \"max\": " << zone.maxMs << " }"
+			<< (z + 1 < zones.size() ? "," : "") << "\n";
+	}
+	json << "      ]";
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Bucket width and counts, without the empty buckets at the end
+static std::string histogramJson(const FramePacer::Histogram& histogram)
+{
+	size_t used = histogram.counts.size();
+	while (used > 0 && histogram.counts[used - 1] == 0) --used;
+
+	std::ostringstream json;
+	json << "{ \"bucket_ms\": " << histogram.bucketMs << ", \"counts\": [";
+	for (size_t i = 0; i < used; ++i) json << (i > 0 ? ", " : "") << histogram.counts[i];
+	json << "] }";
+	return json.str();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static std::string writeReport(const std::vector<ScenarioResult>& results, const AllocatorStressResult* stress,
+	const std::vector<RecordScalingPoint>& recordScaling, const std::vector<JobBenchmarkPoint>& jobBenchmark,
+	const std::vector<CullBenchmarkPoint>& cullBenchmark, const std::vector<PresentPolicyPoint>& presentPolicies,
+	const BenchmarkOptions& options, const std::string& deviceName)
+{
+	std::ostringstream json;
+	json.setf(std::ios::fixed);
+	json.precision(4);
+
+	json << "{\n";
+	json << "  \"device\": \"" << escapeJson(deviceName) << "\",\n";
+	json << "  \"frames\": " << options.frames << ",\n";
+	json << "  \"warmup_frames\": " << options.warmupFrames << ",\n";
+	json << "  \"present_policy\": \"" << presentPolicyName(options.presentPolicy) << "\",\n";
+	json << "  \"target_fps\": " << options.targetFps << ",\n";
+	json << "  \"scenarios\": [\n";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const ScenarioResult& result = results[i];
+		const Scenario& scenario = *result.scenario;
+
+		json << "    {\n";
+		json << "      \"name\": \"" << scenario.name << "\",\n";
+		json << "      \"description\": \"" << scenario.description << "\",\n";
+		json << "      \"width\": " << scenario.width << ",\n";
+		json << "      \"height\": " << scenario.height << ",\n";
+		json << "      \"draw_calls\": " << scenario.drawSettings.drawCount << ",\n";
+		json << "      \"instances_per_draw\": " << scenario.drawSettings.instanceCount << ",\n";
+
+		if (result.failed)
+		{
+			json << "      \"error\": \"" << escapeJson(result.error) << "\"\n";
+		}
+		else
+		{
+			std::vector<double> sorted = result.frameTimesMs;
+			std::sort(sorted.begin(), sorted.end());
+			double sum = 0.0;
+			for (double frameTime : sorted) sum += frameTime;
+			double mean = sorted.empty() ? 0.0 : sum / sorted.size();
+			double fps = result.totalSeconds > 0.0 ? result.frameTimesMs.size() / result.totalSeconds : 0.0;
+
+			json << "      \"startup_ms\": { \"cold\": " << result.coldStartupMs << ", \"warm\": " << result.warmStartupMs
+				<< ", \"warm_cache_hit\": " << (result.warmCacheHit ? "true" : "false") << " },\n";
+			if (scenario.gridSize > 0)
+			{
+				json << "      \"mesh_vertices\": " << scenario.gridSize * scenario.gridSize << ",\n";
+				json << "      \"upload_ms\": " << result.uploadMs << ",\n";
+			}
+			if (scenario.streamKiB > 0)
+			{
+				json << "      \"streamed_mb_per_frame\": " << scenario.streamKiB / 1024.0 << ",\n";
+			}
+			json << "      \"upload_queue\": \"" << result.uploadQueue << "\",\n";
+			if (scenario.culling == Culling::Cpu)
+			{
+				json << "      \"visible_objects\": " << result.visibleObjects << ",\n";
+			}
+			if (scenario.culling == Culling::Gpu)
+			{
+				json << "      \"gpu_driven\": " << (result.gpuDriven ? "true" : "false") << ",\n";
+			}
+			const RenderGraph::Stats& graph = result.renderGraph;
+			json << "      \"render_graph\": { \"passes\": " << graph.passCount << ", \"culled_passes\": " << graph.culledPassCount
+				<< ", \"barriers\": " << graph.barrierCount << ", \"image_barriers\": " << graph.imageBarrierCount
+				<< ", \"subpass_dependencies\": " << graph.subpassDependencyCount
+				<< ", \"transient_mb\": " << graph.transientBytes / (1024.0 * 1024.0)
+				<< ", \"unaliased_transient_mb\": " << graph.unaliasedTransientBytes / (1024.0 * 1024.0) << " },\n";
+			if (scenario.particleCount > 0)
+			{
+				json << "      \"particles\": " << scenario.particleCount << ",\n";
+				json << "      \"compute_async\": " << (result.computeAsync ? "true" : "false") << ",\n";
+			}
+			json << "      \"frame_time_ms\": { ";
+			json << "\"mean\": " << mean << ", ";
+			json << "\"p50\": " << percentile(sorted, 50.0) << ", ";
+			json << "\"p95\": " << percentile(sorted, 95.0) << ", ";
+			json << "\"p99\": " << percentile(sorted, 99.0) << ", ";
+			json << "\"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << " },\n";
+
+			std::vector<double> sortedRecord = result.recordTimesMs;
+			std::sort(sortedRecord.begin(), sortedRecord.end());
+			double recordSum = 0.0;
+			for (double recordTime : sortedRecord) recordSum += recordTime;
+			json << "      \"record_threads\": " << result.recordThreads << ",\n";
+			json << "      \"record_ms\": { ";
+			json << "\"mean\": " << (sortedRecord.empty() ? 0.0 : recordSum / sortedRecord.size()) << ", ";
+			json << "\"p50\": " << percentile(sortedRecord, 50.0) << ", ";
+			json << "\"p99\": " << percentile(sortedRecord, 99.0) << ", ";
+			json << "\"max\": " << (sortedRecord.empty() ? 0.0 : sortedRecord.back()) << " },\n";
+			json << "      \"frames_in_flight\": " << result.framesInFlight << ",\n";
+			json << "      \"latency_ms\": " << result.latencyMs << ",\n";
+			const FramePacer::Stats& present = result.present;
+			json << "      \"present\": { \"latency_ms\": { \"mean\": " << present.meanLatencyMs
+				<< ", \"p50\": " << present.latency.percentile(50.0) << ", \"p99\": " << present.latency.percentile(99.0) << " }"
+				<< ", \"jitter_ms\": { \"mean\": " << present.meanJitterMs << ", \"p99\": " << present.jitter.percentile(99.0)
+				<< ", \"max\": " << present.maxJitterMs << " }"
+				<< ", \"latency_histogram\": " << histogramJson(present.latency)
+				<< ", \"jitter_histogram\": " << histogramJson(present.jitter) << " },\n";
+			json << "      \"fps\": " << fps;
+
+			if (!result.gpuZones.empty())
+			{
+				json << ",\n      \"gpu_zones_ms\": [\n";
+				for (size_t z = 0; z < result.gpuZones.size(); ++z)
+				{
+					const GpuProfiler::ZoneSummary& zone = result.gpuZones[z];
+					json << "        { \"name\": \"" << escapeJson(zone.name) << "\", \"count\": " << zone.count
+						<< ", \"mean\": " << zone.averageMs << ", \"max\": " << zone.maxMs << " }"
+						<< (z + 1 < result.gpuZones.size() ? "," : "") << "\n";
+				}
+				json << "      ]";
+			}
+
+			if (CpuTracer::isCompiledIn())
+			{
+				json << ",\n      \"cpu_stall_ms\": " << result.stallMs;
+				writeCpuZones(json, "cold_startup_zones_ms", result.coldStartupZones);
+				writeCpuZones(json, "warm_startup_zones_ms", result.warmStartupZones);
+				writeCpuZones(json, "cpu_zones_ms", result.frameZones);
+			}
+			json << "\n";
+		}
+
+		json << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	json << "  ]";
+
+	// Same work on one queue or two: how much the overlap buys
+	const ScenarioResult* serialCompute = nullptr;
+	const ScenarioResult* asyncCompute = nullptr;
+	for (const ScenarioResult& result : results)
+	{
+		if (result.failed || result.totalSeconds <= 0.0) continue;
+		if (strcmp(result.scenario->name, "compute-serial") == 0) serialCompute = &result;
+		if (strcmp(result.scenario->name, "compute-async") == 0) asyncCompute = &result;
+	}
+	if (serialCompute != nullptr && asyncCompute != nullptr)
+	{
+		json << ",\n  \"async_compute_gain\": " << serialCompute->totalSeconds / asyncCompute->totalSeconds;
+	}
+
+	// Same scene drawn whole or culled first, on the CPU or on the GPU
+	const ScenarioResult* allDrawn = nullptr;
+	const ScenarioResult* cpuCulled = nullptr;
+	const ScenarioResult* gpuCulled = nullptr;
+	for (const ScenarioResult& result : results)
+	{
+		if (result.failed || result.totalSeconds <= 0.0) continue;
+		if (strcmp(result.scenario->name, "offscreen-instances") == 0) allDrawn = &result;
+		if (strcmp(result.scenario->name, "cpu-culling") == 0) cpuCulled = &result;
+		if (strcmp(result.scenario->name, "gpu-culling") == 0 && result.gpuDriven) gpuCulled = &result;
+	}
+	if (allDrawn != nullptr && cpuCulled != nullptr)
+	{
+		json << ",\n  \"cpu_culling_gain\": " << allDrawn->totalSeconds / cpuCulled->totalSeconds;
+	}
+	if (allDrawn != nullptr && gpuCulled != nullptr)
+	{
+		json << ",\n  \"gpu_culling_gain\": " << allDrawn->totalSeconds / gpuCulled->totalSeconds;
+	}
+
+	// Same layers, all shaded or only the nearest after a depth prepass
+	const ScenarioResult* overdraw = nullptr;
+	const ScenarioResult* prepassed = nullptr;
+	for (const ScenarioResult& result : results)
+	{
+		if (result.failed || result.totalSeconds <= 0.0) continue;
+		if (strcmp(result.scenario->name, "overdraw") == 0) overdraw = &result;
+		if (strcmp(result.scenario->name, "depth-prepass") == 0) prepassed = &result;
+	}
+	if (overdraw != nullptr && prepassed != nullptr)
+	{
+		json << ",\n  \"depth_prepass_gain\": " << overdraw->totalSeconds / prepassed->totalSeconds;
+	}
+
+	if (!recordScaling.empty())
+	{
+		// Speedup against a single thread, linear scaling would be the thread count
+		json << ",\n  \"record_scaling\": [\n";
+		for (size_t p = 0; p < recordScaling.size(); ++p)
+		{
+			const RecordScalingPoint& point = recordScaling[p];
+			json << "    { \"threads\": " << point.threads << ", \"record_ms\": " << point.recordMs
+				<< ", \"speedup\": " << (point.recordMs > 0.0 ? recordScaling[0].recordMs / point.recordMs : 0.0) << " }"
+				<< (p + 1 < recordScaling.size() ? "," : "") << "\n";
+		}
+		json << "  ]";
+	}
+
+	if (!presentPolicies.empty())
+	{
+		// Headless, nothing is presented: the policies differ by their frames in flight only
+		json << ",\n  \"present_policies\": [\n";
+		for (size_t p = 0; p < presentPolicies.size(); ++p)
+		{
+			const PresentPolicyPoint& point = presentPolicies[p];
+			json << "    { \"policy\": \"" << presentPolicyName(point.policy) << "\", \"frames_in_flight\": " << point.framesInFlight
+				<< ", \"fps\": " << point.fps << ", \"latency_ms\": " << point.latencyMs << " }"
+				<< (p + 1 < presentPolicies.size() ? "," : "") << "\n";
+		}
+		json << "  ]";
+	}
+
+	if (!cullBenchmark.empty())
+	{
+		// Kernel throughput on one thread, against the scalar test on the instances as they are (AoS)
+		json << ",\n  \"frustum_culling\": [\n";
+		for (size_t p = 0; p < cullBenchmark.size(); ++p)
+		{
+			const CullBenchmarkPoint& point = cullBenchmark[p];
+			json << "    { \"kernel\": \"" << point.kernel << "\", \"layout\": \"" << point.layout << "\", \"objects\": " << point.objects
+				<< ", \"visible\": " << point.visible << ", \"ms\": " << point.ms
+				<< ", \"objects_per_ns\": " << (point.ms > 0.0 ? point.objects / (point.ms * 1e6) : 0.0)
+				<< ", \"speedup\": " << (point.ms > 0.0 ? cullBenchmark[0].ms / point.ms : 0.0) << " }"
+				<< (p + 1 < cullBenchmark.size() ? "," : "") << "\n";
+		}
+		json << "  ]";
+	}
+
+	if (!jobBenchmark.empty())
+	{
+		json << ",\n  \"job_system\": [\n";
+		for (size_t p = 0; p < jobBenchmark.size(); ++p)
+		{
+			const JobBenchmarkPoint& point = jobBenchmark[p];
+			json << "    { \"scheduler\": \"" << point.scheduler << "\", \"test\": \"" << point.test << "\", \"threads\": " << point.threads
+				<< ", \"jobs\": " << point.jobs << ", \"ms\": " << point.ms
+				<< ", \"ns_per_job\": " << (point.jobs > 0 ? point.ms * 1e6 / point.jobs : 0.0)
+				<< ", \"jobs_per_second\": " << (point.ms > 0.0 ? point.jobs * 1000.0 / point.ms : 0.0) << " }"
+				<< (p + 1 < jobBenchmark.size() ? "," : "") << "\n";
+		}
+		json << "  ]";
+	}
+
+	if (stress != nullptr)
+	{
+		json << ",\n  \"allocator_stress\": {\n";
+		json << "    \"operations\": " << stress->operations << ",\n";
+		if (stress->failed)
+		{
+			json << "    \"error\": \"" << escapeJson(stress->error) << "\"\n";
+		}
+		else
+		{
+			json << "    \"seconds\": " << stress->seconds << ",\n";
+			json << "    \"ns_per_operation\": " << (stress->operations > 0 ? stress->seconds * 1e9 / stress->operations : 0.0) << ",\n";
+			json << "    \"peak_allocations\": " << stress->peakAllocations << ",\n";
+			json << "    \"peak_device_allocations\": " << stress->peakDeviceAllocations << ",\n";
+			json << "    \"overlap_errors\": " << stress->overlapErrors << ",\n";
+			json << "    \"rebar\": " << (stress->reBar ? "true" : "false") << ",\n";
+			json << "    \"heaps_at_peak\": [\n";
+			for (size_t h = 0; h < stress->peakHeapStats.size(); ++h)
+			{
+				const MemoryAllocator::HeapStats& heap = stress->peakHeapStats[h];
+				json << "      { \"size_mb\": " << heap.heapSize / (1024.0 * 1024.0)
+					<< ", \"device_local\": " << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false")
+					<< ", \"blocks\": " << heap.blockCount << ", \"block_mb\": " << heap.blockBytes / (1024.0 * 1024.0)
+					<< ", \"allocations\": " << heap.allocationCount << ", \"used_mb\": " << heap.usedBytes / (1024.0 * 1024.0) << " }"
+					<< (h + 1 < stress->peakHeapStats.size() ? "," : "") << "\n";
+			}
+			json << "    ]\n";
+		}
+		json << "  }";
+	}
+
+	json << "\n}\n";
+	return json.str();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+// Every compiled shader of rsc/Shader, packed again each run so the archive is never older
+// than the shaders. Shaders are then loaded from the mapped archive, like a shipped build.
+static void packShaderArchive()
+{
+	std::vector<std::string> names;
+	std::error_code error;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator("rsc/Shader", error))
+	{
+		if (entry.path().extension() == ".spv") names.push_back("Shader/" + entry.path().filename().string());
+	}
+	if (names.empty())
+	{
+		std::cerr << "No SPIR-V in rsc/Shader, nothing to pack" << std::endl;
+		return;
+	}
+	std::sort(names.begin(), names.end());
+
+	try
+	{
+		AssetArchive::pack(SHADER_ARCHIVE, "rsc", names);
+		std::cerr << "Packed " << names.size() << " shaders into " << SHADER_ARCHIVE << std::endl;
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << "Could not pack the shaders, loose files are used: " << e.what() << std::endl;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static void printUsage()
+{
+	std::cerr << "Usage: VulkanBenchmark [--scenario <name>|all] [--frames N] [--warmup N] [--output report.json] [--gpu-trace <prefix>] [--cpu-trace <prefix>]"
+		" [--allocator-stress N] [--record-threads N] [--record-scaling] [--present-policy balanced|throughput|low-latency] [--present-policies]"
+		" [--target-fps N] [--job-bench N] [--cull-bench N]\n";
+	std::cerr << "Scenarios:";
+	for (const Scenario& scenario : scenarios) std::cerr << " " << scenario.name;
+	std::cerr << std::endl;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+static bool parseOptions(int argc, char* argv[], BenchmarkOptions& options)
+{
+	int i = 1;
+	try
+	{
+		for (; i < argc; ++i)
+		{
+			bool hasValue = i + 1 < argc;
+			if (strcmp(argv[i], "--scenario") == 0 && hasValue) options.scenario = argv[++i];
+			else if (strcmp(argv[i], "--frames") == 0 && hasValue) options.frames = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (strcmp(argv[i], "--warmup") == 0 && hasValue) options.warmupFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (strcmp(argv[i], "--output") == 0 && hasValue) options.outputPath = argv[++i];
+			else if (strcmp(argv[i], "--gpu-trace") == 0 && hasValue) options.gpuTracePrefix = argv[++i];
+			else if (strcmp(argv[i], "--cpu-trace") == 0 && hasValue) options.cpuTracePrefix = argv[++i];
+			else if (strcmp(argv[i], "--allocator-stress") == 0 && hasValue) options.allocatorOperations = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (strcmp(argv[i], "--record-threads") == 0 && hasValue) options.recordThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (strcmp(argv[i], "--record-scaling") == 0) options.recordScaling = true;
+			else if (strcmp(argv[i], "--present-policy") == 0 && hasValue && parsePresentPolicy(argv[i + 1], options.presentPolicy)) ++i;
+			else if (strcmp(argv[i], "--present-policies") == 0) options.presentPolicies = true;
+			else if (strcmp(argv[i], "--target-fps") == 0 && hasValue) options.targetFps = std::stod(argv[++i]);
+			else if (strcmp(argv[i], "--job-bench") == 0 && hasValue) options.jobBenchJobs = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (strcmp(argv[i], "--cull-bench") == 0 && hasValue) options.cullBenchObjects = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else
+			{
+				printUsage();
+				return false;
+			}
+		}
+	}
+	catch (const std::logic_error&)
+	{
+		// std::invalid_argument or std::out_of_range from a number that doesn't parse
+		std::cerr << "Invalid value " << argv[i] << " for " << argv[i - 1] << std::endl;
+		printUsage();
+		return false;
+	}
+	return true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	if (!parseOptions(argc, argv, options)) return EXIT_FAILURE;
+	packShaderArchive();
+
+	std::vector<ScenarioResult> results;
+	std::string deviceName;
+	bool anyFailed = false;
+
+	for (const Scenario& scenario : scenarios)
+	{
+		if (options.scenario != "all" && options.scenario != scenario.name) continue;
+
+		std::cerr << "Running " << scenario.name << "..." << std::endl;
+		results.push_back(runScenario(scenario, options, deviceName));
+		if (results.back().failed)
+		{
+			std::cerr << "  failed: " << results.back().error << std::endl;
+			anyFailed = true;
+		}
+	}
+
+	AllocatorStressResult stress;
+	if (options.allocatorOperations > 0)
+	{
+		std::cerr << "Running allocator stress..." << std::endl;
+		stress = runAllocatorStress(options, deviceName);
+		if (stress.failed || stress.overlapErrors > 0)
+		{
+			std::cerr << "  failed: " << (stress.failed ? stress.error : "overlapping allocations") << std::endl;
+			anyFailed = true;
+		}
+	}
+
+	std::vector<RecordScalingPoint> recordScaling;
+	if (options.recordScaling)
+	{
+		std::cerr << "Running record scaling..." << std::endl;
+		std::string error;
+		recordScaling = runRecordScaling(options, deviceName, error);
+		if (!error.empty())
+		{
+			std::cerr << "  failed: " << error << std::endl;
+			anyFailed = true;
+		}
+	}
+
+	std::vector<PresentPolicyPoint> presentPolicies;
+	if (options.presentPolicies)
+	{
+		std::cerr << "Running present policies..." << std::endl;
+		std::string error;
+		presentPolicies = runPresentPolicies(options, deviceName, error);
+		if (!error.empty())
+		{
+			std::cerr << "  failed: " << error << std::endl;
+			anyFailed = true;
+		}
+	}
+
+	std::vector<JobBenchmarkPoint> jobBenchmark;
+	if (options.jobBenchJobs > 0)
+	{
+		std::cerr << "Running job system benchmark..." << std::endl;
+		jobBenchmark = runJobBenchmark(options);
+	}
+
+	std::vector<CullBenchmarkPoint> cullBenchmark;
+	if (options.cullBenchObjects > 0)
+	{
+		std::cerr << "Running frustum culling benchmark..." << std::endl;
+		cullBenchmark = runCullBenchmark(options);
+	}
+
+	if (results.empty() && options.allocatorOperations == 0 && !options.recordScaling && !options.presentPolicies && options.jobBenchJobs == 0 && options.cullBenchObjects == 0)
+	{
+		std::cerr << "Unknown scenario: " << options.scenario << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::string report = writeReport(results, options.allocatorOperations > 0 ? &stress : nullptr, recordScaling, jobBenchmark, cullBenchmark, presentPolicies, options, deviceName);
+	if (options.outputPath.empty())
+	{
+		std::cout << report;
+	}
+	else
+	{
+		std::ofstream file{ options.outputPath };
+		if (!file.is_open())
+		{
+			std::cerr << "Failed to open " << options.outputPath << std::endl;
+			return EXIT_FAILURE;
+		}
+		file << report;
+	}
+
+	return anyFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,317 @@
+#include "AssetArchive.h"
+#include "FileUtilities.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+AssetArchive::~AssetArchive()
+{
+	close();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool AssetArchive::open(const std::string& path, JobSystem* jobs)
+{
+	close();
+
+	// -- MAPPING -- //
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		throw std::runtime_error("Failed to map asset archive " + path);
+	}
+	fileHandle = file;
+	mappingHandle = mapping;
+	mappedSize = static_cast<size_t>(size.QuadPart);
+	mappedData = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0) return false;
+
+	struct stat fileStat;
+	void* mapped = MAP_FAILED;
+	if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	}
+
+	// The mapping keeps its own reference to the file
+	::close(file);
+	if (mapped == MAP_FAILED)
+	{
+		throw std::runtime_error("Failed to map asset archive " + path);
+	}
+	mappedSize = static_cast<size_t>(fileStat.st_size);
+	mappedData = static_cast<const char*>(mapped);
+#endif
+
+	if (mappedData == nullptr)
+	{
+		close();
+		throw std::runtime_error("Failed to map asset archive " + path);
+	}
+
+
+	// -- VALIDATION -- //
+	// Everything is checked once here, so lookups can trust the index afterwards
+	const Header* header = reinterpret_cast<const Header*>(mappedData);
+	bool valid = mappedSize >= sizeof(Header) && header->magic == MAGIC && header->version == VERSION && header->fileSize == mappedSize;
+
+	size_t namesStart = sizeof(Header) + static_cast<size_t>(valid ? header->entryCount : 0) * sizeof(Entry);
+	valid = valid && namesStart + header->namesSize <= mappedSize;
+	if (valid)
+	{
+		entries = reinterpret_cast<const Entry*>(mappedData + sizeof(Header));
+		names = mappedData + namesStart;
+		entryCount = header->entryCount;
+		for (uint32_t i = 0; i < entryCount && valid; ++i)
+		{
+			const Entry& entry = entries[i];
+			valid = entry.offset % DATA_ALIGNMENT == 0 && entry.offset <= mappedSize && entry.size <= mappedSize - entry.offset
+				&& static_cast<uint64_t>(entry.nameOffset) + entry.nameLength <= header->namesSize
+				&& (i == 0 || entries[i - 1].nameHash <= entry.nameHash);
+		}
+	}
+
+	if (!valid)
+	{
+		close();
+		throw std::runtime_error("Invalid asset archive " + path);
+	}
+
+#ifndef NDEBUG
+	// Catches damaged files early in debug builds, too slow to do on every release startup
+	if (!verify(jobs))
+	{
+		close();
+		throw std::runtime_error("Asset archive " + path + " failed its content check");
+	}
+#endif
+
+	return true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void AssetArchive::close()
+{
+	if (mappedData != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mappedData);
+#else
+		munmap(const_cast<char*>(mappedData), mappedSize);
+#endif
+	}
+#ifdef _WIN32
+	if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+	if (fileHandle != nullptr) CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#endif
+
+	mappedData = nullptr;
+	mappedSize = 0;
+	entries = nullptr;
+	names = nullptr;
+	entryCount = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool AssetArchive::find(const std::string& name, Asset& asset) const
+{
+	if (!isOpen()) return false;
+
+	std::string normalized = normalizeName(name);
+	uint64_t nameHash = hash(normalized.data(), normalized.size());
+
+	// Binary search on the hash, then compare the names in case of collision
+	const Entry* first = std::lower_bound(entries, entries + entryCount, nameHash,
+		[](const Entry& entry, uint64_t value) { return entry.nameHash < value; });
+	for (const Entry* entry = first; entry != entries + entryCount && entry->nameHash == nameHash; ++entry)
+	{
+		if (entry->nameLength == normalized.size() && memcmp(names + entry->nameOffset, normalized.data(), normalized.size()) == 0)
+		{
+			asset.data = mappedData + entry->offset;
+			asset.size = static_cast<size_t>(entry->size);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool AssetArchive::verify(JobSystem* jobs) const
+{
+	// Entries are checked on their own, any number of them at once
+	std::atomic<bool> valid{ true };
+	auto verifyEntries = [this, &valid](uint32_t first, uint32_t last)
+	{
+		for (uint32_t i = first; i < last && valid.load(std::memory_order_relaxed); ++i)
+		{
+			const Entry& entry = entries[i];
+			if (hash(mappedData + entry.offset, static_cast<size_t>(entry.size)) != entry.contentHash
+				|| hash(names + entry.nameOffset, entry.nameLength) != entry.nameHash)
+			{
+				valid = false;
+			}
+		}
+	};
+
+	if (jobs != nullptr) jobs->parallelFor(entryCount, 1, verifyEntries);
+	else verifyEntries(0, entryCount);
+	return valid;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void AssetArchive::pack(const std::string& archivePath, const std::string& rootDirectory, const std::vector<std::string>& assetNames)
+{
+	struct PackedFile
+	{
+		std::string name;
+		std::vector<char> content;
+		Entry entry;
+	};
+
+	// Read every file, the archive is only written if they all exist
+	std::vector<PackedFile> files;
+	std::string names;
+	for (const std::string& assetName : assetNames)
+	{
+		PackedFile packed;
+		packed.name = normalizeName(assetName);
+
+		std::string filePath = rootDirectory.empty() ? packed.name : rootDirectory + "/" + packed.name;
+		std::ifstream file{ filePath, std::ios::binary | std::ios::ate };
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to open " + filePath);
+		}
+		packed.content.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(packed.content.data(), packed.content.size());
+
+		packed.entry = {};
+		packed.entry.nameHash = hash(packed.name.data(), packed.name.size());
+		packed.entry.contentHash = hash(packed.content.data(), packed.content.size());
+		packed.entry.size = packed.content.size();
+		packed.entry.nameOffset = static_cast<uint32_t>(names.size());
+		packed.entry.nameLength = static_cast<uint32_t>(packed.name.size());
+		names += packed.name;
+		files.push_back(std::move(packed));
+	}
+
+	std::sort(files.begin(), files.end(), [](const PackedFile& a, const PackedFile& b)
+	{
+		return a.entry.nameHash < b.entry.nameHash;
+	});
+
+	// Lay the data out after the index, each entry aligned
+	auto align = [](uint64_t offset) { return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT; };
+	uint64_t offset = align(sizeof(Header) + files.size() * sizeof(Entry) + names.size());
+	for (PackedFile& packed : files)
+	{
+		packed.entry.offset = offset;
+		offset = align(offset + packed.entry.size);
+	}
+
+	Header header{};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.entryCount = static_cast<uint32_t>(files.size());
+	header.namesSize = static_cast<uint32_t>(names.size());
+	header.fileSize = offset;
+
+	std::ofstream archive{ archivePath, std::ios::binary | std::ios::trunc };
+	if (!archive.is_open())
+	{
+		throw std::runtime_error("Failed to create " + archivePath);
+	}
+	archive.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+	for (const PackedFile& packed : files)
+	{
+		archive.write(reinterpret_cast<const char*>(&packed.entry), sizeof(Entry));
+	}
+	archive.write(names.data(), names.size());
+
+	const char padding[DATA_ALIGNMENT]{};
+	for (const PackedFile& packed : files)
+	{
+		archive.write(padding, packed.entry.offset - static_cast<uint64_t>(archive.tellp()));
+		archive.write(packed.content.data(), packed.content.size());
+	}
+	archive.write(padding, header.fileSize - static_cast<uint64_t>(archive.tellp()));
+
+	if (!archive)
+	{
+		throw std::runtime_error("Failed to write " + archivePath);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint64_t AssetArchive::hash(const char* data, size_t size)
+{
+	// FNV-1a, good enough for lookups and to detect damaged data
+	return hashBytes(data, size);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::string AssetArchive::normalizeName(const std::string& name)
+{
+	// Same name whatever the separator used, and no leading "./"
+	std::string normalized = name;
+	std::replace(normalized.begin(), normalized.end(), '\\', '/');
+	while (normalized.compare(0, 2, "./") == 0) normalized.erase(0, 2);
+	return normalized;
+}
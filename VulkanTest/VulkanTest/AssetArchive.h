@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+// Packed, read-only asset archive.
+// All the assets live in a single file that is memory mapped: looking an asset up gives a
+// pointer straight into the mapping, nothing is read or copied until the bytes are used.
+//
+// File layout (little endian):
+//   Header
+//   Entry[entryCount]     sorted by nameHash, for binary search
+//   Names                 entry names, not null terminated
+//   Data                  each entry starts on a DATA_ALIGNMENT boundary
+//
+// Names are paths relative to the packed root, with '/' separators ("Shader/vert.spv").
+class AssetArchive
+{
+public:
+
+	static const uint32_t DATA_ALIGNMENT = 16; // SPIR-V needs 4, 16 keeps room for SIMD loads
+
+	struct Asset
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+	};
+
+	AssetArchive() = default;
+	~AssetArchive();
+	AssetArchive(const AssetArchive&) = delete;
+	AssetArchive& operator=(const AssetArchive&) = delete;
+
+	// Throws if the file exists but is not a valid archive. Returns false if there is no file.
+	// The content check of debug builds is spread over jobs when a job system is given.
+	bool open(const std::string& path, JobSystem* jobs = nullptr);
+	void close();
+	bool isOpen() const { return mappedData != nullptr; }
+
+	// Returns false if there is no asset with this name
+	bool find(const std::string& name, Asset& asset) const;
+
+	// Check every entry against its content hash (reads the whole archive)
+	bool verify(JobSystem* jobs = nullptr) const;
+
+	// Pack files found under rootDirectory. Names are given relative to rootDirectory.
+	static void pack(const std::string& archivePath, const std::string& rootDirectory, const std::vector<std::string>& names);
+
+	static uint64_t hash(const char* data, size_t size);
+
+private:
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t namesSize;
+		uint64_t fileSize;
+	};
+
+	struct Entry
+	{
+		uint64_t nameHash;
+		uint64_t contentHash;
+		uint64_t offset; // From the start of the file
+		uint64_t size;
+		uint32_t nameOffset; // In the names block
+		uint32_t nameLength;
+	};
+
+	static const uint32_t MAGIC = 0x4B505456; // "VTPK"
+	static const uint32_t VERSION = 1;
+
+	const char* mappedData = nullptr;
+	size_t mappedSize = 0;
+	const Entry* entries = nullptr;
+	const char* names = nullptr;
+	uint32_t entryCount = 0;
+
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+
+	static std::string normalizeName(const std::string& name);
+};
@@ -0,0 +1,269 @@
+#include "BindlessDescriptors.h"
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+	// Everything that records draws or dispatches can read them
+	const VkShaderStageFlags BINDLESS_STAGES = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void BindlessDescriptors::init(VkDevice logicalDevice, DeletionQueue& queue, bool descriptorIndexing, uint32_t maxBuffers, uint32_t maxTextures)
+{
+	device = logicalDevice;
+	deletionQueue = &queue;
+	supported = descriptorIndexing;
+	buffers = IndexArray{};
+	textures = IndexArray{};
+	stats = Stats{};
+
+	if (!supported)
+	{
+		// An empty layout: set 0 of the pipeline layouts exists, nothing is bound to it
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &layout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create the bindless descriptor set layout");
+		}
+		return;
+	}
+
+	buffers.capacity = maxBuffers;
+	textures.capacity = maxTextures;
+
+	VkDescriptorSetLayoutBinding bindings[2]{};
+	bindings[0].binding = BUFFER_BINDING;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].descriptorCount = maxBuffers;
+	bindings[0].stageFlags = BINDLESS_STAGES;
+	bindings[1].binding = TEXTURE_BINDING;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].descriptorCount = maxTextures;
+	bindings[1].stageFlags = BINDLESS_STAGES;
+
+	// Written while bound, indices only in use by frames in flight are left alone, and
+	// indices nothing was written to yet don't have to be valid
+	const VkDescriptorBindingFlags bindingFlag = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+		VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+	VkDescriptorBindingFlags bindingFlags[2] = { bindingFlag, bindingFlag };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.bindingCount = 2;
+	bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.pNext = &bindingFlagsInfo;
+	layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutCreateInfo.bindingCount = 2;
+	layoutCreateInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the bindless descriptor set layout");
+	}
+
+	VkDescriptorPoolSize poolSizes[2] =
+	{
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxBuffers },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxTextures }
+	};
+
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolCreateInfo.maxSets = 1;
+	poolCreateInfo.poolSizeCount = 2;
+	poolCreateInfo.pPoolSizes = poolSizes;
+	if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the bindless descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = pool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &layout;
+	if (vkAllocateDescriptorSets(device, &allocateInfo, &set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate the bindless descriptor set");
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void BindlessDescriptors::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+
+	// The set goes with its pool
+	if (pool != VK_NULL_HANDLE) vkDestroyDescriptorPool(device, pool, nullptr);
+	if (layout != VK_NULL_HANDLE) vkDestroyDescriptorSetLayout(device, layout, nullptr);
+	pool = VK_NULL_HANDLE;
+	layout = VK_NULL_HANDLE;
+	set = VK_NULL_HANDLE;
+
+	pendingWrites.clear();
+	pendingBufferInfos.clear();
+	pendingImageInfos.clear();
+	device = VK_NULL_HANDLE;
+	deletionQueue = nullptr;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t BindlessDescriptors::addBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	if (!supported) return NO_INDEX;
+
+	uint32_t index = takeIndex(buffers, "buffers");
+	pendingWrites.push_back({ BUFFER_BINDING, index, static_cast<uint32_t>(pendingBufferInfos.size()) });
+	pendingBufferInfos.push_back({ buffer, offset, range });
+	++stats.bufferCount;
+	return index;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t BindlessDescriptors::addTexture(VkImageView view, VkSampler sampler, VkImageLayout imageLayout)
+{
+	if (!supported) return NO_INDEX;
+
+	uint32_t index = takeIndex(textures, "textures");
+	pendingWrites.push_back({ TEXTURE_BINDING, index, static_cast<uint32_t>(pendingImageInfos.size()) });
+	pendingImageInfos.push_back({ sampler, view, imageLayout });
+	++stats.textureCount;
+	return index;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void BindlessDescriptors::removeBuffer(uint32_t index)
+{
+	if (index == NO_INDEX) return;
+	--stats.bufferCount;
+	retireIndex(buffers, index);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void BindlessDescriptors::removeTexture(uint32_t index)
+{
+	if (index == NO_INDEX) return;
+	--stats.textureCount;
+	retireIndex(textures, index);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void BindlessDescriptors::flushUpdates()
+{
+	if (pendingWrites.empty()) return;
+
+	// Writes one after the other in the same binding, on indices and infos that follow each
+	// other (what adding several in a row gives), become a single write of several descriptors
+	writes.clear();
+	for (size_t i = 0; i < pendingWrites.size(); ++i)
+	{
+		const PendingWrite& pending = pendingWrites[i];
+		if (i > 0)
+		{
+			const PendingWrite& previous = pendingWrites[i - 1];
+			if (pending.binding == previous.binding && pending.index == previous.index + 1 && pending.info == previous.info + 1)
+			{
+				++writes.back().descriptorCount;
+				continue;
+			}
+		}
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = pending.binding;
+		write.dstArrayElement = pending.index;
+		write.descriptorCount = 1;
+		if (pending.binding == BUFFER_BINDING)
+		{
+			write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			write.pBufferInfo = &pendingBufferInfos[pending.info];
+		}
+		else
+		{
+			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			write.pImageInfo = &pendingImageInfos[pending.info];
+		}
+		writes.push_back(write);
+	}
+
+	// In order: an index written twice keeps the last one
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	++stats.updateCalls;
+	stats.descriptorWrites += pendingWrites.size();
+
+	pendingWrites.clear();
+	pendingBufferInfos.clear();
+	pendingImageInfos.clear();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t BindlessDescriptors::takeIndex(IndexArray& array, const char* what)
+{
+	if (!array.freeIndices.empty())
+	{
+		uint32_t index = array.freeIndices.back();
+		array.freeIndices.pop_back();
+		return index;
+	}
+	if (array.next >= array.capacity)
+	{
+		throw std::runtime_error(std::string("No bindless index left for ") + what);
+	}
+	return array.next++;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void BindlessDescriptors::retireIndex(IndexArray& array, uint32_t index)
+{
+	// Frames in flight may still read the descriptor: nothing writes over it until they're done.
+	// Without a deletion queue (clean up after it was flushed), it's free right away.
+	IndexArray* indices = &array;
+	if (deletionQueue == nullptr)
+	{
+		indices->freeIndices.push_back(index);
+		return;
+	}
+	deletionQueue->push([indices, index]() { indices->freeIndices.push_back(index); });
+}
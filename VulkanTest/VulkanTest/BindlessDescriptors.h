@@ -0,0 +1,92 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include "DeletionQueue.h"
+
+// Bindless descriptors: a single set for the whole renderer, bound once per command buffer.
+// Buffers and textures are added to it once, when they are made, and shaders find them by
+// index (given in push constants, instance data...): draws bind no descriptors at all.
+//
+// Needs VK_EXT_descriptor_indexing. The arrays are update-after-bind and partially bound:
+// indices are written while frames in flight use the set (never ones they read), and what
+// was never written is never looked at. Writes wait in a batch, flushUpdates sends them with
+// a single vkUpdateDescriptorSets before the frame is submitted. Without descriptor indexing
+// the layout has no bindings, pipeline layouts stay the same, and nothing gets an index.
+//
+// Removed indices go through the deletion queue before they are handed out again: frames in
+// flight may still read them.
+//
+// In GLSL (GL_EXT_nonuniform_qualifier), the set being the one of the pipeline layout:
+//   layout(set = 0, binding = 0) readonly buffer Buffers { uint words[]; } buffers[];
+//   layout(set = 0, binding = 1) uniform sampler2D textures[];
+class BindlessDescriptors
+{
+public:
+
+	static const uint32_t NO_INDEX = ~0u;
+	static const uint32_t BUFFER_BINDING = 0; // Storage buffers
+	static const uint32_t TEXTURE_BINDING = 1; // Combined image samplers
+
+	struct Stats
+	{
+		uint32_t bufferCount = 0; // In use
+		uint32_t textureCount = 0;
+		uint64_t updateCalls = 0; // vkUpdateDescriptorSets calls, one per flush with writes
+		uint64_t descriptorWrites = 0;
+	};
+
+	// Capacities have to fit the device's update-after-bind limits
+	void init(VkDevice device, DeletionQueue& deletionQueue, bool descriptorIndexing, uint32_t maxBuffers, uint32_t maxTextures);
+	void destroy(); // After the deletion queue was flushed
+
+	bool isSupported() const { return supported; }
+	VkDescriptorSetLayout getLayout() const { return layout; }
+	VkDescriptorSet getSet() const { return set; } // Null without support
+
+	// NO_INDEX without support, throws when the array is full
+	uint32_t addBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+	uint32_t addTexture(VkImageView view, VkSampler sampler, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	void removeBuffer(uint32_t index);
+	void removeTexture(uint32_t index);
+
+	// Before submitting the first frame that reads what was added
+	void flushUpdates();
+
+	const Stats& getStats() const { return stats; }
+
+private:
+
+	// Indices of one binding
+	struct IndexArray
+	{
+		uint32_t capacity = 0;
+		uint32_t next = 0; // Never handed out from here on
+		std::vector<uint32_t> freeIndices;
+	};
+
+	struct PendingWrite
+	{
+		uint32_t binding;
+		uint32_t index;
+		uint32_t info; // In pendingBufferInfos or pendingImageInfos
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	DeletionQueue* deletionQueue = nullptr;
+	bool supported = false;
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+
+	IndexArray buffers;
+	IndexArray textures;
+	std::vector<PendingWrite> pendingWrites; // In the order they were made, a later one wins
+	std::vector<VkDescriptorBufferInfo> pendingBufferInfos;
+	std::vector<VkDescriptorImageInfo> pendingImageInfos;
+	std::vector<VkWriteDescriptorSet> writes; // Reused by each flush
+	Stats stats;
+
+	uint32_t takeIndex(IndexArray& array, const char* what);
+	void retireIndex(IndexArray& array, uint32_t index);
+};
@@ -0,0 +1,188 @@
+#include "CpuTracer.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+
+namespace CpuTracer
+{
+	// Ring of one thread. Only the owner thread writes, the index is published with release
+	// ordering so a reader sees complete events up to it. The owner never waits for readers:
+	// snapshot checks the index again after copying, for slots written over meanwhile.
+	struct ThreadBuffer
+	{
+		Event events[RING_CAPACITY];
+		std::atomic<uint64_t> writeIndex{ 0 };
+		std::atomic<uint64_t> clearedIndex{ 0 }; // Events before this one were cleared
+		uint32_t threadIndex = 0;
+		ThreadBuffer* next = nullptr;
+	};
+
+	static std::atomic<ThreadBuffer*> bufferList{ nullptr };
+	static std::atomic<uint32_t> threadCount{ 0 };
+
+
+	/*------------------------------------------------------------------------------------------------------------------------*/
+	/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+	static ThreadBuffer* registerThread()
+	{
+		// Buffers live until the end of the program, so the trace outlives worker threads
+		ThreadBuffer* buffer = new ThreadBuffer();
+		buffer->threadIndex = threadCount.fetch_add(1);
+
+		// Lock-free push at the head of the list
+		buffer->next = bufferList.load(std::memory_order_relaxed);
+		while (!bufferList.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed))
+		{
+		}
+		return buffer;
+	}
+
+
+	/*------------------------------------------------------------------------------------------------------------------------*/
+	/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+	void record(const char* name, uint64_t startNs, uint64_t endNs, Category category)
+	{
+		thread_local ThreadBuffer* buffer = registerThread();
+
+		uint64_t index = buffer->writeIndex.load(std::memory_order_relaxed);
+		buffer->events[index & (RING_CAPACITY - 1)] = { name, startNs, endNs, category };
+		buffer->writeIndex.store(index + 1, std::memory_order_release);
+	}
+
+
+	/*------------------------------------------------------------------------------------------------------------------------*/
+	/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+	void clear()
+	{
+		for (ThreadBuffer* buffer = bufferList.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next)
+		{
+			buffer->clearedIndex.store(buffer->writeIndex.load(std::memory_order_acquire), std::memory_order_relaxed);
+		}
+	}
+
+
+	/*------------------------------------------------------------------------------------------------------------------------*/
+	/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+	std::vector<Event> snapshot(std::vector<uint32_t>* threadIndices)
+	{
+		// Events and their thread are sorted together
+		std::vector<std::pair<Event, uint32_t>> collected;
+		for (ThreadBuffer* buffer = bufferList.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next)
+		{
+			uint64_t end = buffer->writeIndex.load(std::memory_order_acquire);
+			uint64_t begin = std::max(buffer->clearedIndex.load(std::memory_order_relaxed), end > RING_CAPACITY ? end - RING_CAPACITY : 0);
+			size_t firstCopied = collected.size();
+			for (uint64_t i = begin; i < end; ++i)
+			{
+				collected.push_back({ buffer->events[i & (RING_CAPACITY - 1)], buffer->threadIndex });
+			}
+
+			// The owner kept writing while we copied. Like a seqlock, the index is read again after
+			// the copy: events whose slot it may have been writing over meanwhile are dropped.
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint64_t writing = buffer->writeIndex.load(std::memory_order_relaxed);
+			if (writing >= begin + RING_CAPACITY)
+			{
+				uint64_t overwritten = std::min(writing - RING_CAPACITY + 1 - begin, end - begin);
+				collected.erase(collected.begin() + firstCopied, collected.begin() + firstCopied + static_cast<size_t>(overwritten));
+			}
+		}
+
+		std::sort(collected.begin(), collected.end(), [](const std::pair<Event, uint32_t>& a, const std::pair<Event, uint32_t>& b)
+		{
+			return a.first.startNs < b.first.startNs;
+		});
+
+		std::vector<Event> events;
+		events.reserve(collected.size());
+		if (threadIndices != nullptr) threadIndices->clear();
+		for (const auto& entry : collected)
+		{
+			events.push_back(entry.first);
+			if (threadIndices != nullptr) threadIndices->push_back(entry.second);
+		}
+		return events;
+	}
+
+
+	/*------------------------------------------------------------------------------------------------------------------------*/
+	/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+	std::vector<ZoneSummary> summarize()
+	{
+		std::vector<ZoneSummary> summaries;
+		std::map<std::string, size_t> indexByName;
+		for (const Event& event : snapshot())
+		{
+			auto found = indexByName.find(event.name);
+			if (found == indexByName.end())
+			{
+				found = indexByName.emplace(event.name, summaries.size()).first;
+				summaries.push_back({ event.name, event.category, 0, 0.0, 0.0 });
+			}
+
+			double durationMs = (event.endNs - event.startNs) / 1e6;
+			ZoneSummary& summary = summaries[found->second];
+			summary.totalMs += durationMs;
+			summary.maxMs = std::max(summary.maxMs, durationMs);
+			++summary.count;
+		}
+		return summaries;
+	}
+
+
+	/*------------------------------------------------------------------------------------------------------------------------*/
+	/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+	double getStallTimeMs()
+	{
+		double stallMs = 0.0;
+		for (const Event& event : snapshot())
+		{
+			if (event.category == Category::Stall) stallMs += (event.endNs - event.startNs) / 1e6;
+		}
+		return stallMs;
+	}
+
+
+	/*------------------------------------------------------------------------------------------------------------------------*/
+	/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+	bool exportChromeTrace(const std::string& path)
+	{
+		std::ofstream file{ path };
+		if (!file.is_open()) return false;
+
+		std::vector<uint32_t> threadIndices;
+		std::vector<Event> events = snapshot(&threadIndices);
+
+		// Complete events ("ph": "X"), times are in microseconds. pid 0 is the CPU, so the
+		// trace can be merged with the GPU profiler one (pid 1).
+		file.setf(std::ios::fixed);
+		file.precision(3);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}}";
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			const Event& event = events[i];
+			file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.category == Category::Stall ? "stall" : "cpu")
+				<< "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << threadIndices[i]
+				<< ",\"ts\":" << event.startNs / 1000.0
+				<< ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+		}
+		file << "\n]}\n";
+		return true;
+	}
+}
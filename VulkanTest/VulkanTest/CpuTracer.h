@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Low overhead CPU tracing.
+// Each thread writes its zones to its own fixed size ring buffer: no lock, no allocation on
+// the hot path, only two clock reads and a store per zone. Buffers are registered once per
+// thread in a lock-free list, and read back when exporting.
+//
+// Zones are only compiled in when ENABLE_CPU_TRACING is defined, otherwise CPU_ZONE and
+// CPU_STALL_ZONE expand to nothing and cost nothing.
+//
+// CPU_STALL_ZONE is for time spent waiting on the GPU (timeline waits...), it is reported apart.
+
+#ifdef ENABLE_CPU_TRACING
+#define CPU_TRACE_CONCAT_INNER(a, b) a##b
+#define CPU_TRACE_CONCAT(a, b) CPU_TRACE_CONCAT_INNER(a, b)
+#define CPU_ZONE(name) CpuTracer::ScopedZone CPU_TRACE_CONCAT(cpuZone, __LINE__){ name, CpuTracer::Category::Work }
+#define CPU_STALL_ZONE(name) CpuTracer::ScopedZone CPU_TRACE_CONCAT(cpuZone, __LINE__){ name, CpuTracer::Category::Stall }
+#else
+#define CPU_ZONE(name)
+#define CPU_STALL_ZONE(name)
+#endif
+
+namespace CpuTracer
+{
+	enum class Category : uint8_t
+	{
+		Work,
+		Stall
+	};
+
+	struct Event
+	{
+		const char* name; // Must be a string literal, only the pointer is stored
+		uint64_t startNs;
+		uint64_t endNs;
+		Category category;
+	};
+
+	struct ZoneSummary
+	{
+		std::string name;
+		Category category;
+		uint32_t count;
+		double totalMs;
+		double maxMs;
+	};
+
+	// Events kept per thread, older ones get overwritten
+	static const uint32_t RING_CAPACITY = 1 << 16;
+
+	constexpr bool isCompiledIn()
+	{
+#ifdef ENABLE_CPU_TRACING
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Nanoseconds since the first call, shared by all threads
+	inline uint64_t nowNs()
+	{
+		static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count());
+	}
+
+	void record(const char* name, uint64_t startNs, uint64_t endNs, Category category);
+
+	// Forget everything recorded so far (e.g. between benchmark runs)
+	void clear();
+
+	// Copy of every event still in the rings, sorted by start time
+	std::vector<Event> snapshot(std::vector<uint32_t>* threadIndices = nullptr);
+
+	// Per zone name totals, in order of first appearance
+	std::vector<ZoneSummary> summarize();
+	double getStallTimeMs();
+
+	// Chrome trace / Perfetto JSON, one track per thread
+	bool exportChromeTrace(const std::string& path);
+
+	class ScopedZone
+	{
+	public:
+		ScopedZone(const char* zoneName, Category zoneCategory)
+			: name(zoneName), category(zoneCategory), startNs(nowNs()) {}
+		~ScopedZone() { record(name, startNs, nowNs(), category); }
+
+		ScopedZone(const ScopedZone&) = delete;
+		ScopedZone& operator=(const ScopedZone&) = delete;
+
+	private:
+		const char* name;
+		Category category;
+		uint64_t startNs;
+	};
+}
@@ -0,0 +1,38 @@
+#include "DeletionQueue.h"
+
+
+void DeletionQueue::push(Deleter deleter)
+{
+	deleters.push_back({ submittedFrames, std::move(deleter) });
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void DeletionQueue::collect(uint64_t completedFrames)
+{
+	// Pushed in order, so the frames only grow from the front to the back
+	while (!deleters.empty() && deleters.front().frame <= completedFrames)
+	{
+		Deleter deleter = std::move(deleters.front().deleter);
+		deleters.pop_front();
+		deleter();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void DeletionQueue::flush()
+{
+	while (!deleters.empty())
+	{
+		Deleter deleter = std::move(deleters.front().deleter);
+		deleters.pop_front();
+		deleter();
+	}
+}
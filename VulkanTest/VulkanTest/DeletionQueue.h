@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+// Vulkan objects that frames in flight may still use (an old swapchain, its views, resized
+// attachments...) are not destroyed right away: their destruction waits here until every
+// frame submitted before it has completed. No vkDeviceWaitIdle, no hitch.
+//
+// The owner counts frames: setSubmittedFrames after each submit, collect with the number of
+// frames the GPU has completed (known from the timeline values it waited on).
+class DeletionQueue
+{
+public:
+
+	using Deleter = std::function<void()>;
+
+	// Runs once the frames submitted so far have all completed
+	void push(Deleter deleter);
+
+	void setSubmittedFrames(uint64_t frames) { submittedFrames = frames; }
+
+	// Run the deleters whose frames are all done, in the order they were pushed
+	void collect(uint64_t completedFrames);
+
+	// Run everything: the device has to be idle
+	void flush();
+
+	size_t size() const { return deleters.size(); }
+
+private:
+
+	struct Entry
+	{
+		uint64_t frame; // Frames submitted when it was pushed
+		Deleter deleter;
+	};
+
+	std::deque<Entry> deleters;
+	uint64_t submittedFrames = 0;
+};
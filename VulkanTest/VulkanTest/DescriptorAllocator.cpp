@@ -0,0 +1,147 @@
+#include "DescriptorAllocator.h"
+#include <stdexcept>
+
+namespace
+{
+	// Descriptors of each type a pool has, per set it can hold. A set using more than this
+	// of a type only makes the pool run out sooner.
+	struct PoolRatio
+	{
+		VkDescriptorType type;
+		uint32_t perSet;
+	};
+
+	const PoolRatio POOL_RATIOS[]
+	{
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 }
+	};
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void DescriptorAllocator::init(VkDevice logicalDevice, uint32_t framesInFlight, uint32_t poolSets)
+{
+	device = logicalDevice;
+	setsPerPool = poolSets;
+	frames.assign(framesInFlight, FramePools{});
+	frameSlot = 0;
+	frameSetCount = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void DescriptorAllocator::destroy()
+{
+	for (FramePools& frame : frames)
+	{
+		for (VkDescriptorPool pool : frame.pools)
+		{
+			vkDestroyDescriptorPool(device, pool, nullptr);
+		}
+	}
+	frames.clear();
+	device = VK_NULL_HANDLE;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void DescriptorAllocator::beginFrame(uint32_t slot)
+{
+	// Only the pools the last frame of this slot used have sets in them
+	FramePools& frame = frames[slot];
+	for (uint32_t i = 0; i <= frame.current && i < frame.pools.size(); ++i)
+	{
+		vkResetDescriptorPool(device, frame.pools[i], 0);
+	}
+	frame.current = 0;
+	frameSlot = slot;
+	frameSetCount = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout)
+{
+	FramePools& frame = frames[frameSlot];
+	VkDescriptorSetAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &layout;
+
+	// The current pool, or the next ones when it is full. A pool that was just made and
+	// can't hold the set never will.
+	while (true)
+	{
+		bool newPool = frame.current >= frame.pools.size();
+		if (newPool) frame.pools.push_back(createPool());
+		allocateInfo.descriptorPool = frame.pools[frame.current];
+
+		VkDescriptorSet set = VK_NULL_HANDLE;
+		VkResult result = vkAllocateDescriptorSets(device, &allocateInfo, &set);
+		if (result == VK_SUCCESS)
+		{
+			++frameSetCount;
+			return set;
+		}
+		if ((result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) || newPool)
+		{
+			throw std::runtime_error("Failed to allocate a frame descriptor set");
+		}
+		++frame.current;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t DescriptorAllocator::getPoolCount() const
+{
+	uint32_t count = 0;
+	for (const FramePools& frame : frames) count += static_cast<uint32_t>(frame.pools.size());
+	return count;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkDescriptorPool DescriptorAllocator::createPool()
+{
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (const PoolRatio& ratio : POOL_RATIOS)
+	{
+		poolSizes.push_back({ ratio.type, ratio.perSet * setsPerPool });
+	}
+
+	// No FREE_DESCRIPTOR_SET_BIT: sets only go with a reset of the whole pool
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = setsPerPool;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a frame descriptor pool");
+	}
+	return pool;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+// Descriptor sets that live for one frame, taken from the pools of their frame in flight.
+// Sets are never freed one by one: when a frame slot comes around again (its last frame is
+// done on the GPU), beginFrame resets the slot's pools, one call each. A pool that runs out
+// hands over to the next one, and pools are kept from frame to frame: after a few frames
+// each slot has as many pools as its frames need, and a set costs a vkAllocateDescriptorSets.
+//
+// Every pool has room for setsPerPool sets of any layout made of the types in POOL_RATIOS
+// (DescriptorAllocator.cpp). Not thread safe: sets are allocated while building the frame.
+class DescriptorAllocator
+{
+public:
+
+	static const uint32_t DEFAULT_SETS_PER_POOL = 64;
+
+	void init(VkDevice device, uint32_t framesInFlight, uint32_t setsPerPool = DEFAULT_SETS_PER_POOL);
+	void destroy();
+
+	// The frame slot's last frame has to be done: its sets become invalid
+	void beginFrame(uint32_t frameSlot);
+
+	// Valid until the slot's next beginFrame
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+	uint32_t getPoolCount() const; // Every slot
+	uint32_t getFrameSetCount() const { return frameSetCount; } // Allocated since beginFrame
+
+private:
+
+	struct FramePools
+	{
+		std::vector<VkDescriptorPool> pools;
+		uint32_t current = 0; // Pools before it are full
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t setsPerPool = DEFAULT_SETS_PER_POOL;
+	std::vector<FramePools> frames;
+	uint32_t frameSlot = 0;
+	uint32_t frameSetCount = 0;
+
+	VkDescriptorPool createPool();
+};
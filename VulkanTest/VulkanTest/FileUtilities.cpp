@@ -0,0 +1,105 @@
+#include "FileUtilities.h"
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#endif
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool writeFileAtomic(const std::string& path, const char* data, size_t size)
+{
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+		if (!file.is_open()) return false;
+		file.write(data, size);
+		file.flush();
+		if (!file)
+		{
+			file.close();
+			std::remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	// Swap the new file in with a single rename
+#ifdef _WIN32
+	bool renamed = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool renamed = std::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+	if (!renamed) std::remove(tempPath.c_str());
+	return renamed;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool createDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR) != 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+FileStamp getFileStamp(const std::string& path)
+{
+	FileStamp stamp;
+#ifdef _WIN32
+	// stat only has whole seconds there, the FILETIME counts 100 ns ticks
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes)) return stamp;
+	ULARGE_INTEGER writeTime;
+	writeTime.LowPart = attributes.ftLastWriteTime.dwLowDateTime;
+	writeTime.HighPart = attributes.ftLastWriteTime.dwHighDateTime;
+	ULARGE_INTEGER size;
+	size.LowPart = attributes.nFileSizeLow;
+	size.HighPart = attributes.nFileSizeHigh;
+	stamp.modificationTime = static_cast<int64_t>(writeTime.QuadPart) * 100;
+	stamp.size = static_cast<int64_t>(size.QuadPart);
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) return stamp;
+#ifdef __APPLE__
+	const struct timespec& writeTime = info.st_mtimespec;
+#else
+	const struct timespec& writeTime = info.st_mtim;
+#endif
+	stamp.modificationTime = static_cast<int64_t>(writeTime.tv_sec) * 1000000000 + writeTime.tv_nsec;
+	stamp.size = static_cast<int64_t>(info.st_size);
+#endif
+	return stamp;
+}
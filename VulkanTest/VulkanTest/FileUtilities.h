@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Small file system helpers shared by the caches (pipeline cache, shader cache...)
+
+// FNV-1a, chainable by passing the previous result as seed
+static const uint64_t HASH_SEED = 14695981039346656037ull;
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = HASH_SEED);
+
+// Write to <path>.tmp then rename it over path: readers see the old file or the new one,
+// never a half written one
+bool writeFileAtomic(const std::string& path, const char* data, size_t size);
+
+// Creates one directory level, true if it exists afterwards
+bool createDirectory(const std::string& path);
+
+// What changes when a file is written. Both are -1 if the file doesn't exist.
+struct FileStamp
+{
+	int64_t modificationTime = -1; // Nanoseconds, as precise as the file system keeps it: two saves in one second still differ
+	int64_t size = -1;
+
+	bool operator==(const FileStamp& other) const { return modificationTime == other.modificationTime && size == other.size; }
+	bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+FileStamp getFileStamp(const std::string& path);
@@ -0,0 +1,226 @@
+#include "FramePacer.h"
+#include "CpuTracer.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+	const uint32_t HISTOGRAM_BUCKETS = 64;
+	const double LATENCY_BUCKET_MS = 1.0; // Up to 64 ms
+	const double JITTER_BUCKET_MS = 0.25; // Up to 16 ms
+
+	// A lost present (minimised window...) must not hang the frame
+	const uint64_t PRESENT_WAIT_TIMEOUT_NS = 100000000;
+
+	// sleep_for wakes up late by up to a scheduler tick: the end of the wait is spun
+	const uint64_t SPIN_NS = 1000000;
+
+	void addSample(FramePacer::Histogram& histogram, double valueMs)
+	{
+		uint32_t bucket = static_cast<uint32_t>(std::max(valueMs, 0.0) / histogram.bucketMs);
+		++histogram.counts[std::min(bucket, HISTOGRAM_BUCKETS - 1)];
+	}
+
+	void waitUntil(uint64_t timeNs)
+	{
+		uint64_t nowNs = CpuTracer::nowNs();
+		if (nowNs + SPIN_NS < timeNs)
+		{
+			std::this_thread::sleep_for(std::chrono::nanoseconds(timeNs - nowNs - SPIN_NS));
+		}
+		while (CpuTracer::nowNs() < timeNs) std::this_thread::yield();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint64_t FramePacer::Histogram::total() const
+{
+	uint64_t sum = 0;
+	for (uint32_t count : counts) sum += count;
+	return sum;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+double FramePacer::Histogram::percentile(double p) const
+{
+	uint64_t sampleCount = total();
+	if (sampleCount == 0) return 0.0;
+
+	uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * sampleCount));
+	uint64_t seen = 0;
+	for (size_t bucket = 0; bucket < counts.size(); ++bucket)
+	{
+		seen += counts[bucket];
+		if (seen >= rank) return (bucket + 1) * bucketMs;
+	}
+	return counts.size() * bucketMs;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void FramePacer::init(VkDevice logicalDevice, PFN_vkWaitForPresentKHR waitForPresentFunction)
+{
+	device = logicalDevice;
+	waitForPresent = waitForPresentFunction;
+	swapchain = VK_NULL_HANDLE;
+	lastPresentId = 0;
+	shownPresentId = 0;
+	nextFrameNs = 0;
+	pending.clear();
+	resetStats();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void FramePacer::setTargetFrameRate(double framesPerSecond)
+{
+	targetIntervalNs = framesPerSecond > 0.0 ? static_cast<uint64_t>(1e9 / framesPerSecond) : 0;
+	nextFrameNs = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint64_t FramePacer::beginFrame(VkSwapchainKHR currentSwapchain)
+{
+	swapchain = currentSwapchain;
+
+	// Never more than maxQueuedPresents frames waiting for the display: the frame about to
+	// start would only queue behind them, and show up later than it was made for
+	if (waitForPresent != nullptr && lastPresentId > maxQueuedPresents)
+	{
+		waitForPresents(lastPresentId - maxQueuedPresents);
+	}
+
+	if (targetIntervalNs > 0)
+	{
+		// Late by more than a frame: start the cadence again from now rather than rushing
+		// frames out to catch up
+		uint64_t nowNs = CpuTracer::nowNs();
+		if (nextFrameNs == 0 || nowNs > nextFrameNs + targetIntervalNs) nextFrameNs = nowNs;
+		waitUntil(nextFrameNs);
+		nextFrameNs += targetIntervalNs;
+	}
+	return CpuTracer::nowNs();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void FramePacer::presented(uint64_t presentId, uint64_t frameBeginNs, uint64_t presentEndNs)
+{
+	if (waitForPresent == nullptr)
+	{
+		record(frameBeginNs, presentEndNs);
+		return;
+	}
+	pending.push_back({ presentId, frameBeginNs });
+
+	// Already shown ones are timed now rather than at the next frame
+	waitForPresents(0);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void FramePacer::swapchainChanged()
+{
+	pending.clear();
+	lastPresentNs = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void FramePacer::resetStats()
+{
+	stats = Stats{};
+	stats.latency.bucketMs = LATENCY_BUCKET_MS;
+	stats.latency.counts.assign(HISTOGRAM_BUCKETS, 0);
+	stats.jitter.bucketMs = JITTER_BUCKET_MS;
+	stats.jitter.counts.assign(HISTOGRAM_BUCKETS, 0);
+	lastPresentNs = 0;
+	intervalTotalMs = 0.0;
+	intervalCount = 0;
+	latencyTotalMs = 0.0;
+	jitterTotalMs = 0.0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void FramePacer::waitForPresents(uint64_t untilId)
+{
+	// Oldest first. Up to untilId the wait blocks, after it the presents are only polled.
+	while (!pending.empty())
+	{
+		const PendingPresent& present = pending.front();
+		uint64_t timeoutNs = present.presentId <= untilId ? PRESENT_WAIT_TIMEOUT_NS : 0;
+		VkResult result = waitForPresent(device, swapchain, present.presentId, timeoutNs);
+		if (result == VK_TIMEOUT) return;
+
+		// Out of date or lost: that present will never be seen, don't time it
+		if (result == VK_SUCCESS)
+		{
+			record(present.frameBeginNs, CpuTracer::nowNs());
+			shownPresentId = present.presentId;
+		}
+		pending.pop_front();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void FramePacer::record(uint64_t frameBeginNs, uint64_t presentNs)
+{
+	double latencyMs = (presentNs - frameBeginNs) / 1e6;
+	++stats.frames;
+	latencyTotalMs += latencyMs;
+	stats.meanLatencyMs = latencyTotalMs / stats.frames;
+	addSample(stats.latency, latencyMs);
+
+	if (lastPresentNs != 0)
+	{
+		double intervalMs = (presentNs - lastPresentNs) / 1e6;
+		intervalTotalMs += intervalMs;
+		++intervalCount;
+		stats.meanIntervalMs = intervalTotalMs / intervalCount;
+
+		// Against the cadence asked for, or the one we get
+		double expectedMs = targetIntervalNs > 0 ? targetIntervalNs / 1e6 : stats.meanIntervalMs;
+		double jitterMs = std::abs(intervalMs - expectedMs);
+		jitterTotalMs += jitterMs;
+		stats.meanJitterMs = jitterTotalMs / intervalCount;
+		stats.maxJitterMs = std::max(stats.maxJitterMs, jitterMs);
+		addSample(stats.jitter, jitterMs);
+	}
+	lastPresentNs = presentNs;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Frame pacing and present feedback.
+// Each frame starts with beginFrame and ends with presented. Pacing does two things:
+// - Frames don't bunch up behind the display: with VK_KHR_present_wait, beginFrame waits
+//   until at most maxQueuedPresents frames are waiting to be shown.
+// - With a target frame rate, frames start on a steady cadence: beginFrame sleeps until the
+//   next frame is due, and starts again from now when it fell behind.
+//
+// Present times come from vkWaitForPresentKHR when the device has present_id/present_wait
+// (the time the wait returns, exact when it had to wait). Everywhere else they are taken on
+// the CPU when vkQueuePresentKHR returns. Latency is from beginFrame to the present, jitter
+// how far the interval between two presents is from the target (or the mean interval
+// without a target).
+class FramePacer
+{
+public:
+
+	// Fixed width buckets, the last one counts everything above
+	struct Histogram
+	{
+		double bucketMs = 0.0;
+		std::vector<uint32_t> counts;
+
+		uint64_t total() const;
+		double percentile(double p) const; // Upper edge of the bucket it falls in
+	};
+
+	struct Stats
+	{
+		uint64_t frames = 0; // With a present time
+		double meanLatencyMs = 0.0;
+		double meanIntervalMs = 0.0;
+		double meanJitterMs = 0.0;
+		double maxJitterMs = 0.0;
+		Histogram latency;
+		Histogram jitter;
+	};
+
+	// waitForPresent is null without present_wait: CPU timing only
+	void init(VkDevice device, PFN_vkWaitForPresentKHR waitForPresent);
+	bool usesPresentWait() const { return waitForPresent != nullptr; }
+
+	// 0: as fast as the present mode allows (the default)
+	void setTargetFrameRate(double framesPerSecond);
+	double getTargetFrameRate() const { return targetIntervalNs > 0 ? 1e9 / targetIntervalNs : 0.0; }
+
+	// Frames presented but not shown yet that beginFrame lets through, present_wait only
+	void setMaxQueuedPresents(uint32_t count) { maxQueuedPresents = count; }
+
+	// Waits for the display and the cadence, returns the time the frame starts at
+	uint64_t beginFrame(VkSwapchainKHR swapchain);
+
+	// For VkPresentIdKHR, one per present
+	uint64_t nextPresentId() { return ++lastPresentId; }
+	uint64_t getLastPresentId() const { return lastPresentId; }
+
+	// Last present vkWaitForPresentKHR saw on screen, 0 without present_wait. The display
+	// shows presents in order: every present before it is done with its image.
+	uint64_t getShownPresentId() const { return shownPresentId; }
+
+	// After vkQueuePresentKHR (or the submit, when there is nothing to present). presentEndNs
+	// is when it returned, it is the present time without present_wait.
+	void presented(uint64_t presentId, uint64_t frameBeginNs, uint64_t presentEndNs);
+
+	// Ids of a retired swapchain will never be waited on
+	void swapchainChanged();
+
+	const Stats& getStats() const { return stats; }
+	void resetStats();
+
+private:
+
+	struct PendingPresent
+	{
+		uint64_t presentId;
+		uint64_t frameBeginNs;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+
+	uint64_t targetIntervalNs = 0;
+	uint64_t nextFrameNs = 0; // When the next frame is due, with a target
+	uint32_t maxQueuedPresents = 1;
+	uint64_t lastPresentId = 0;
+	uint64_t shownPresentId = 0;
+	std::deque<PendingPresent> pending; // Present wait only, oldest first
+	uint64_t lastPresentNs = 0;
+	double intervalTotalMs = 0.0;
+	uint64_t intervalCount = 0;
+	double latencyTotalMs = 0.0;
+	double jitterTotalMs = 0.0;
+	Stats stats;
+
+	void waitForPresents(uint64_t untilId);
+	void record(uint64_t frameBeginNs, uint64_t presentNs);
+};
@@ -0,0 +1,262 @@
+#include "FrustumCuller.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FRUSTUM_CULLER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	uint32_t cullScalar(const Frustum& frustum, const CullBounds& bounds, float radiusScale,
+		uint32_t first, uint32_t last, uint32_t* visible)
+	{
+		uint32_t count = 0;
+		for (uint32_t i = first; i < last; ++i)
+		{
+			float x = bounds.centerX[i];
+			float y = bounds.centerY[i];
+			float z = bounds.centerZ[i];
+			float negativeRadius = -bounds.radius[i] * radiusScale;
+
+			bool inside = true;
+			for (const Frustum::Plane& plane : frustum.planes)
+			{
+				float distance = plane.normal[0] * x + plane.normal[1] * y + plane.normal[2] * z + plane.distance;
+				inside &= distance >= negativeRadius;
+			}
+			if (inside) visible[count++] = i;
+		}
+		return count;
+	}
+
+#ifdef FRUSTUM_CULLER_X86
+
+	uint32_t cullSse(const Frustum& frustum, const CullBounds& bounds, float radiusScale,
+		uint32_t first, uint32_t last, uint32_t* visible)
+	{
+		// Planes broadcast once, each lane is another object
+		__m128 normalX[6], normalY[6], normalZ[6], distance[6];
+		for (int p = 0; p < 6; ++p)
+		{
+			normalX[p] = _mm_set1_ps(frustum.planes[p].normal[0]);
+			normalY[p] = _mm_set1_ps(frustum.planes[p].normal[1]);
+			normalZ[p] = _mm_set1_ps(frustum.planes[p].normal[2]);
+			distance[p] = _mm_set1_ps(frustum.planes[p].distance);
+		}
+		__m128 scale = _mm_set1_ps(-radiusScale);
+
+		uint32_t count = 0;
+		uint32_t i = first;
+		for (; i + 4 <= last; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&bounds.centerX[i]);
+			__m128 y = _mm_loadu_ps(&bounds.centerY[i]);
+			__m128 z = _mm_loadu_ps(&bounds.centerZ[i]);
+			__m128 negativeRadius = _mm_mul_ps(_mm_loadu_ps(&bounds.radius[i]), scale);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, normalX[p]), _mm_mul_ps(y, normalY[p])),
+					_mm_add_ps(_mm_mul_ps(z, normalZ[p]), distance[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negativeRadius));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				if (mask & (1 << lane)) visible[count++] = i + lane;
+			}
+		}
+		return count + cullScalar(frustum, bounds, radiusScale, i, last, visible + count);
+	}
+
+
+	// For each 8 bit visibility mask, the lanes to keep moved to the front, and how many there are
+	struct PackTable
+	{
+		alignas(32) uint32_t lanes[256][8];
+		uint8_t counts[256];
+
+		PackTable()
+		{
+			for (uint32_t mask = 0; mask < 256; ++mask)
+			{
+				uint32_t count = 0;
+				for (uint32_t lane = 0; lane < 8; ++lane)
+				{
+					if (mask & (1u << lane)) lanes[mask][count++] = lane;
+				}
+				counts[mask] = static_cast<uint8_t>(count);
+				for (uint32_t lane = count; lane < 8; ++lane) lanes[mask][lane] = 0;
+			}
+		}
+	};
+	const PackTable packTable;
+
+
+	AVX2_TARGET uint32_t cullAvx2(const Frustum& frustum, const CullBounds& bounds, float radiusScale,
+		uint32_t first, uint32_t last, uint32_t* visible)
+	{
+		__m256 normalX[6], normalY[6], normalZ[6], distance[6];
+		for (int p = 0; p < 6; ++p)
+		{
+			normalX[p] = _mm256_set1_ps(frustum.planes[p].normal[0]);
+			normalY[p] = _mm256_set1_ps(frustum.planes[p].normal[1]);
+			normalZ[p] = _mm256_set1_ps(frustum.planes[p].normal[2]);
+			distance[p] = _mm256_set1_ps(frustum.planes[p].distance);
+		}
+		__m256 scale = _mm256_set1_ps(-radiusScale);
+		__m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+		uint32_t count = 0;
+		uint32_t i = first;
+		for (; i + 8 <= last; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(&bounds.centerX[i]);
+			__m256 y = _mm256_loadu_ps(&bounds.centerY[i]);
+			__m256 z = _mm256_loadu_ps(&bounds.centerZ[i]);
+			__m256 negativeRadius = _mm256_mul_ps(_mm256_loadu_ps(&bounds.radius[i]), scale);
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, normalX[p]), _mm256_mul_ps(y, normalY[p])),
+					_mm256_add_ps(_mm256_mul_ps(z, normalZ[p]), distance[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negativeRadius, _CMP_GE_OQ));
+			}
+
+			// Always 8 indices stored, only the first counts[mask] are kept. It never writes past
+			// the end: count is at most i - first, and i + 8 <= last.
+			int mask = _mm256_movemask_ps(inside);
+			__m256i indices = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), laneIndices);
+			__m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(packTable.lanes[mask]));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(visible + count), _mm256_permutevar8x32_epi32(indices, lanes));
+			count += packTable.counts[mask];
+		}
+		return count + cullScalar(frustum, bounds, radiusScale, i, last, visible + count);
+	}
+
+
+	bool cpuHasAvx2()
+	{
+#if defined(_MSC_VER)
+		// The CPU has to support AVX2, and the OS has to save the YMM registers
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+		__cpuid(info, 1);
+		bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+		if (!osSavesYmm) return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+#endif
+}
+
+
+void CullBounds::resize(uint32_t count)
+{
+	centerX.resize(count);
+	centerY.resize(count);
+	centerZ.resize(count);
+	radius.resize(count);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+Frustum Frustum::clipSpace()
+{
+	return Frustum{ {
+		{ { 1.0f, 0.0f, 0.0f }, 1.0f },		// x >= -1
+		{ { -1.0f, 0.0f, 0.0f }, 1.0f },	// x <= 1
+		{ { 0.0f, 1.0f, 0.0f }, 1.0f },		// y >= -1
+		{ { 0.0f, -1.0f, 0.0f }, 1.0f },	// y <= 1
+		{ { 0.0f, 0.0f, 1.0f }, 0.0f },		// z >= 0
+		{ { 0.0f, 0.0f, -1.0f }, 1.0f }		// z <= 1
+	} };
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+FrustumCuller::Kernel FrustumCuller::bestKernel()
+{
+	if (isSupported(Kernel::Avx2)) return Kernel::Avx2;
+	if (isSupported(Kernel::Sse)) return Kernel::Sse;
+	return Kernel::Scalar;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool FrustumCuller::isSupported(Kernel kernel)
+{
+	switch (kernel)
+	{
+#ifdef FRUSTUM_CULLER_X86
+	case Kernel::Avx2:
+	{
+		// Asked once, the answer doesn't change
+		static const bool hasAvx2 = cpuHasAvx2();
+		return hasAvx2;
+	}
+	case Kernel::Sse:
+		return true; // Part of x64, and of every x86 CPU Vulkan runs on
+#endif
+	case Kernel::Scalar:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+const char* FrustumCuller::getKernelName(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::Avx2: return "avx2";
+	case Kernel::Sse: return "sse";
+	default: return "scalar";
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t FrustumCuller::cull(const Frustum& frustum, const CullBounds& bounds, float radiusScale,
+	uint32_t first, uint32_t last, uint32_t* visible) const
+{
+	switch (kernel)
+	{
+#ifdef FRUSTUM_CULLER_X86
+	case Kernel::Avx2: return cullAvx2(frustum, bounds, radiusScale, first, last, visible);
+	case Kernel::Sse: return cullSse(frustum, bounds, radiusScale, first, last, visible);
+#endif
+	default: return cullScalar(frustum, bounds, radiusScale, first, last, visible);
+	}
+}
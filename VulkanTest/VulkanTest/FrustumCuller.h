@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Bounding spheres as structure of arrays: a SIMD kernel loads 4 or 8 objects' x (or y, z,
+// radius) in one go, where an array of structures would need a gather or a shuffle per object.
+struct CullBounds
+{
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+
+	uint32_t size() const { return static_cast<uint32_t>(radius.size()); }
+	void resize(uint32_t count);
+};
+
+
+// Six planes facing inwards: a point p is inside when dot(normal, p) + distance >= 0 for all of them
+struct Frustum
+{
+	struct Plane
+	{
+		float normal[3];
+		float distance;
+	};
+	Plane planes[6];
+
+	// The clip volume, x and y in [-1, 1], z in [0, 1]: what the renderer draws to without a camera
+	static Frustum clipSpace();
+};
+
+
+// Tests bounding spheres against a frustum, a sphere is visible unless it is fully outside one plane.
+// The kernel is picked at runtime from what the CPU supports: AVX2 tests 8 spheres at a time
+// and packs the visible indices with a permute, SSE tests 4, scalar is the fallback (and
+// the only choice off x86).
+class FrustumCuller
+{
+public:
+
+	enum class Kernel
+	{
+		Scalar,
+		Sse,
+		Avx2
+	};
+
+	FrustumCuller() : kernel(bestKernel()) {}
+
+	static Kernel bestKernel();
+	static bool isSupported(Kernel kernel);
+	static const char* getKernelName(Kernel kernel);
+
+	// Benchmarks force the slower kernels, unsupported ones are ignored
+	void setKernel(Kernel wanted) { if (isSupported(wanted)) kernel = wanted; }
+	Kernel getKernel() const { return kernel; }
+
+	// Test the objects [first, last), with their radii multiplied by radiusScale (e.g. the
+	// mesh's own radius). Writes the visible indices to visible, which has room for
+	// last - first of them, in order. Returns how many were written.
+	uint32_t cull(const Frustum& frustum, const CullBounds& bounds, float radiusScale,
+		uint32_t first, uint32_t last, uint32_t* visible) const;
+
+private:
+
+	Kernel kernel;
+};
@@ -0,0 +1,247 @@
+#include "GpuProfiler.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <map>
+#include <algorithm>
+
+
+void GpuProfiler::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t slotCount, uint32_t maxZonesPerSlot)
+{
+	// Check the queue can write timestamps at all. Valid bits tells how many bits of the
+	// timestamp are meaningful, 0 means no support.
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	uint32_t validBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+	if (validBits == 0)
+	{
+		std::cerr << "GPU profiler: timestamps not supported on this queue, profiling disabled" << std::endl;
+		return;
+	}
+	timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+	// Nanoseconds per timestamp tick
+	VkPhysicalDeviceProperties deviceProperties{};
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	timestampPeriodNs = deviceProperties.limits.timestampPeriod;
+
+	device = logicalDevice;
+	maxZones = maxZonesPerSlot;
+	slots.assign(slotCount, Slot{});
+	readback.resize(maxZones * 2 * 2); // Value + availability for each query
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo{};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = slotCount * maxZones * 2;
+
+	VkResult result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the timestamp query pool");
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuProfiler::destroy()
+{
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(device, queryPool, nullptr);
+	}
+	queryPool = VK_NULL_HANDLE;
+	device = VK_NULL_HANDLE;
+	slots.clear();
+	hasOrigin = false;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuProfiler::beginSlot(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+	if (!isEnabled()) return;
+
+	// Queries have to be reset before being written again
+	vkCmdResetQueryPool(commandBuffer, queryPool, firstQuery(slot), maxZones * 2);
+	slots[slot].zones.clear();
+	slots[slot].openZones = 0;
+	slots[slot].pending = false;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t GpuProfiler::beginZone(VkCommandBuffer commandBuffer, uint32_t slot, const char* name, int32_t index)
+{
+	if (!isEnabled()) return INVALID_ZONE;
+
+	// Out of queries: the zone is silently dropped, and so is its end
+	Slot& profilerSlot = slots[slot];
+	if (profilerSlot.zones.size() >= maxZones) return INVALID_ZONE;
+
+	uint32_t zone = static_cast<uint32_t>(profilerSlot.zones.size());
+	std::string zoneName = index >= 0 ? std::string(name) + " " + std::to_string(index) : name;
+	profilerSlot.zones.push_back({ zoneName, profilerSlot.openZones, false });
+	++profilerSlot.openZones;
+
+	// Top of pipe: written as soon as the previous commands have started
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, firstQuery(slot) + zone * 2);
+	return zone;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuProfiler::endZone(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t zone)
+{
+	if (!isEnabled() || zone == INVALID_ZONE) return;
+
+	Slot& profilerSlot = slots[slot];
+	profilerSlot.zones[zone].ended = true;
+	--profilerSlot.openZones;
+
+	// Bottom of pipe: written once all previous commands are done
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, firstQuery(slot) + zone * 2 + 1);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuProfiler::submitted(uint32_t slot, uint64_t frameNumber)
+{
+	if (!isEnabled()) return;
+
+	// Previous results of this slot were not read in time: they are lost, but we never wait
+	slots[slot].pending = !slots[slot].zones.empty();
+	slots[slot].frameNumber = frameNumber;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuProfiler::collect()
+{
+	if (!isEnabled()) return;
+
+	for (uint32_t slot = 0; slot < slots.size(); ++slot)
+	{
+		Slot& profilerSlot = slots[slot];
+		if (!profilerSlot.pending) continue;
+
+		// No WAIT bit: ask for availability next to each value instead of blocking
+		uint32_t queryCount = static_cast<uint32_t>(profilerSlot.zones.size()) * 2;
+		VkResult result = vkGetQueryPoolResults(device, queryPool, firstQuery(slot), queryCount,
+			queryCount * 2 * sizeof(uint64_t), readback.data(), 2 * sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+		if (result != VK_SUCCESS && result != VK_NOT_READY) continue;
+
+		// Leave the whole slot for later if any written timestamp is not available yet
+		bool available = true;
+		for (size_t z = 0; z < profilerSlot.zones.size() && available; ++z)
+		{
+			available = readback[z * 4 + 1] != 0
+				&& (!profilerSlot.zones[z].ended || readback[z * 4 + 3] != 0);
+		}
+		if (!available) continue;
+
+		for (size_t z = 0; z < profilerSlot.zones.size(); ++z)
+		{
+			const Zone& zone = profilerSlot.zones[z];
+			if (!zone.ended) continue;
+
+			uint64_t begin = readback[z * 4] & timestampMask;
+			uint64_t end = readback[z * 4 + 2] & timestampMask;
+			if (!hasOrigin)
+			{
+				originTimestamp = begin;
+				hasOrigin = true;
+			}
+
+			ZoneResult zoneResult;
+			zoneResult.name = zone.name;
+			zoneResult.frame = profilerSlot.frameNumber;
+			zoneResult.depth = zone.depth;
+			zoneResult.startMs = (double)(int64_t)(begin - originTimestamp) * timestampPeriodNs / 1e6;
+			zoneResult.durationMs = end >= begin ? (double)(end - begin) * timestampPeriodNs / 1e6 : 0.0;
+			results.push_back(zoneResult);
+		}
+		profilerSlot.pending = false;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::vector<GpuProfiler::ZoneSummary> GpuProfiler::summarize() const
+{
+	// Keep zones in order of first appearance, easier to read than alphabetical
+	std::vector<ZoneSummary> summaries;
+	std::map<std::string, size_t> indexByName;
+	for (const ZoneResult& zoneResult : results)
+	{
+		auto found = indexByName.find(zoneResult.name);
+		if (found == indexByName.end())
+		{
+			found = indexByName.emplace(zoneResult.name, summaries.size()).first;
+			summaries.push_back({ zoneResult.name, 0, 0.0, 0.0 });
+		}
+
+		ZoneSummary& summary = summaries[found->second];
+		summary.averageMs += zoneResult.durationMs;
+		summary.maxMs = std::max(summary.maxMs, zoneResult.durationMs);
+		++summary.count;
+	}
+
+	for (ZoneSummary& summary : summaries)
+	{
+		summary.averageMs /= summary.count;
+	}
+	return summaries;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool GpuProfiler::exportChromeTrace(const std::string& path) const
+{
+	std::ofstream file{ path };
+	if (!file.is_open()) return false;
+
+	// Complete events ("ph": "X"), times are in microseconds
+	file.setf(std::ios::fixed);
+	file.precision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"GPU graphics queue\"}}";
+	for (const ZoneResult& zoneResult : results)
+	{
+		file << ",\n{\"name\":\"" << zoneResult.name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+			<< ",\"ts\":" << zoneResult.startMs * 1000.0
+			<< ",\"dur\":" << zoneResult.durationMs * 1000.0
+			<< ",\"args\":{\"frame\":" << zoneResult.frame << "}}";
+	}
+	file << "\n]}\n";
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+
+// GPU timestamp profiler.
+// Zones are pairs of timestamps written in a command buffer. Each command buffer gets its
+// own "slot" of queries in a single query pool. Results are read back without waiting: a
+// slot is only read once the frame that used it has been waited on by draw() anyway, so
+// reading them never stalls. A slot that is not ready yet is simply skipped.
+class GpuProfiler
+{
+public:
+
+	static const uint32_t INVALID_ZONE = ~0u;
+
+	struct ZoneResult
+	{
+		std::string name;
+		uint64_t frame; // Frame number the zone was submitted with
+		uint32_t depth; // Nesting level, 0 for outermost zones
+		double startMs; // Relative to the first timestamp ever read
+		double durationMs;
+	};
+
+	struct ZoneSummary
+	{
+		std::string name;
+		uint32_t count;
+		double averageMs;
+		double maxMs;
+	};
+
+	// Profiler stays disabled if the queue family can't write timestamps
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, uint32_t slotCount, uint32_t maxZonesPerSlot);
+	void destroy();
+	bool isEnabled() const { return queryPool != VK_NULL_HANDLE; }
+
+	// -- Recording -- //
+	// beginSlot resets the slot queries, so it must be recorded outside of a render pass
+	void beginSlot(VkCommandBuffer commandBuffer, uint32_t slot);
+	// Index >= 0 is appended to the name ("Draw 3"), the string is only built when enabled
+	uint32_t beginZone(VkCommandBuffer commandBuffer, uint32_t slot, const char* name, int32_t index = -1);
+	void endZone(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t zone);
+	// --------------- //
+
+	// Tell the profiler the command buffer using this slot was submitted for this frame
+	void submitted(uint32_t slot, uint64_t frameNumber);
+
+	// Read back every submitted slot whose results are ready. Never waits for the GPU.
+	void collect();
+
+	const std::vector<ZoneResult>& getResults() const { return results; }
+	std::vector<ZoneSummary> summarize() const;
+	void clearResults() { results.clear(); }
+
+	// Chrome trace / Perfetto JSON (load it in chrome://tracing or ui.perfetto.dev)
+	bool exportChromeTrace(const std::string& path) const;
+
+private:
+
+	struct Zone
+	{
+		std::string name;
+		uint32_t depth;
+		bool ended;
+	};
+
+	struct Slot
+	{
+		std::vector<Zone> zones; // Zone i uses queries 2i and 2i+1 of the slot
+		uint32_t openZones = 0;
+		bool pending = false;
+		uint64_t frameNumber = 0;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	uint32_t maxZones = 0;
+	double timestampPeriodNs = 1.0;
+	uint64_t timestampMask = ~0ull;
+
+	bool hasOrigin = false;
+	uint64_t originTimestamp = 0;
+
+	std::vector<Slot> slots;
+	std::vector<ZoneResult> results;
+	std::vector<uint64_t> readback;
+
+	uint32_t firstQuery(uint32_t slot) const { return slot * maxZones * 2; }
+};
@@ -0,0 +1,303 @@
+#include "GpuTimeline.h"
+#include <limits>
+#include <stdexcept>
+
+void GpuTimeline::init(VkDevice logicalDevice, PFN_vkWaitSemaphores waitSemaphoresFunction,
+	PFN_vkGetSemaphoreCounterValue getCounterValueFunction, PFN_vkQueueSubmit2 queueSubmit2Function)
+{
+	device = logicalDevice;
+	waitSemaphores = waitSemaphoresFunction;
+	getCounterValue = getCounterValueFunction;
+	queueSubmit2 = queueSubmit2Function;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuTimeline::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+
+	for (Timeline& timeline : timelines)
+	{
+		vkDestroySemaphore(device, timeline.semaphore, nullptr);
+	}
+	for (VkSemaphore semaphore : binarySemaphores)
+	{
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+
+	timelines.clear();
+	freeSemaphores.clear();
+	recycledSemaphores.clear();
+	binarySemaphores.clear();
+	device = VK_NULL_HANDLE;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+GpuTimeline::Queue GpuTimeline::addQueue(VkQueue queue)
+{
+	// Two "queues" can be the same VkQueue (e.g. uploads on the graphics queue): their
+	// submits are ordered together, so one timeline counts them
+	for (size_t i = 0; i < timelines.size(); ++i)
+	{
+		if (timelines[i].queue == queue) return static_cast<Queue>(i);
+	}
+
+	Timeline timeline;
+	timeline.queue = queue;
+	timeline.semaphore = createSemaphore(VK_SEMAPHORE_TYPE_TIMELINE);
+	timelines.push_back(timeline);
+	return static_cast<Queue>(timelines.size() - 1);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint64_t GpuTimeline::submit(Queue queue, const VkCommandBuffer* commandBuffers, uint32_t commandBufferCount,
+	const Wait* waits, uint32_t waitCount, VkSemaphore binarySignal)
+{
+	Timeline& timeline = timelines[queue];
+	uint64_t value = timeline.submittedValue + 1;
+
+	VkResult result;
+	if (queueSubmit2 != nullptr)
+	{
+		waitInfos.resize(waitCount);
+		for (uint32_t i = 0; i < waitCount; ++i)
+		{
+			waitInfos[i] = {};
+			waitInfos[i].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+			waitInfos[i].semaphore = waits[i].semaphore;
+			waitInfos[i].value = waits[i].value;
+			// The legacy stage bits are the low bits of the 64 bit ones
+			waitInfos[i].stageMask = waits[i].stages;
+		}
+
+		commandBufferInfos.resize(commandBufferCount);
+		for (uint32_t i = 0; i < commandBufferCount; ++i)
+		{
+			commandBufferInfos[i] = {};
+			commandBufferInfos[i].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+			commandBufferInfos[i].commandBuffer = commandBuffers[i];
+		}
+
+		// Both once everything is done, like vkQueueSubmit signals
+		VkSemaphoreSubmitInfo signalInfos[2]{};
+		uint32_t signalCount = 0;
+		signalInfos[signalCount].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+		signalInfos[signalCount].semaphore = timeline.semaphore;
+		signalInfos[signalCount].value = value;
+		signalInfos[signalCount++].stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		if (binarySignal != VK_NULL_HANDLE)
+		{
+			signalInfos[signalCount].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+			signalInfos[signalCount].semaphore = binarySignal;
+			signalInfos[signalCount++].stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		}
+
+		VkSubmitInfo2 submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+		submitInfo.waitSemaphoreInfoCount = waitCount;
+		submitInfo.pWaitSemaphoreInfos = waitInfos.data();
+		submitInfo.commandBufferInfoCount = commandBufferCount;
+		submitInfo.pCommandBufferInfos = commandBufferInfos.data();
+		submitInfo.signalSemaphoreInfoCount = signalCount;
+		submitInfo.pSignalSemaphoreInfos = signalInfos;
+		result = queueSubmit2(timeline.queue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
+	else
+	{
+		waitSemaphoreList.resize(waitCount);
+		waitValues.resize(waitCount);
+		waitStages.resize(waitCount);
+		for (uint32_t i = 0; i < waitCount; ++i)
+		{
+			waitSemaphoreList[i] = waits[i].semaphore;
+			waitValues[i] = waits[i].value; // Ignored for binary semaphores
+			waitStages[i] = waits[i].stages;
+		}
+
+		VkSemaphore signalSemaphores[2] = { timeline.semaphore, binarySignal };
+		uint64_t signalValues[2] = { value, 0 };
+		uint32_t signalCount = binarySignal != VK_NULL_HANDLE ? 2 : 1;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = waitCount;
+		timelineInfo.pWaitSemaphoreValues = waitValues.data();
+		timelineInfo.signalSemaphoreValueCount = signalCount;
+		timelineInfo.pSignalSemaphoreValues = signalValues;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = waitCount;
+		submitInfo.pWaitSemaphores = waitSemaphoreList.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+		submitInfo.commandBufferCount = commandBufferCount;
+		submitInfo.pCommandBuffers = commandBuffers;
+		submitInfo.signalSemaphoreCount = signalCount;
+		submitInfo.pSignalSemaphores = signalSemaphores;
+		result = vkQueueSubmit(timeline.queue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit to a queue");
+	}
+	timeline.submittedValue = value;
+	return value;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+GpuTimeline::Wait GpuTimeline::waitFor(Queue queue, uint64_t value, VkPipelineStageFlags stages) const
+{
+	Wait wait;
+	wait.semaphore = timelines[queue].semaphore;
+	wait.value = value;
+	wait.stages = stages;
+	return wait;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint64_t GpuTimeline::getCompletedValue(Queue queue)
+{
+	Timeline& timeline = timelines[queue];
+	uint64_t value = 0;
+	if (getCounterValue(device, timeline.semaphore, &value) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to read a timeline semaphore");
+	}
+	timeline.completedValue = value;
+	return value;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool GpuTimeline::isComplete(Queue queue, uint64_t value)
+{
+	return value <= timelines[queue].completedValue || value <= getCompletedValue(queue);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuTimeline::wait(Queue queue, uint64_t value)
+{
+	Timeline& timeline = timelines[queue];
+	if (value <= timeline.completedValue) return;
+
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline.semaphore;
+	waitInfo.pValues = &value;
+	if (waitSemaphores(device, &waitInfo, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to wait on a timeline semaphore");
+	}
+	timeline.completedValue = value;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuTimeline::waitIdle()
+{
+	for (Queue queue = 0; queue < timelines.size(); ++queue)
+	{
+		wait(queue, timelines[queue].submittedValue);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkSemaphore GpuTimeline::takeBinarySemaphore()
+{
+	// Recycled ones whose queue got there first, a new one if none is
+	for (size_t i = 0; i < recycledSemaphores.size();)
+	{
+		const RecycledSemaphore& recycled = recycledSemaphores[i];
+		if (isComplete(recycled.queue, recycled.value))
+		{
+			freeSemaphores.push_back(recycled.semaphore);
+			recycledSemaphores[i] = recycledSemaphores.back();
+			recycledSemaphores.pop_back();
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	if (freeSemaphores.empty())
+	{
+		binarySemaphores.push_back(createSemaphore(VK_SEMAPHORE_TYPE_BINARY));
+		return binarySemaphores.back();
+	}
+	VkSemaphore semaphore = freeSemaphores.back();
+	freeSemaphores.pop_back();
+	return semaphore;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void GpuTimeline::recycleBinarySemaphore(VkSemaphore semaphore, Queue queue, uint64_t value)
+{
+	if (value == 0) freeSemaphores.push_back(semaphore);
+	else recycledSemaphores.push_back({ semaphore, queue, value });
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkSemaphore GpuTimeline::createSemaphore(VkSemaphoreType type)
+{
+	VkSemaphoreTypeCreateInfo typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = type;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a semaphore");
+	}
+	return semaphore;
+}
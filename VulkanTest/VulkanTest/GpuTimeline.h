@@ -0,0 +1,95 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+// GPU progress, one timeline semaphore per queue (VK_KHR_timeline_semaphore).
+// Every submit made through the timeline signals its queue's semaphore with the next value:
+// a value stands for that submit and everything submitted before it on the queue.
+// - The CPU waits for a value (vkWaitSemaphores) or reads how far the queue got, no fences.
+// - Submits wait on other queues' values: any number of submits can wait on the same value,
+//   and a wait doesn't have to be paired with its own signal like a binary semaphore.
+// - The swapchain only takes binary semaphores (acquire and present). A pool hands them out,
+//   they come back with the value of a queue after which they can be used again.
+//
+// Submits go through vkQueueSubmit2KHR when the device has VK_KHR_synchronization2, through
+// vkQueueSubmit with VkTimelineSemaphoreSubmitInfo otherwise. Like the queues, not thread safe.
+class GpuTimeline
+{
+public:
+
+	using Queue = uint32_t;
+
+	// What a submit waits on: a value of a timeline, or a binary semaphore (value 0)
+	struct Wait
+	{
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		uint64_t value = 0;
+		VkPipelineStageFlags stages = 0;
+	};
+
+	// queueSubmit2 is null without synchronization2
+	void init(VkDevice device, PFN_vkWaitSemaphores waitSemaphores, PFN_vkGetSemaphoreCounterValue getCounterValue,
+		PFN_vkQueueSubmit2 queueSubmit2);
+	void destroy(); // The device has to be idle
+
+	// One timeline per VkQueue: adding the same queue again gives back its timeline
+	Queue addQueue(VkQueue queue);
+
+	// Signals the queue's timeline with the next value and returns it. binarySignal is for
+	// vkQueuePresentKHR.
+	uint64_t submit(Queue queue, const VkCommandBuffer* commandBuffers, uint32_t commandBufferCount,
+		const Wait* waits, uint32_t waitCount, VkSemaphore binarySignal = VK_NULL_HANDLE);
+
+	// For a submit on another queue: wait in stages until queue reached value
+	Wait waitFor(Queue queue, uint64_t value, VkPipelineStageFlags stages) const;
+
+	uint64_t getSubmittedValue(Queue queue) const { return timelines[queue].submittedValue; }
+	uint64_t getCompletedValue(Queue queue); // Asks the device
+	bool isComplete(Queue queue, uint64_t value); // Only asks the device when it has to
+	void wait(Queue queue, uint64_t value);
+	void waitIdle(); // Everything submitted so far, on every queue
+
+	// Binary semaphores, unsignaled
+	VkSemaphore takeBinarySemaphore();
+	// Back to the pool once queue reached value, value 0 for now
+	void recycleBinarySemaphore(VkSemaphore semaphore, Queue queue, uint64_t value);
+
+	bool usesSubmit2() const { return queueSubmit2 != nullptr; }
+
+private:
+
+	struct Timeline
+	{
+		VkQueue queue = VK_NULL_HANDLE;
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		uint64_t submittedValue = 0;
+		uint64_t completedValue = 0; // Last read from the device
+	};
+
+	struct RecycledSemaphore
+	{
+		VkSemaphore semaphore;
+		Queue queue;
+		uint64_t value;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	PFN_vkWaitSemaphores waitSemaphores = nullptr;
+	PFN_vkGetSemaphoreCounterValue getCounterValue = nullptr;
+	PFN_vkQueueSubmit2 queueSubmit2 = nullptr;
+
+	std::vector<Timeline> timelines;
+	std::vector<VkSemaphore> freeSemaphores;
+	std::vector<RecycledSemaphore> recycledSemaphores; // Waiting for their value
+	std::vector<VkSemaphore> binarySemaphores; // Every one created, given out or not
+
+	// Reused by every submit
+	std::vector<VkSemaphoreSubmitInfo> waitInfos;
+	std::vector<VkCommandBufferSubmitInfo> commandBufferInfos;
+	std::vector<VkSemaphore> waitSemaphoreList;
+	std::vector<uint64_t> waitValues;
+	std::vector<VkPipelineStageFlags> waitStages;
+
+	VkSemaphore createSemaphore(VkSemaphoreType type);
+};
@@ -0,0 +1,42 @@
+#include "InstanceBuffer.h"
+
+void InstanceBuffer::create(MemoryAllocator& allocator, StagingUploader& uploader, const std::vector<InstanceData>& instances)
+{
+	instanceCount = static_cast<uint32_t>(instances.size());
+
+	VkBufferCreateInfo bufferCreateInfo{};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = sizeof(InstanceData) * instances.size();
+
+	// Written by the staging copies, then read as instance rate vertex attributes, or culled
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	allocator.createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, buffer, allocation);
+
+	// Millions of instances are bigger than a staging page, the uploader splits them
+	uploader.uploadBuffer(buffer, 0, instances.data(), bufferCreateInfo.size,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+
+	bounds.resize(instanceCount);
+	for (uint32_t i = 0; i < instanceCount; ++i)
+	{
+		bounds.centerX[i] = instances[i].offset[0];
+		bounds.centerY[i] = instances[i].offset[1];
+		bounds.centerZ[i] = instances[i].offset[2];
+		bounds.radius[i] = instances[i].scale;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void InstanceBuffer::destroy(MemoryAllocator& allocator)
+{
+	// The GPU must be done with the buffer, and with its upload
+	if (buffer != VK_NULL_HANDLE) allocator.destroyBuffer(buffer, allocation);
+	buffer = VK_NULL_HANDLE;
+	instanceCount = 0;
+	bounds = {};
+}
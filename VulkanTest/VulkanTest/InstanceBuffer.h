@@ -0,0 +1,31 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "VulkanUtilities.h"
+#include "StagingUploader.h"
+#include "FrustumCuller.h"
+
+// Per instance data (transform and color) in a device local vertex buffer, read by the
+// vertex shader at instance rate: one draw of a mesh gives as many copies as there are
+// instances. Uploaded like a Mesh, through the uploader.
+// GPU driven drawing also reads it as a storage buffer, from the culling compute shader.
+// A copy of the bounds stays on the CPU for CPU culling: centres are the offsets, radii the
+// scales (to multiply by the mesh's radius).
+class InstanceBuffer
+{
+public:
+
+	void create(MemoryAllocator& allocator, StagingUploader& uploader, const std::vector<InstanceData>& instances);
+	void destroy(MemoryAllocator& allocator);
+
+	VkBuffer getBuffer() const { return buffer; }
+	uint32_t getInstanceCount() const { return instanceCount; }
+	const CullBounds& getBounds() const { return bounds; }
+
+private:
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	MemoryAllocation allocation;
+	uint32_t instanceCount = 0;
+	CullBounds bounds;
+};
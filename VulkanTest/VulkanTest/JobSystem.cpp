@@ -0,0 +1,380 @@
+#include "JobSystem.h"
+#include <algorithm>
+
+namespace
+{
+	// Which system and deque the current thread belongs to
+	struct ThreadIdentity
+	{
+		const JobSystem* system = nullptr;
+		uint32_t index = 0;
+	};
+	thread_local ThreadIdentity currentThread;
+}
+
+void JobSystem::init(uint32_t count)
+{
+	destroy();
+	threadCount = std::max(count, 1u);
+	stopping = false;
+	queuedJobs = 0;
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		deques.push_back(std::make_unique<WorkDeque>());
+	}
+
+	currentThread = { this, 0 };
+	for (uint32_t i = 1; i < threadCount; ++i)
+	{
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::destroy()
+{
+	if (deques.empty()) return;
+
+	{
+		std::lock_guard<std::mutex> lock{ sleepMutex };
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+
+	// Jobs nobody waited for are dropped. Every thread is gone, popping from here is safe.
+	for (std::unique_ptr<WorkDeque>& deque : deques)
+	{
+		while (Job* job = deque->pop()) delete job;
+	}
+	deques.clear();
+	for (Job* job : injectedJobs) delete job;
+	injectedJobs.clear();
+	injectedCount = 0;
+
+	if (currentThread.system == this) currentThread = {};
+	threadCount = 1;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::run(std::function<void()> function, JobCounter* counter, JobCounter* dependency)
+{
+	Job* job = new Job{ std::move(function), counter };
+	if (counter != nullptr) counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+	if (dependency != nullptr)
+	{
+		// Zero is only reached under the lock: either it is already there, or finish() will see this job
+		std::lock_guard<std::mutex> lock{ dependency->mutex };
+		if (dependency->pending.load(std::memory_order_relaxed) != 0)
+		{
+			dependency->dependents.push_back(job);
+			return;
+		}
+	}
+	schedule(job);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::wait(JobCounter& counter)
+{
+	uint32_t threadIndex = currentThreadIndex();
+	uint32_t victim = threadIndex == ~0u ? 0 : (threadIndex + 1) % threadCount;
+	while (counter.pending.load(std::memory_order_acquire) != 0)
+	{
+		// Help instead of sleeping, the job found may not be one of ours
+		if (Job* job = findJob(threadIndex, victim)) execute(job);
+		else std::this_thread::yield();
+	}
+
+	// Also makes sure the thread that finished the last job is done with the counter
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock{ counter.mutex };
+		std::swap(error, counter.error);
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::parallelFor(uint32_t count, uint32_t minBatchSize, const std::function<void(uint32_t, uint32_t)>& function)
+{
+	if (count == 0) return;
+
+	// About 4 batches per thread: enough to even out, not so many that scheduling shows
+	uint32_t batchesWanted = threadCount * 4;
+	uint32_t batchSize = std::max({ minBatchSize, 1u, (count + batchesWanted - 1) / batchesWanted });
+	if (batchSize >= count || threadCount == 1)
+	{
+		function(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (uint32_t first = 0; first < count; first += std::min(batchSize, count - first))
+	{
+		uint32_t last = first + std::min(batchSize, count - first);
+		run([&function, first, last]() { function(first, last); }, &counter);
+	}
+	wait(counter);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::schedule(Job* job)
+{
+	// Counted before it can be taken, so the count never goes below zero
+	queuedJobs.fetch_add(1);
+
+	uint32_t threadIndex = currentThreadIndex();
+	if (threadIndex == ~0u)
+	{
+		std::lock_guard<std::mutex> lock{ injectedMutex };
+		injectedJobs.push_back(job);
+		injectedCount.fetch_add(1);
+	}
+	else if (!deques[threadIndex]->push(job))
+	{
+		// Deque full: this thread has plenty to do already
+		queuedJobs.fetch_sub(1);
+		execute(job);
+		return;
+	}
+
+	// A sleeping worker either sees queuedJobs > 0 before sleeping, or is waiting and gets notified
+	if (sleepingWorkers.load() > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ sleepMutex };
+		}
+		wakeUp.notify_one();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+JobSystem::Job* JobSystem::findJob(uint32_t threadIndex, uint32_t& victim)
+{
+	// Own jobs first (newest first, still in cache), then jobs from outside, then steal
+	Job* job = nullptr;
+	if (threadIndex != ~0u) job = deques[threadIndex]->pop();
+
+	if (job == nullptr && injectedCount.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock{ injectedMutex };
+		if (!injectedJobs.empty())
+		{
+			job = injectedJobs.front();
+			injectedJobs.pop_front();
+			injectedCount.fetch_sub(1);
+		}
+	}
+
+	// Start with the last thread we stole from, it probably has more
+	for (uint32_t i = 0; job == nullptr && i < threadCount; ++i)
+	{
+		uint32_t candidate = (victim + i) % threadCount;
+		if (candidate == threadIndex) continue;
+		job = deques[candidate]->steal();
+		if (job != nullptr) victim = candidate;
+	}
+
+	if (job != nullptr) queuedJobs.fetch_sub(1);
+	return job;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::execute(Job* job)
+{
+	JobCounter* counter = job->counter;
+	if (counter == nullptr)
+	{
+		job->function();
+		delete job;
+		return;
+	}
+
+	// An exception can't leave a worker thread, it is handed to whoever waits on the counter
+	try
+	{
+		job->function();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock{ counter->mutex };
+		if (!counter->error) counter->error = std::current_exception();
+	}
+	delete job;
+	finish(*counter);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::finish(JobCounter& counter)
+{
+	// Lock free while other jobs of the group are left. The last one takes the lock to reach
+	// zero, so no dependent can be added in between, and the counter isn't touched after.
+	uint32_t pending = counter.pending.load(std::memory_order_relaxed);
+	while (true)
+	{
+		if (pending != 1)
+		{
+			if (counter.pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel)) return;
+			continue;
+		}
+
+		std::vector<Job*> released;
+		{
+			std::lock_guard<std::mutex> lock{ counter.mutex };
+			if (!counter.pending.compare_exchange_strong(pending, 0, std::memory_order_acq_rel)) continue;
+			released.swap(counter.dependents);
+		}
+		for (Job* job : released)
+		{
+			schedule(job);
+		}
+		return;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void JobSystem::workerLoop(uint32_t threadIndex)
+{
+	currentThread = { this, threadIndex };
+	uint32_t victim = (threadIndex + 1) % threadCount;
+	uint32_t idleRounds = 0;
+	while (!stopping.load(std::memory_order_relaxed))
+	{
+		if (Job* job = findJob(threadIndex, victim))
+		{
+			execute(job);
+			idleRounds = 0;
+			continue;
+		}
+
+		// Jobs often come in bursts, spin a little before paying for a sleep and a wake up
+		if (++idleRounds < SPIN_COUNT)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		idleRounds = 0;
+
+		std::unique_lock<std::mutex> lock{ sleepMutex };
+		sleepingWorkers.fetch_add(1);
+		wakeUp.wait(lock, [this]() { return stopping.load() || queuedJobs.load() > 0; });
+		sleepingWorkers.fetch_sub(1);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t JobSystem::currentThreadIndex() const
+{
+	return currentThread.system == this ? currentThread.index : ~0u;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool JobSystem::WorkDeque::push(Job* job)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= CAPACITY) return false;
+
+	jobs[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+JobSystem::Job* JobSystem::WorkDeque::pop()
+{
+	// Take the bottom slot first, then look whether a thief got there too
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		// Empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = jobs[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// Last job: race the thieves for it
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) job = nullptr;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+JobSystem::Job* JobSystem::WorkDeque::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b) return nullptr;
+
+	// Another thief or the owner may take it first, then it is theirs
+	Job* job = jobs[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+	return job;
+}
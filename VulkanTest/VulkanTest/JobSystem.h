@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobCounter;
+
+// Work-stealing job scheduler.
+// Each thread has its own deque (Chase-Lev): it pushes and pops jobs at the bottom without any
+// lock, idle threads steal the oldest jobs from the top of the others' deques. Threads that
+// don't belong to the system (e.g. a second thread using the renderer) go through a small
+// locked queue instead. Workers spin a little when they run out of jobs, then sleep.
+//
+// The thread calling init() is thread 0 and owns a deque too: it runs jobs while it waits.
+class JobSystem
+{
+public:
+
+	// threadCount includes the calling thread: 1 means no worker, everything runs in wait()
+	void init(uint32_t threadCount);
+	void destroy();
+	~JobSystem() { destroy(); }
+
+	uint32_t getThreadCount() const { return threadCount; }
+
+	// Run function once dependency (if any) has reached zero. The job is counted on counter
+	// from now on. A job without a counter must not throw.
+	void run(std::function<void()> function, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+
+	// Run jobs on this thread until counter reaches zero. Rethrows the first exception of its jobs.
+	void wait(JobCounter& counter);
+
+	// Call function(first, last) over [0, count) in batches of at least minBatchSize, and wait.
+	// There are a few batches per thread so threads that finish early can steal from the others.
+	void parallelFor(uint32_t count, uint32_t minBatchSize, const std::function<void(uint32_t, uint32_t)>& function);
+
+private:
+
+	friend class JobCounter;
+
+	struct Job
+	{
+		std::function<void()> function;
+		JobCounter* counter = nullptr;
+	};
+
+	// Chase-Lev deque: the owner thread pushes and pops at the bottom, the others steal at the
+	// top. Fixed size, a full deque makes run() execute the job right away.
+	class WorkDeque
+	{
+	public:
+
+		static const int64_t CAPACITY = 4096; // Power of two
+
+		bool push(Job* job);
+		Job* pop();
+		Job* steal();
+
+	private:
+
+		// Apart, so the owner and the thieves don't fight over a cache line
+		alignas(64) std::atomic<int64_t> top{ 0 };
+		alignas(64) std::atomic<int64_t> bottom{ 0 };
+		std::atomic<Job*> jobs[CAPACITY]{};
+	};
+
+	static const uint32_t SPIN_COUNT = 64; // Rounds without work before a worker sleeps
+
+	uint32_t threadCount = 1;
+	std::vector<std::unique_ptr<WorkDeque>> deques; // [thread]
+	std::vector<std::thread> workers; // Thread i + 1
+	std::atomic<bool> stopping{ false };
+
+	// Jobs pushed by threads without a deque
+	std::mutex injectedMutex;
+	std::deque<Job*> injectedJobs;
+	std::atomic<uint32_t> injectedCount{ 0 }; // Peeked at without the lock
+
+	// Sleep: a worker only sleeps when no job is queued anywhere
+	std::atomic<int64_t> queuedJobs{ 0 };
+	std::atomic<uint32_t> sleepingWorkers{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+
+	void schedule(Job* job);
+	Job* findJob(uint32_t threadIndex, uint32_t& victim);
+	void execute(Job* job);
+	void finish(JobCounter& counter);
+	void workerLoop(uint32_t threadIndex);
+	uint32_t currentThreadIndex() const; // ~0u for threads outside the system
+};
+
+
+// Number of jobs of a group still to finish. Waiting on it helps running jobs, and other jobs
+// can be made to start only once it reaches zero (dependencies).
+// A counter must outlive the jobs counted on it and the jobs depending on it.
+class JobCounter
+{
+public:
+
+	JobCounter() = default;
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+
+	friend class JobSystem;
+
+	std::atomic<uint32_t> pending{ 0 };
+	std::mutex mutex; // Taken when reaching zero only, and to add dependents
+	std::vector<JobSystem::Job*> dependents; // Waiting for zero
+	std::exception_ptr error; // First exception thrown by a counted job
+};
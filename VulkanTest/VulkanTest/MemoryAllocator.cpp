@@ -0,0 +1,476 @@
+#include "MemoryAllocator.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+static VkDeviceSize nextPowerOfTwo(VkDeviceSize value)
+{
+	VkDeviceSize power = 1;
+	while (power < value) power <<= 1;
+	return power;
+}
+
+static uint32_t log2(VkDeviceSize powerOfTwo)
+{
+	uint32_t log = 0;
+	while ((VkDeviceSize(1) << log) < powerOfTwo) ++log;
+	return log;
+}
+
+static uint32_t countBits(uint32_t value)
+{
+	uint32_t count = 0;
+	for (; value != 0; value &= value - 1) ++count;
+	return count;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize preferredBlockSize)
+{
+	device = logicalDevice;
+	blockSize = nextPowerOfTwo(preferredBlockSize);
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	maxAllocationCount = deviceProperties.limits.maxMemoryAllocationCount;
+
+	// ReBAR: the CPU can write straight into device local memory
+	reBarAvailable = false;
+	const VkMemoryPropertyFlags reBarFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+	{
+		const VkMemoryType& memoryType = memoryProperties.memoryTypes[i];
+		if ((memoryType.propertyFlags & reBarFlags) == reBarFlags
+			&& (memoryProperties.memoryHeaps[memoryType.heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+		{
+			reBarAvailable = true;
+		}
+	}
+
+	pools.clear();
+	pools.resize(memoryProperties.memoryTypeCount * 2);
+	heapStats.assign(memoryProperties.memoryHeapCount, HeapStats{});
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+	{
+		heapStats[i].heapSize = memoryProperties.memoryHeaps[i].size;
+		heapStats[i].flags = memoryProperties.memoryHeaps[i].flags;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+
+	uint32_t leakedAllocations = 0;
+	for (size_t poolIndex = 0; poolIndex < pools.size(); ++poolIndex)
+	{
+		for (auto& block : pools[poolIndex].blocks)
+		{
+			leakedAllocations += block->allocationCount;
+			freeDeviceMemory(static_cast<uint32_t>(poolIndex / 2), block->size, block->memory);
+		}
+	}
+	// Reported, then freed all the same: the device is about to be destroyed
+	leakedAllocations += static_cast<uint32_t>(dedicatedAllocations.size());
+	for (const auto& dedicated : dedicatedAllocations)
+	{
+		freeDeviceMemory(dedicated.second.memoryTypeIndex, dedicated.second.size, dedicated.first);
+	}
+	if (leakedAllocations > 0)
+	{
+		printf("MemoryAllocator: %u allocations were never freed\n", leakedAllocations);
+	}
+
+	pools.clear();
+	dedicatedAllocations.clear();
+	heapStats.clear();
+	device = VK_NULL_HANDLE;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, MemoryUsage usage, bool linear)
+{
+	std::vector<uint32_t> memoryTypes = rankMemoryTypes(requirements.memoryTypeBits, usage);
+	if (memoryTypes.empty())
+	{
+		throw std::runtime_error("Failed to find a suitable memory type");
+	}
+
+	// Best type first, the next ones if its heap is full
+	for (uint32_t memoryTypeIndex : memoryTypes)
+	{
+		MemoryAllocation allocation;
+		allocation.size = requirements.size;
+		allocation.memoryTypeIndex = memoryTypeIndex;
+		HeapStats& stats = heapStats[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex];
+		VkDeviceSize typeBlockSize = getBlockSize(memoryTypeIndex);
+
+		// -- DEDICATED -- //
+		// Would waste most of a block, gets its own memory
+		if (requirements.size > typeBlockSize / 2)
+		{
+			if (!allocateDeviceMemory(memoryTypeIndex, requirements.size, allocation.memory, allocation.mapped)) continue;
+			dedicatedAllocations[allocation.memory] = Dedicated{ memoryTypeIndex, requirements.size };
+			++stats.allocationCount;
+			stats.usedBytes += requirements.size;
+			return allocation;
+		}
+
+
+		// -- FROM A BLOCK -- //
+		Pool& pool = pools[memoryTypeIndex * 2 + (linear ? 1 : 0)];
+		Block* foundBlock = nullptr;
+		for (auto& block : pool.blocks)
+		{
+			if (allocateFromBlock(*block, requirements.size, requirements.alignment, allocation.offset, allocation.level))
+			{
+				foundBlock = block.get();
+				break;
+			}
+		}
+
+		// Every block is full, add one
+		if (foundBlock == nullptr)
+		{
+			std::unique_ptr<Block> block{ new Block() };
+			if (!allocateDeviceMemory(memoryTypeIndex, typeBlockSize, block->memory, block->mapped)) continue;
+			block->size = typeBlockSize;
+			block->levelCount = log2(typeBlockSize / MIN_ALLOCATION_SIZE) + 1;
+			block->freeOffsets.resize(block->levelCount);
+			block->freeOffsets[0].insert(0);
+			pool.blocks.push_back(std::move(block));
+
+			foundBlock = pool.blocks.back().get();
+			allocateFromBlock(*foundBlock, requirements.size, requirements.alignment, allocation.offset, allocation.level);
+		}
+
+		allocation.memory = foundBlock->memory;
+		allocation.block = foundBlock;
+		if (foundBlock->mapped != nullptr) allocation.mapped = static_cast<char*>(foundBlock->mapped) + allocation.offset;
+		++stats.allocationCount;
+		stats.usedBytes += requirements.size;
+		return allocation;
+	}
+
+	throw std::runtime_error("Out of device memory");
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::free(MemoryAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE) return;
+
+	HeapStats& stats = heapStats[memoryProperties.memoryTypes[allocation.memoryTypeIndex].heapIndex];
+	--stats.allocationCount;
+	stats.usedBytes -= allocation.size;
+
+	if (allocation.block == nullptr)
+	{
+		dedicatedAllocations.erase(allocation.memory);
+		freeDeviceMemory(allocation.memoryTypeIndex, allocation.size, allocation.memory);
+		allocation = MemoryAllocation{};
+		return;
+	}
+
+	Block* block = static_cast<Block*>(allocation.block);
+	freeToBlock(*block, allocation.offset, allocation.level);
+
+	// Give empty blocks back to Vulkan, but keep one per pool so a resource created and
+	// destroyed every frame doesn't allocate a block every frame
+	if (block->allocationCount == 0)
+	{
+		for (uint32_t linear = 0; linear < 2; ++linear)
+		{
+			Pool& pool = pools[allocation.memoryTypeIndex * 2 + linear];
+			auto found = std::find_if(pool.blocks.begin(), pool.blocks.end(),
+				[block](const std::unique_ptr<Block>& poolBlock) { return poolBlock.get() == block; });
+			if (found != pool.blocks.end() && pool.blocks.size() > 1)
+			{
+				freeDeviceMemory(allocation.memoryTypeIndex, block->size, block->memory);
+				pool.blocks.erase(found);
+			}
+		}
+	}
+
+	allocation = MemoryAllocation{};
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::createBuffer(const VkBufferCreateInfo& bufferCreateInfo, MemoryUsage usage, VkBuffer& buffer, MemoryAllocation& allocation)
+{
+	VkResult result = vkCreateBuffer(device, &bufferCreateInfo, nullptr, &buffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a buffer");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+	try
+	{
+		allocation = allocate(memoryRequirements, usage, true);
+	}
+	catch (const std::runtime_error&)
+	{
+		vkDestroyBuffer(device, buffer, nullptr);
+		buffer = VK_NULL_HANDLE;
+		throw;
+	}
+	vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::createImage(const VkImageCreateInfo& imageCreateInfo, MemoryUsage usage, VkImage& image, MemoryAllocation& allocation)
+{
+	VkResult result = vkCreateImage(device, &imageCreateInfo, nullptr, &image);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create an image");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device, image, &memoryRequirements);
+	try
+	{
+		allocation = allocate(memoryRequirements, usage, imageCreateInfo.tiling == VK_IMAGE_TILING_LINEAR);
+	}
+	catch (const std::runtime_error&)
+	{
+		vkDestroyImage(device, image, nullptr);
+		image = VK_NULL_HANDLE;
+		throw;
+	}
+	vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::destroyBuffer(VkBuffer buffer, MemoryAllocation& allocation)
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	free(allocation);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::destroyImage(VkImage image, MemoryAllocation& allocation)
+{
+	vkDestroyImage(device, image, nullptr);
+	free(allocation);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::vector<MemoryAllocator::HeapStats> MemoryAllocator::getHeapStats() const
+{
+	return heapStats;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::vector<uint32_t> MemoryAllocator::rankMemoryTypes(uint32_t allowedTypes, MemoryUsage usage) const
+{
+	// Required flags must be there, preferred ones make a type better, avoided ones worse.
+	// Lazily allocated memory is only for transient attachments (GpuLazy).
+	VkMemoryPropertyFlags required = 0;
+	VkMemoryPropertyFlags preferred = 0;
+	VkMemoryPropertyFlags avoided = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	switch (usage)
+	{
+	case MemoryUsage::GpuOnly:
+		preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		avoided |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT; // Leave the ReBAR heap to dynamic data
+		break;
+	case MemoryUsage::CpuToGpu:
+		// Its users flush what they write: a non coherent type can be the device local one
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		break;
+	case MemoryUsage::Staging:
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		avoided |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		break;
+	case MemoryUsage::GpuToCpu:
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		break;
+	case MemoryUsage::GpuLazy:
+		// Only offered for images with TRANSIENT_ATTACHMENT usage: the attachment may never get memory at all
+		preferred = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		break;
+	}
+
+	std::vector<std::pair<int, uint32_t>> scoredTypes;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+	{
+		VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+		if (!(allowedTypes & (1 << i)) || (flags & required) != required) continue;
+		if ((flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && usage != MemoryUsage::GpuOnly && usage != MemoryUsage::GpuLazy) continue;
+
+		int score = 2 * static_cast<int>(countBits(flags & preferred)) - static_cast<int>(countBits(flags & avoided));
+		scoredTypes.push_back({ score, i });
+	}
+
+	// Stable: on a tie the lower index wins, drivers list their best types first
+	std::stable_sort(scoredTypes.begin(), scoredTypes.end(),
+		[](const std::pair<int, uint32_t>& a, const std::pair<int, uint32_t>& b) { return a.first > b.first; });
+
+	std::vector<uint32_t> memoryTypes;
+	for (const auto& scoredType : scoredTypes) memoryTypes.push_back(scoredType.second);
+	return memoryTypes;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkDeviceSize MemoryAllocator::getBlockSize(uint32_t memoryTypeIndex) const
+{
+	// Small heaps (256MB BAR...) get smaller blocks, so one block doesn't eat the heap
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+	VkDeviceSize size = blockSize;
+	while (size > heapSize / 8 && size > MIN_ALLOCATION_SIZE * 1024) size >>= 1;
+	return size;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool MemoryAllocator::allocateDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory& memory, void*& mapped)
+{
+	HeapStats& stats = heapStats[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex];
+
+	uint32_t liveAllocations = 0;
+	for (const HeapStats& heap : heapStats) liveAllocations += heap.blockCount;
+	if (liveAllocations >= maxAllocationCount) return false;
+
+	VkMemoryAllocateInfo memoryAllocInfo{};
+	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocInfo.allocationSize = size;
+	memoryAllocInfo.memoryTypeIndex = memoryTypeIndex;
+	if (vkAllocateMemory(device, &memoryAllocInfo, nullptr, &memory) != VK_SUCCESS) return false;
+
+	// Host visible memory is mapped once for its whole life
+	mapped = nullptr;
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+		{
+			vkFreeMemory(device, memory, nullptr);
+			return false;
+		}
+	}
+
+	++stats.blockCount;
+	stats.blockBytes += size;
+	return true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::freeDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory memory)
+{
+	// Freeing memory unmaps it
+	vkFreeMemory(device, memory, nullptr);
+
+	HeapStats& stats = heapStats[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex];
+	--stats.blockCount;
+	stats.blockBytes -= size;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool MemoryAllocator::allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, uint32_t& level)
+{
+	// Pieces are aligned on their size, a piece at least as big as the alignment is aligned
+	VkDeviceSize pieceSize = std::max(std::max(nextPowerOfTwo(size), nextPowerOfTwo(alignment)), MIN_ALLOCATION_SIZE);
+	if (pieceSize > block.size) return false;
+	level = log2(block.size / pieceSize);
+
+	// Smallest free piece that is big enough
+	int freeLevel = static_cast<int>(level);
+	while (freeLevel >= 0 && block.freeOffsets[freeLevel].empty()) --freeLevel;
+	if (freeLevel < 0) return false;
+
+	offset = *block.freeOffsets[freeLevel].begin();
+	block.freeOffsets[freeLevel].erase(block.freeOffsets[freeLevel].begin());
+
+	// Split it in two until it has the right size, the upper halves stay free
+	for (uint32_t splitLevel = freeLevel + 1; splitLevel <= level; ++splitLevel)
+	{
+		block.freeOffsets[splitLevel].insert(offset + (block.size >> splitLevel));
+	}
+
+	++block.allocationCount;
+	return true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void MemoryAllocator::freeToBlock(Block& block, VkDeviceSize offset, uint32_t level)
+{
+	// Merge with the buddy as long as it is free too
+	while (level > 0)
+	{
+		VkDeviceSize buddy = offset ^ (block.size >> level);
+		auto found = block.freeOffsets[level].find(buddy);
+		if (found == block.freeOffsets[level].end()) break;
+
+		block.freeOffsets[level].erase(found);
+		offset = std::min(offset, buddy);
+		--level;
+	}
+	block.freeOffsets[level].insert(offset);
+	--block.allocationCount;
+}
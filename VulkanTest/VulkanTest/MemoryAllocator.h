@@ -0,0 +1,127 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+// What the memory is used for, decides which memory type is picked
+enum class MemoryUsage
+{
+	GpuOnly,	// Written once or by the GPU only: render targets, static meshes
+	CpuToGpu,	// Rewritten by the CPU often (uniforms, dynamic vertices): device local + host visible (ReBAR) if there is one, maybe not coherent
+	Staging,	// CPU writes, GPU copies from it once: host memory, keeps the small ReBAR heap free
+	GpuToCpu,	// GPU writes, CPU reads back: host cached if possible
+	GpuLazy		// Transient attachments that never leave the tile: lazily allocated (tilers) if there is such a type, GpuOnly otherwise
+};
+
+// Piece of a VkDeviceMemory given by the MemoryAllocator
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0; // Asked size, the block given may be bigger
+	void* mapped = nullptr; // Host visible memory stays mapped, already offset
+	uint32_t memoryTypeIndex = 0;
+
+	// Where it came from, used to give it back
+	void* block = nullptr; // nullptr for dedicated allocations
+	uint32_t level = 0;
+};
+
+// Sub-allocator of device memory.
+// Vulkan limits the number of vkAllocateMemory (maxMemoryAllocationCount, 4096 on many drivers)
+// and each call is slow, so resources are carved out of big blocks, one set of blocks per
+// memory type. Each block is split with a buddy allocator: sizes are powers of two, a free
+// piece is merged back with its "buddy" when both are free. Buddies are aligned on their own
+// size, which covers every Vulkan alignment (all powers of two).
+//
+// Linear (buffers, linear images) and optimal (optimal images) resources never share a block,
+// so bufferImageGranularity can never be violated.
+//
+// Resources bigger than half a block get their own dedicated allocation.
+class MemoryAllocator
+{
+public:
+
+	struct HeapStats
+	{
+		VkDeviceSize heapSize = 0;
+		VkMemoryHeapFlags flags = 0;
+		uint32_t blockCount = 0; // vkAllocateMemory calls alive, blocks and dedicated allocations
+		VkDeviceSize blockBytes = 0; // Reserved from Vulkan
+		uint32_t allocationCount = 0; // Handed out to resources
+		VkDeviceSize usedBytes = 0; // Asked by resources
+	};
+
+	static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+	static const VkDeviceSize MIN_ALLOCATION_SIZE = 256;
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE);
+	void destroy();
+
+	// Throws std::runtime_error if no memory type can hold it
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, MemoryUsage usage, bool linear);
+	void free(MemoryAllocation& allocation);
+
+	// Create the resource, allocate and bind its memory
+	void createBuffer(const VkBufferCreateInfo& bufferCreateInfo, MemoryUsage usage, VkBuffer& buffer, MemoryAllocation& allocation);
+	void createImage(const VkImageCreateInfo& imageCreateInfo, MemoryUsage usage, VkImage& image, MemoryAllocation& allocation);
+	void destroyBuffer(VkBuffer buffer, MemoryAllocation& allocation);
+	void destroyImage(VkImage image, MemoryAllocation& allocation);
+
+	// Indexed like VkPhysicalDeviceMemoryProperties::memoryHeaps
+	std::vector<HeapStats> getHeapStats() const;
+
+	// Device local memory the CPU can write to directly (resizable BAR, or unified memory)
+	bool hasReBar() const { return reBarAvailable; }
+
+	// CPU writes are seen by the GPU without vkFlushMappedMemoryRanges. Always for every usage
+	// but CpuToGpu.
+	bool isHostCoherent(const MemoryAllocation& allocation) const
+	{
+		return (memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+	}
+
+private:
+
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint32_t levelCount = 0; // Level 0 is the whole block, level i is size >> i
+		void* mapped = nullptr;
+		uint32_t allocationCount = 0;
+		std::vector<std::set<VkDeviceSize>> freeOffsets; // Free pieces per level
+	};
+
+	// Blocks of one memory type, for linear or for optimal resources
+	struct Pool
+	{
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties{};
+	uint32_t maxAllocationCount = 0;
+	VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+	bool reBarAvailable = false;
+
+	// Memory of its own, kept to be freed at destroy if its resource never was
+	struct Dedicated
+	{
+		uint32_t memoryTypeIndex = 0;
+		VkDeviceSize size = 0;
+	};
+
+	std::vector<Pool> pools; // Index: memoryTypeIndex * 2 + (linear ? 1 : 0)
+	std::map<VkDeviceMemory, Dedicated> dedicatedAllocations;
+	std::vector<HeapStats> heapStats;
+
+	std::vector<uint32_t> rankMemoryTypes(uint32_t allowedTypes, MemoryUsage usage) const;
+	VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const;
+	bool allocateDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory& memory, void*& mapped);
+	void freeDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory memory);
+	bool allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, uint32_t& level);
+	void freeToBlock(Block& block, VkDeviceSize offset, uint32_t level);
+};
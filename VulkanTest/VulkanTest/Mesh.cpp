@@ -0,0 +1,55 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <cmath>
+
+void Mesh::create(MemoryAllocator& allocator, StagingUploader& uploader,
+	const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	vertexCount = static_cast<uint32_t>(vertices.size());
+	indexCount = static_cast<uint32_t>(indices.size());
+
+	boundingRadius = 0.0f;
+	for (const Vertex& vertex : vertices)
+	{
+		boundingRadius = std::max(boundingRadius, std::sqrt(vertex.position[0] * vertex.position[0] + vertex.position[1] * vertex.position[1]));
+	}
+
+	// -- VERTEX BUFFER -- //
+	VkBufferCreateInfo bufferCreateInfo{};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = sizeof(Vertex) * vertices.size();
+
+	// Written by the staging copies, then read as vertices
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	allocator.createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, vertexBuffer, vertexAllocation);
+
+	uploader.uploadBuffer(vertexBuffer, 0, vertices.data(), bufferCreateInfo.size,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+
+	// -- INDEX BUFFER -- //
+	bufferCreateInfo.size = sizeof(uint32_t) * indices.size();
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	allocator.createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, indexBuffer, indexAllocation);
+
+	uploader.uploadBuffer(indexBuffer, 0, indices.data(), bufferCreateInfo.size,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void Mesh::destroy(MemoryAllocator& allocator)
+{
+	// The GPU must be done with the buffers, and with their uploads
+	if (vertexBuffer != VK_NULL_HANDLE) allocator.destroyBuffer(vertexBuffer, vertexAllocation);
+	if (indexBuffer != VK_NULL_HANDLE) allocator.destroyBuffer(indexBuffer, indexAllocation);
+	vertexBuffer = VK_NULL_HANDLE;
+	indexBuffer = VK_NULL_HANDLE;
+	vertexCount = 0;
+	indexCount = 0;
+	boundingRadius = 0.0f;
+}
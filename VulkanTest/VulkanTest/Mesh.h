@@ -0,0 +1,37 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "VulkanUtilities.h"
+#include "StagingUploader.h"
+
+// Vertex and index buffers in device local memory.
+// Their content goes through the uploader: it is on the GPU once the upload batch ran,
+// which any frame submitted after the next flush is guaranteed to see.
+class Mesh
+{
+public:
+
+	void create(MemoryAllocator& allocator, StagingUploader& uploader,
+		const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+	void destroy(MemoryAllocator& allocator);
+
+	VkBuffer getVertexBuffer() const { return vertexBuffer; }
+	VkBuffer getIndexBuffer() const { return indexBuffer; }
+	uint32_t getVertexCount() const { return vertexCount; }
+	uint32_t getIndexCount() const { return indexCount; }
+
+	// Smallest circle around the mesh origin holding every vertex (x and y only), for culling
+	float getBoundingRadius() const { return boundingRadius; }
+
+private:
+
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	MemoryAllocation vertexAllocation;
+	uint32_t vertexCount = 0;
+
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	MemoryAllocation indexAllocation;
+	uint32_t indexCount = 0;
+
+	float boundingRadius = 0.0f;
+};
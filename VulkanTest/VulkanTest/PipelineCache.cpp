@@ -0,0 +1,123 @@
+#include "PipelineCache.h"
+#include "FileUtilities.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+void PipelineCache::create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& filePath)
+{
+	device = logicalDevice;
+	path = filePath;
+	loaded = false;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	// Read the previous cache, if there is one and it was made by this exact device and driver
+	std::vector<char> data;
+	std::ifstream file{ path, std::ios::binary | std::ios::ate };
+	if (file.is_open())
+	{
+		size_t fileSize = static_cast<size_t>(file.tellg());
+		file.seekg(0);
+
+		FileHeader header{};
+		if (fileSize >= sizeof(FileHeader) && file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader)))
+		{
+			FileHeader expected = makeHeader(header.dataSize, 0);
+			bool sameDevice = header.magic == expected.magic && header.headerVersion == expected.headerVersion
+				&& header.vendorID == expected.vendorID && header.deviceID == expected.deviceID
+				&& header.driverVersion == expected.driverVersion
+				&& memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+			if (sameDevice && header.dataSize == fileSize - sizeof(FileHeader))
+			{
+				data.resize(static_cast<size_t>(header.dataSize));
+				file.read(data.data(), data.size());
+				if (!file || hashBytes(data.data(), data.size()) != header.checksum) data.clear();
+			}
+		}
+
+		if (data.empty())
+		{
+			std::cerr << "Pipeline cache " << path << " is outdated or damaged, starting from an empty cache" << std::endl;
+		}
+	}
+
+	VkPipelineCacheCreateInfo cacheCreateInfo{};
+	cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheCreateInfo.initialDataSize = data.size();
+	cacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	VkResult result = vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache);
+	if (result != VK_SUCCESS && !data.empty())
+	{
+		// Driver didn't like the data after all, an empty cache is still better than nothing
+		cacheCreateInfo.initialDataSize = 0;
+		cacheCreateInfo.pInitialData = nullptr;
+		data.clear();
+		result = vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache);
+	}
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a pipeline cache");
+	}
+	loaded = !data.empty();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool PipelineCache::save()
+{
+	if (cache == VK_NULL_HANDLE || path.empty()) return false;
+
+	// Get the size first, then the data, right after room for our header
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) return false;
+	std::vector<char> fileData(sizeof(FileHeader) + dataSize);
+	char* data = fileData.data() + sizeof(FileHeader);
+	if (vkGetPipelineCacheData(device, cache, &dataSize, data) != VK_SUCCESS) return false;
+	fileData.resize(sizeof(FileHeader) + dataSize);
+
+	FileHeader header = makeHeader(dataSize, hashBytes(data, dataSize));
+	memcpy(fileData.data(), &header, sizeof(FileHeader));
+
+	return writeFileAtomic(path, fileData.data(), fileData.size());
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void PipelineCache::destroy()
+{
+	if (cache != VK_NULL_HANDLE) vkDestroyPipelineCache(device, cache, nullptr);
+	cache = VK_NULL_HANDLE;
+	device = VK_NULL_HANDLE;
+	loaded = false;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+PipelineCache::FileHeader PipelineCache::makeHeader(uint64_t dataSize, uint64_t dataChecksum) const
+{
+	// Zeroed so the padding bytes written to the file are always the same
+	FileHeader header;
+	memset(&header, 0, sizeof(FileHeader));
+	header.magic = MAGIC;
+	header.headerVersion = HEADER_VERSION;
+	header.vendorID = deviceProperties.vendorID;
+	header.deviceID = deviceProperties.deviceID;
+	header.driverVersion = deviceProperties.driverVersion;
+	memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.dataSize = dataSize;
+	header.checksum = dataChecksum;
+	return header;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+
+// VkPipelineCache saved on disk between launches, so pipelines compiled once are not
+// compiled again by the driver at the next startup.
+// The file starts with our own header: a blob made by another GPU or another driver version
+// is useless (at best), so it is thrown away instead of being given to the driver.
+class PipelineCache
+{
+public:
+
+	// Loads the file if it is valid for this device, starts empty otherwise
+	void create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& filePath);
+
+	// Write the cache back to disk. Written to a temporary file first then renamed over the
+	// old one, so a crash in the middle never leaves a half written cache behind.
+	bool save();
+	void destroy();
+
+	VkPipelineCache getHandle() const { return cache; }
+
+	// Whether the cache was filled from disk (warm start) or started empty (cold start)
+	bool wasLoaded() const { return loaded; }
+
+private:
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t headerVersion;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+		uint64_t checksum; // FNV-1a of the data, catches truncated or damaged files
+	};
+
+	static const uint32_t MAGIC = 0x43505456; // "VTPC"
+	static const uint32_t HEADER_VERSION = 1;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties deviceProperties{};
+	std::string path;
+	bool loaded = false;
+
+	FileHeader makeHeader(uint64_t dataSize, uint64_t checksum) const;
+};
@@ -0,0 +1,1141 @@
+#include "RenderGraph.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	struct UsageInfo
+	{
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+		bool writes;
+	};
+
+	UsageInfo getUsageInfo(ResourceUsage usage)
+	{
+		switch (usage)
+		{
+		case ResourceUsage::ColorAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+		case ResourceUsage::DepthAttachment:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+		case ResourceUsage::DepthAttachmentReadOnly:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false };
+		case ResourceUsage::SampledRead:
+			return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+		case ResourceUsage::StorageRead:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+		case ResourceUsage::StorageWrite:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true };
+		case ResourceUsage::IndirectRead:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case ResourceUsage::VertexRead:
+			return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case ResourceUsage::TransferRead:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+		case ResourceUsage::TransferWrite:
+		default:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+		}
+	}
+
+	// Only writes have to be made available, read bits in a source access mask mean nothing
+	const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	bool isAttachment(VkImageLayout layout)
+	{
+		return layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL || layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+			|| layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	}
+
+	bool sameAttachments(const std::vector<VkAttachmentDescription>& a, const std::vector<VkAttachmentDescription>& b)
+	{
+		if (a.size() != b.size()) return false;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (a[i].format != b[i].format || a[i].samples != b[i].samples || a[i].loadOp != b[i].loadOp || a[i].storeOp != b[i].storeOp
+				|| a[i].initialLayout != b[i].initialLayout || a[i].finalLayout != b[i].finalLayout) return false;
+		}
+		return true;
+	}
+
+	bool sameReference(const VkAttachmentReference& a, const VkAttachmentReference& b)
+	{
+		return a.attachment == b.attachment && a.layout == b.layout;
+	}
+
+	bool sameDependencies(const std::vector<VkSubpassDependency>& a, const std::vector<VkSubpassDependency>& b)
+	{
+		if (a.size() != b.size()) return false;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (a[i].srcSubpass != b[i].srcSubpass || a[i].dstSubpass != b[i].dstSubpass || a[i].srcStageMask != b[i].srcStageMask
+				|| a[i].dstStageMask != b[i].dstStageMask || a[i].srcAccessMask != b[i].srcAccessMask || a[i].dstAccessMask != b[i].dstAccessMask
+				|| a[i].dependencyFlags != b[i].dependencyFlags) return false;
+		}
+		return true;
+	}
+}
+
+
+void RenderGraph::PassContext::beginRenderPass(VkSubpassContents contents) const
+{
+	if (subpass == 0) vkCmdBeginRenderPass(commandBuffer, &renderPassBegin, contents);
+	else vkCmdNextSubpass(commandBuffer, contents);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::PassContext::endRenderPass() const
+{
+	if (lastSubpass) vkCmdEndRenderPass(commandBuffer);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::init(VkDevice logicalDevice, MemoryAllocator& memoryAllocator, DeletionQueue& frameDeletionQueue)
+{
+	device = logicalDevice;
+	allocator = &memoryAllocator;
+	deletionQueue = &frameDeletionQueue;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+
+	releaseFramebuffers();
+	for (RenderPassEntry& entry : renderPasses)
+	{
+		vkDestroyRenderPass(device, entry.renderPass, nullptr);
+	}
+	renderPasses.clear();
+	destroyTransientImages();
+	reset();
+
+	device = VK_NULL_HANDLE;
+	allocator = nullptr;
+	deletionQueue = nullptr;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::reset()
+{
+	resources.clear();
+	passes.clear();
+	finalBarriers.clear();
+	finalSrcStages = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, VkImage image, VkImageView view, VkFormat format, VkExtent2D extent,
+	VkImageAspectFlags aspect, VkImageLayout initialLayout, VkPipelineStageFlags srcStage, VkImageLayout finalLayout)
+{
+	ResourceNode node;
+	node.name = name;
+	node.isImage = true;
+	node.image = image;
+	node.view = view;
+	node.format = format;
+	node.extent = extent;
+	node.aspect = aspect;
+	node.initialLayout = initialLayout;
+	node.initialStages = srcStage;
+	node.finalLayout = finalLayout;
+	return addResource(node);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name, VkBuffer buffer)
+{
+	ResourceNode node;
+	node.name = name;
+	node.buffer = buffer;
+	return addResource(node);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name, VkFormat format, VkExtent2D extent, VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+	ResourceNode node;
+	node.name = name;
+	node.isImage = true;
+	node.transient = true;
+	node.format = format;
+	node.extent = extent;
+	node.usage = usage;
+	node.aspect = aspect;
+	return addResource(node);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::markOutput(Resource resource)
+{
+	resources[resource].output = true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+RenderGraph::Pass RenderGraph::addGraphicsPass(const std::string& name, RecordFunction record)
+{
+	PassNode node;
+	node.name = name;
+	node.graphics = true;
+	node.record = std::move(record);
+	passes.push_back(std::move(node));
+	return static_cast<Pass>(passes.size() - 1);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+RenderGraph::Pass RenderGraph::addGraphicsSubpass(const std::string& name, RecordFunction record)
+{
+	Pass pass = addGraphicsPass(name, std::move(record));
+	if (pass == 0 || !passes[pass - 1].graphics)
+	{
+		throw std::runtime_error("Render graph: subpass " + name + " doesn't follow a graphics pass");
+	}
+	passes[pass].subpassOfPrevious = true;
+	return pass;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+RenderGraph::Pass RenderGraph::addComputePass(const std::string& name, RecordFunction record)
+{
+	PassNode node;
+	node.name = name;
+	node.record = std::move(record);
+	passes.push_back(std::move(node));
+	return static_cast<Pass>(passes.size() - 1);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::read(Pass pass, Resource resource, ResourceUsage usage)
+{
+	use(pass, resource, usage, false, false, {});
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::write(Pass pass, Resource resource, ResourceUsage usage)
+{
+	use(pass, resource, usage, true, false, {});
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::writeCleared(Pass pass, Resource resource, ResourceUsage usage, VkClearValue clearValue)
+{
+	use(pass, resource, usage, true, true, clearValue);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::compile()
+{
+	stats = {};
+	stats.passCount = static_cast<uint32_t>(passes.size());
+
+	cullPasses();
+	mergeSubpasses();
+	createTransientImages();
+	computeBarriers();
+	createRenderPasses();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer)
+{
+	for (PassNode& pass : passes)
+	{
+		if (pass.culled) continue;
+
+		// A later subpass's barriers were recorded before its render pass began
+		if (pass.srcStages != 0)
+		{
+			bool memoryBarrier = pass.memoryBarrier.srcAccessMask != 0 || pass.memoryBarrier.dstAccessMask != 0;
+			vkCmdPipelineBarrier(commandBuffer, pass.srcStages, pass.dstStages, 0,
+				memoryBarrier ? 1 : 0, memoryBarrier ? &pass.memoryBarrier : nullptr, 0, nullptr,
+				static_cast<uint32_t>(pass.imageBarriers.size()), pass.imageBarriers.data());
+		}
+
+		PassContext context;
+		context.commandBuffer = commandBuffer;
+		if (pass.graphics)
+		{
+			const PassNode& firstPass = passes[pass.firstPass];
+			context.renderPassBegin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			context.renderPassBegin.renderPass = firstPass.renderPass;
+			context.renderPassBegin.framebuffer = firstPass.framebuffer;
+			context.renderPassBegin.renderArea = { { 0, 0 }, firstPass.extent };
+			context.renderPassBegin.clearValueCount = static_cast<uint32_t>(firstPass.clearValues.size());
+			context.renderPassBegin.pClearValues = firstPass.clearValues.data();
+			context.subpass = pass.subpass;
+			context.lastSubpass = pass.lastSubpass;
+		}
+		if (pass.record) pass.record(context);
+	}
+
+	if (!finalBarriers.empty())
+	{
+		vkCmdPipelineBarrier(commandBuffer, finalSrcStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+			static_cast<uint32_t>(finalBarriers.size()), finalBarriers.data());
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkRenderPass RenderGraph::getRenderPass(Pass pass) const
+{
+	return passes[pass].renderPass;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t RenderGraph::getSubpass(Pass pass) const
+{
+	return passes[pass].subpass;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::releaseFramebuffers()
+{
+	for (FramebufferEntry& entry : framebuffers)
+	{
+		vkDestroyFramebuffer(device, entry.framebuffer, nullptr);
+	}
+	framebuffers.clear();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::retireImageViews(const std::vector<VkImageView>& views)
+{
+	std::vector<VkFramebuffer> retired;
+	for (size_t i = 0; i < framebuffers.size();)
+	{
+		bool usesView = false;
+		for (VkImageView view : framebuffers[i].views) usesView |= std::find(views.begin(), views.end(), view) != views.end();
+		if (!usesView)
+		{
+			++i;
+			continue;
+		}
+		retired.push_back(framebuffers[i].framebuffer);
+		framebuffers.erase(framebuffers.begin() + i);
+	}
+	if (retired.empty()) return;
+
+	VkDevice logicalDevice = device;
+	deletionQueue->push([logicalDevice, retired]()
+	{
+		for (VkFramebuffer framebuffer : retired) vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+	});
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+RenderGraph::Resource RenderGraph::addResource(ResourceNode node)
+{
+	resources.push_back(std::move(node));
+	return static_cast<Resource>(resources.size() - 1);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::use(Pass pass, Resource resource, ResourceUsage usage, bool writes, bool clear, VkClearValue clearValue)
+{
+	UsageInfo info = getUsageInfo(usage);
+	bool isImage = resources[resource].isImage;
+
+	// The barriers follow the usage: a write declared with a read usage would never be waited for
+	if (info.writes != writes)
+	{
+		throw std::runtime_error("Render graph: pass " + passes[pass].name + (writes ? " writes " : " reads ")
+			+ resources[resource].name + " with a usage that " + (info.writes ? "writes" : "only reads"));
+	}
+
+	// A resource used several ways in one pass (e.g. cleared by a transfer, then written by
+	// a shader) is one use: the pass orders its own commands
+	std::vector<ResourceUse>& uses = passes[pass].uses;
+	auto existing = std::find_if(uses.begin(), uses.end(), [resource](const ResourceUse& u) { return u.resource == resource; });
+	if (existing != uses.end())
+	{
+		if (isImage && existing->access.layout != info.layout)
+		{
+			throw std::runtime_error("Render graph: pass " + passes[pass].name + " uses " + resources[resource].name + " in two layouts");
+		}
+		existing->access.stages |= info.stages;
+		existing->access.access |= info.access;
+		existing->access.writes |= info.writes;
+		existing->clear |= clear;
+		if (clear) existing->clearValue = clearValue;
+		return;
+	}
+
+	ResourceUse newUse;
+	newUse.resource = resource;
+	newUse.access = { info.stages, info.access, isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED, info.writes };
+	newUse.clear = clear;
+	newUse.clearValue = clearValue;
+	uses.push_back(newUse);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::cullPasses()
+{
+	// From the last pass back: a pass is kept if it writes something still needed. What it
+	// reads is then needed, and so is what it writes without clearing (it builds on it).
+	std::vector<bool> needed(resources.size());
+	for (size_t r = 0; r < resources.size(); ++r)
+	{
+		needed[r] = resources[r].output;
+	}
+
+	for (size_t p = passes.size(); p-- > 0;)
+	{
+		PassNode& pass = passes[p];
+		bool kept = false;
+		for (ResourceUse& use : pass.uses)
+		{
+			use.usedAfter = needed[use.resource];
+			kept |= use.access.writes && needed[use.resource];
+		}
+
+		pass.culled = !kept;
+		if (pass.culled)
+		{
+			++stats.culledPassCount;
+			continue;
+		}
+
+		for (const ResourceUse& use : pass.uses)
+		{
+			if (!use.access.writes || !use.clear) needed[use.resource] = true;
+			else needed[use.resource] = false; // Cleared: what came before doesn't matter
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::mergeSubpasses()
+{
+	// A subpass joins the render pass before it only if that pass is recorded too
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		PassNode& pass = passes[p];
+		pass.firstPass = p;
+		pass.subpass = 0;
+		pass.lastSubpass = true;
+		if (pass.culled || !pass.subpassOfPrevious) continue;
+
+		PassNode& previous = passes[p - 1];
+		if (previous.culled) continue;
+		pass.firstPass = previous.firstPass;
+		pass.subpass = previous.subpass + 1;
+		previous.lastSubpass = false;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::createTransientImages()
+{
+	// Transient images used by the passes left, with their lifetimes
+	std::vector<TransientImage> wanted;
+	std::vector<Resource> wantedResources;
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		if (passes[p].culled) continue;
+		for (const ResourceUse& use : passes[p].uses)
+		{
+			ResourceNode& node = resources[use.resource];
+			if (!node.transient) continue;
+
+			auto found = std::find(wantedResources.begin(), wantedResources.end(), use.resource);
+			if (found != wantedResources.end())
+			{
+				wanted[found - wantedResources.begin()].lastPass = p;
+				continue;
+			}
+
+			TransientImage image;
+			image.format = node.format;
+			image.extent = node.extent;
+			image.usage = node.usage;
+			image.aspect = node.aspect;
+			image.firstPass = p;
+			image.lastPass = p;
+			wanted.push_back(image);
+			wantedResources.push_back(use.resource);
+		}
+	}
+
+	// Same shape as last frame: same images, same aliasing
+	bool same = wanted.size() == transientImages.size();
+	for (size_t i = 0; same && i < wanted.size(); ++i)
+	{
+		const TransientImage& a = wanted[i];
+		const TransientImage& b = transientImages[i];
+		same = a.format == b.format && a.extent.width == b.extent.width && a.extent.height == b.extent.height
+			&& a.usage == b.usage && a.aspect == b.aspect && a.firstPass == b.firstPass && a.lastPass == b.lastPass;
+	}
+
+	if (!same)
+	{
+		// Frames in flight may still use the old images: they go when those frames are done
+		retireTransientImages();
+		transientImages = wanted;
+
+		for (TransientImage& image : transientImages)
+		{
+			VkImageCreateInfo imageCreateInfo{};
+			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.format = image.format;
+			imageCreateInfo.extent = { image.extent.width, image.extent.height, 1 };
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.usage = image.usage;
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if (vkCreateImage(device, &imageCreateInfo, nullptr, &image.image) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Render graph: failed to create a transient image");
+			}
+			vkGetImageMemoryRequirements(device, image.image, &image.memoryRequirements);
+		}
+
+		// Greedy aliasing, in order of first use: an image goes in the first slot whose last
+		// image is done before it starts and whose memory type suits it. Slots grow to fit.
+		for (uint32_t i = 0; i < transientImages.size(); ++i)
+		{
+			TransientImage& image = transientImages[i];
+			uint32_t slot = 0;
+			for (; slot < memorySlots.size(); ++slot)
+			{
+				const MemorySlot& candidate = memorySlots[slot];
+				bool free = transientImages[candidate.images.back()].lastPass < image.firstPass;
+				bool compatible = (candidate.memoryRequirements.memoryTypeBits & image.memoryRequirements.memoryTypeBits) != 0;
+				if (free && compatible) break;
+			}
+			if (slot == memorySlots.size())
+			{
+				memorySlots.emplace_back();
+				memorySlots.back().memoryRequirements = image.memoryRequirements;
+			}
+
+			MemorySlot& memorySlot = memorySlots[slot];
+			memorySlot.memoryRequirements.size = std::max(memorySlot.memoryRequirements.size, image.memoryRequirements.size);
+			memorySlot.memoryRequirements.alignment = std::max(memorySlot.memoryRequirements.alignment, image.memoryRequirements.alignment);
+			memorySlot.memoryRequirements.memoryTypeBits &= image.memoryRequirements.memoryTypeBits;
+			memorySlot.images.push_back(i);
+			image.memorySlot = slot;
+		}
+
+		for (MemorySlot& memorySlot : memorySlots)
+		{
+			// Attachments that never leave the render pass can live in lazily allocated memory
+			// (on tilers they stay in tile memory), if every image sharing the slot is one
+			bool lazy = true;
+			for (uint32_t i : memorySlot.images) lazy &= (transientImages[i].usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+			memorySlot.allocation = allocator->allocate(memorySlot.memoryRequirements, lazy ? MemoryUsage::GpuLazy : MemoryUsage::GpuOnly, false);
+			for (uint32_t i : memorySlot.images)
+			{
+				TransientImage& image = transientImages[i];
+				vkBindImageMemory(device, image.image, memorySlot.allocation.memory, memorySlot.allocation.offset);
+
+				VkImageViewCreateInfo viewCreateInfo{};
+				viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+				viewCreateInfo.image = image.image;
+				viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+				viewCreateInfo.format = image.format;
+				viewCreateInfo.subresourceRange = { image.aspect, 0, 1, 0, 1 };
+				if (vkCreateImageView(device, &viewCreateInfo, nullptr, &image.view) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Render graph: failed to create a transient image view");
+				}
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < wantedResources.size(); ++i)
+	{
+		ResourceNode& node = resources[wantedResources[i]];
+		node.transientIndex = i;
+		node.image = transientImages[i].image;
+		node.view = transientImages[i].view;
+	}
+
+	stats.transientImageCount = static_cast<uint32_t>(transientImages.size());
+	for (const MemorySlot& memorySlot : memorySlots) stats.transientBytes += memorySlot.memoryRequirements.size;
+	for (const TransientImage& image : transientImages) stats.unaliasedTransientBytes += image.memoryRequirements.size;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::destroyTransientImages()
+{
+	for (TransientImage& image : transientImages)
+	{
+		vkDestroyImageView(device, image.view, nullptr);
+		vkDestroyImage(device, image.image, nullptr);
+	}
+	transientImages.clear();
+
+	for (MemorySlot& memorySlot : memorySlots)
+	{
+		allocator->free(memorySlot.allocation);
+	}
+	memorySlots.clear();
+
+	// The views are gone, so are the framebuffers made with them
+	releaseFramebuffers();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::retireTransientImages()
+{
+	if (transientImages.empty()) return;
+
+	std::vector<VkImageView> views;
+	for (const TransientImage& image : transientImages) views.push_back(image.view);
+	retireImageViews(views);
+
+	// Handed over as they are, the deleter owns them from now on
+	VkDevice logicalDevice = device;
+	MemoryAllocator* memoryAllocator = allocator;
+	std::vector<TransientImage> images = std::move(transientImages);
+	std::vector<MemorySlot> slots = std::move(memorySlots);
+	deletionQueue->push([logicalDevice, memoryAllocator, images, slots]() mutable
+	{
+		for (TransientImage& image : images)
+		{
+			vkDestroyImageView(logicalDevice, image.view, nullptr);
+			vkDestroyImage(logicalDevice, image.image, nullptr);
+		}
+		for (MemorySlot& memorySlot : slots) memoryAllocator->free(memorySlot.allocation);
+	});
+	transientImages.clear();
+	memorySlots.clear();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::computeBarriers()
+{
+	std::vector<ResourceState> states(resources.size());
+	for (size_t r = 0; r < resources.size(); ++r)
+	{
+		const ResourceNode& node = resources[r];
+		if (!node.isImage || node.transient) continue;
+		states[r].layout = node.initialLayout;
+		states[r].writeStages = node.initialStages;
+	}
+
+	// A transient image starts after the image before it in its slot, the first one of a slot
+	// after the slot's last image in the previous frame. Contents never survive, but the
+	// previous image's writes are made available before the memory is written over.
+	std::vector<VkPipelineStageFlags> transientLastStages(transientImages.size(), 0);
+	std::vector<VkAccessFlags> transientLastWriteAccess(transientImages.size(), 0);
+	std::vector<bool> transientStarted(transientImages.size(), false);
+
+	for (PassNode& pass : passes)
+	{
+		pass.dependencies.clear();
+		pass.imageBarriers.clear();
+		pass.memoryBarrier = {};
+		pass.memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		pass.srcStages = 0;
+		pass.dstStages = 0;
+	}
+
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		PassNode& pass = passes[p];
+		if (pass.culled) continue;
+
+		// No barrier between subpasses: a later subpass's go before its render pass
+		PassNode& barrierPass = passes[pass.firstPass];
+		for (ResourceUse& use : pass.uses)
+		{
+			const ResourceNode& node = resources[use.resource];
+			ResourceState& state = states[use.resource];
+
+			if (node.transient && !transientStarted[node.transientIndex])
+			{
+				const MemorySlot& memorySlot = memorySlots[transientImages[node.transientIndex].memorySlot];
+				auto position = std::find(memorySlot.images.begin(), memorySlot.images.end(), node.transientIndex);
+				bool firstInSlot = position == memorySlot.images.begin();
+				state.writeStages = firstInSlot ? memorySlot.lastStages : transientLastStages[*(position - 1)];
+				state.writeAccess = firstInSlot ? memorySlot.lastWriteAccess : transientLastWriteAccess[*(position - 1)];
+				transientStarted[node.transientIndex] = true;
+			}
+
+			use.discard = node.isImage && state.layout == VK_IMAGE_LAYOUT_UNDEFINED;
+			bool sameRenderPass = pass.graphics && state.renderPass == pass.firstPass;
+			if (sameRenderPass && node.isImage && isAttachment(use.access.layout))
+			{
+				// From the subpass that used it last, pixel by pixel
+				auto dependency = std::find_if(pass.dependencies.begin(), pass.dependencies.end(),
+					[&](const VkSubpassDependency& d) { return d.srcSubpass == state.subpass; });
+				if (dependency == pass.dependencies.end())
+				{
+					VkSubpassDependency newDependency{};
+					newDependency.srcSubpass = state.subpass;
+					newDependency.dstSubpass = pass.subpass;
+					newDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+					pass.dependencies.push_back(newDependency);
+					dependency = pass.dependencies.end() - 1;
+				}
+				addBarrier(pass, node, state, use.access, &*dependency);
+			}
+			else if (sameRenderPass && (use.access.writes || state.writtenInRenderPass))
+			{
+				throw std::runtime_error("Render graph: subpass " + pass.name + " can't wait for " + node.name
+					+ " inside its render pass, only attachments go from one subpass to the next");
+			}
+			else
+			{
+				addBarrier(barrierPass, node, state, use.access);
+			}
+			state.writtenInRenderPass = (sameRenderPass && state.writtenInRenderPass) || use.access.writes;
+			state.renderPass = pass.graphics ? pass.firstPass : NO_PASS;
+			state.subpass = pass.subpass;
+
+			if (node.transient)
+			{
+				// The last write and the reads after it
+				transientLastStages[node.transientIndex] = state.writeStages | state.readStages;
+				transientLastWriteAccess[node.transientIndex] = state.writeAccess;
+			}
+		}
+
+	}
+
+	for (PassNode& pass : passes)
+	{
+		if (pass.culled) continue;
+
+		// Only layout changes with nothing to wait for: still a barrier, after nothing
+		if (pass.dstStages != 0 && pass.srcStages == 0) pass.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		if (pass.srcStages != 0)
+		{
+			++stats.barrierCount;
+			stats.imageBarrierCount += static_cast<uint32_t>(pass.imageBarriers.size());
+		}
+
+		// Reads of what the earlier subpass read need no dependency
+		pass.dependencies.erase(std::remove_if(pass.dependencies.begin(), pass.dependencies.end(),
+			[](const VkSubpassDependency& d) { return d.srcStageMask == 0; }), pass.dependencies.end());
+		stats.subpassDependencyCount += static_cast<uint32_t>(pass.dependencies.size());
+	}
+
+	// Imported images end in the layout asked for
+	for (size_t r = 0; r < resources.size(); ++r)
+	{
+		const ResourceNode& node = resources[r];
+		const ResourceState& state = states[r];
+		if (!node.isImage || node.transient || node.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || node.finalLayout == state.layout) continue;
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = state.writeAccess;
+		barrier.dstAccessMask = 0;
+		barrier.oldLayout = state.layout;
+		barrier.newLayout = node.finalLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = node.image;
+		barrier.subresourceRange = { node.aspect, 0, 1, 0, 1 };
+		finalBarriers.push_back(barrier);
+		finalSrcStages |= state.writeStages | state.readStages;
+	}
+	if (!finalBarriers.empty())
+	{
+		if (finalSrcStages == 0) finalSrcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		++stats.barrierCount;
+		stats.imageBarrierCount += static_cast<uint32_t>(finalBarriers.size());
+	}
+
+	// What the next frame's first image of each slot waits for
+	for (MemorySlot& memorySlot : memorySlots)
+	{
+		memorySlot.lastStages = transientLastStages[memorySlot.images.back()];
+		memorySlot.lastWriteAccess = transientLastWriteAccess[memorySlot.images.back()];
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::addBarrier(PassNode& pass, const ResourceNode& resource, ResourceState& state, const Access& access, VkSubpassDependency* dependency)
+{
+	bool layoutChange = resource.isImage && access.layout != state.layout;
+	VkPipelineStageFlags srcStages = 0;
+	VkAccessFlags srcAccess = 0;
+	if (layoutChange || access.writes)
+	{
+		// After the last write, and after every read since (write after read only needs the order)
+		srcStages = state.writeStages | state.readStages;
+		srcAccess = state.writeAccess;
+	}
+	else if (state.writeStages != 0)
+	{
+		// Read: the last write has to be visible to this stage, unless an earlier barrier did it
+		bool visible = (state.visibleStages & access.stages) == access.stages && (state.visibleAccess & access.access) == access.access;
+		if (!visible)
+		{
+			srcStages = state.writeStages;
+			srcAccess = state.writeAccess;
+		}
+	}
+
+	if (dependency != nullptr)
+	{
+		// The render pass changes the layout between the subpasses, through their attachment references
+		if (srcStages != 0)
+		{
+			dependency->srcStageMask |= srcStages;
+			dependency->dstStageMask |= access.stages;
+			dependency->srcAccessMask |= srcAccess;
+			dependency->dstAccessMask |= access.access;
+		}
+	}
+	else if (layoutChange || srcStages != 0)
+	{
+		pass.srcStages |= srcStages;
+		pass.dstStages |= access.stages;
+		if (layoutChange)
+		{
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = access.access;
+			barrier.oldLayout = state.layout;
+			barrier.newLayout = access.layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = resource.image;
+			barrier.subresourceRange = { resource.aspect, 0, 1, 0, 1 };
+			pass.imageBarriers.push_back(barrier);
+		}
+		else if (srcAccess != 0)
+		{
+			// One global barrier covers every buffer: cheaper than a barrier per buffer
+			pass.memoryBarrier.srcAccessMask |= srcAccess;
+			pass.memoryBarrier.dstAccessMask |= access.access;
+		}
+	}
+
+	if (access.writes)
+	{
+		state.writeStages = access.stages;
+		state.writeAccess = access.access & WRITE_ACCESS;
+		state.readStages = 0;
+		state.visibleStages = 0;
+		state.visibleAccess = 0;
+	}
+	else if (layoutChange)
+	{
+		// The transition is a write of its own: later readers chain on this pass's stages
+		state.writeStages = access.stages;
+		state.writeAccess = 0;
+		state.readStages = access.stages;
+		state.visibleStages = access.stages;
+		state.visibleAccess = access.access;
+	}
+	else
+	{
+		state.readStages |= access.stages;
+		if (srcStages != 0)
+		{
+			state.visibleStages |= access.stages;
+			state.visibleAccess |= access.access;
+		}
+	}
+	if (resource.isImage) state.layout = access.layout;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void RenderGraph::createRenderPasses()
+{
+	for (PassNode& pass : passes)
+	{
+		pass.renderPass = VK_NULL_HANDLE;
+		pass.framebuffer = VK_NULL_HANDLE;
+		pass.clearValues.clear();
+	}
+
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		PassNode& pass = passes[p];
+		if (pass.culled || !pass.graphics || pass.subpass != 0) continue;
+
+		// Every subpass of the render pass: it is made once, with the first
+		uint32_t last = p;
+		while (!passes[last].lastSubpass) ++last;
+
+		RenderPassEntry description;
+		std::vector<Resource> attachmentResources;
+		std::vector<VkImageView> views;
+		for (uint32_t s = p; s <= last; ++s)
+		{
+			const PassNode& subpass = passes[s];
+			SubpassAttachments references;
+			for (const ResourceUse& use : subpass.uses)
+			{
+				const ResourceNode& node = resources[use.resource];
+				if (!node.isImage || !isAttachment(use.access.layout)) continue;
+
+				auto found = std::find(attachmentResources.begin(), attachmentResources.end(), use.resource);
+				uint32_t index = static_cast<uint32_t>(found - attachmentResources.begin());
+				if (found == attachmentResources.end())
+				{
+					// Layouts are the graph's business: the render pass starts in the one its first use needs
+					VkAttachmentDescription attachment{};
+					attachment.format = node.format;
+					attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+					attachment.loadOp = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : use.discard ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_LOAD;
+					attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+					attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+					attachment.initialLayout = use.access.layout;
+					description.attachments.push_back(attachment);
+					attachmentResources.push_back(use.resource);
+					views.push_back(node.view);
+					pass.clearValues.push_back(use.clearValue);
+					pass.extent = node.extent;
+				}
+				else if (use.clear)
+				{
+					throw std::runtime_error("Render graph: subpass " + subpass.name + " clears " + node.name + ", an earlier subpass already uses it");
+				}
+
+				// Stored if what the last subpass using it leaves is needed, ends in that subpass's layout
+				VkAttachmentDescription& attachment = description.attachments[index];
+				attachment.storeOp = use.usedAfter ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				attachment.finalLayout = use.access.layout;
+
+				if (use.access.layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) references.colors.push_back({ index, use.access.layout });
+				else references.depth = { index, use.access.layout };
+			}
+			description.subpasses.push_back(references);
+			description.dependencies.insert(description.dependencies.end(), subpass.dependencies.begin(), subpass.dependencies.end());
+		}
+		if (description.attachments.empty())
+		{
+			throw std::runtime_error("Render graph: graphics pass " + pass.name + " has no attachment");
+		}
+
+		VkRenderPass renderPass = getOrCreateRenderPass(description);
+		VkFramebuffer framebuffer = getOrCreateFramebuffer(renderPass, views, pass.extent);
+		for (uint32_t s = p; s <= last; ++s)
+		{
+			passes[s].renderPass = renderPass;
+			passes[s].framebuffer = framebuffer;
+			passes[s].extent = pass.extent;
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkRenderPass RenderGraph::getOrCreateRenderPass(const RenderPassEntry& description)
+{
+	for (const RenderPassEntry& entry : renderPasses)
+	{
+		if (!sameAttachments(entry.attachments, description.attachments) || entry.subpasses.size() != description.subpasses.size()
+			|| !sameDependencies(entry.dependencies, description.dependencies)) continue;
+
+		bool sameSubpasses = true;
+		for (size_t i = 0; i < entry.subpasses.size() && sameSubpasses; ++i)
+		{
+			const SubpassAttachments& a = entry.subpasses[i];
+			const SubpassAttachments& b = description.subpasses[i];
+			sameSubpasses = a.colors.size() == b.colors.size() && sameReference(a.depth, b.depth)
+				&& std::equal(a.colors.begin(), a.colors.end(), b.colors.begin(), sameReference);
+		}
+		if (sameSubpasses) return entry.renderPass;
+	}
+
+	// Color attachments in the order declared, at most one depth attachment per subpass
+	std::vector<VkSubpassDescription> subpasses;
+	for (const SubpassAttachments& references : description.subpasses)
+	{
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(references.colors.size());
+		subpass.pColorAttachments = references.colors.data();
+		subpass.pDepthStencilAttachment = references.depth.attachment != VK_ATTACHMENT_UNUSED ? &references.depth : nullptr;
+		subpasses.push_back(subpass);
+	}
+
+	// No external dependencies: the graph's barriers order the render passes
+	VkRenderPassCreateInfo renderPassCreateInfo{};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(description.attachments.size());
+	renderPassCreateInfo.pAttachments = description.attachments.data();
+	renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+	renderPassCreateInfo.pSubpasses = subpasses.data();
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(description.dependencies.size());
+	renderPassCreateInfo.pDependencies = description.dependencies.data();
+
+	RenderPassEntry entry = description;
+	if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &entry.renderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Render graph: could not create a render pass");
+	}
+	renderPasses.push_back(entry);
+	return entry.renderPass;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkFramebuffer RenderGraph::getOrCreateFramebuffer(VkRenderPass renderPass, const std::vector<VkImageView>& views, VkExtent2D extent)
+{
+	for (const FramebufferEntry& entry : framebuffers)
+	{
+		if (entry.renderPass == renderPass && entry.views == views && entry.extent.width == extent.width && entry.extent.height == extent.height)
+		{
+			return entry.framebuffer;
+		}
+	}
+
+	VkFramebufferCreateInfo framebufferCreateInfo{};
+	framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferCreateInfo.renderPass = renderPass;
+	framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(views.size());
+	framebufferCreateInfo.pAttachments = views.data();
+	framebufferCreateInfo.width = extent.width;
+	framebufferCreateInfo.height = extent.height;
+	framebufferCreateInfo.layers = 1;
+
+	FramebufferEntry entry;
+	entry.renderPass = renderPass;
+	entry.views = views;
+	entry.extent = extent;
+	if (vkCreateFramebuffer(device, &framebufferCreateInfo, nullptr, &entry.framebuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Render graph: failed to create a framebuffer");
+	}
+	framebuffers.push_back(entry);
+	return entry.framebuffer;
+}
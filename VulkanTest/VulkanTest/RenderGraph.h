@@ -0,0 +1,283 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "MemoryAllocator.h"
+#include "DeletionQueue.h"
+
+// How a pass uses a resource: gives the pipeline stages, the access and (for images) the layout
+enum class ResourceUsage
+{
+	ColorAttachment,		// Written, and read by blending
+	DepthAttachment,		// Depth test and write
+	DepthAttachmentReadOnly,// Depth test only
+	SampledRead,			// Fragment shader
+	StorageRead,			// Compute shader
+	StorageWrite,			// Compute shader, read-modify-write allowed (atomics)
+	IndirectRead,			// Draw parameters
+	VertexRead,				// Vertex attributes
+	TransferRead,
+	TransferWrite
+};
+
+// Frame graph: the frame is described as passes that declare which resources they read and
+// write, and the graph works out everything in between.
+// - Barriers: each use of a resource is checked against the previous ones, and one
+//   vkCmdPipelineBarrier is recorded before each pass with exactly the stages and accesses
+//   involved. Reads after reads need nothing, layout changes are image barriers.
+// - Render passes: one VkRenderPass per graphics pass, with load and store ops picked from
+//   what comes before and after (a transient attachment nobody reads after is not stored).
+//   Layouts are changed by the graph's barriers, before the render pass.
+// - Subpasses: a graphics pass added as a subpass joins the render pass of the pass before
+//   it. Attachments they share go from one subpass to the next through by-region subpass
+//   dependencies (the render pass changes their layout), never through memory: a depth
+//   buffer cleared in the first subpass and dropped after the last can stay a lazily
+//   allocated transient attachment. Barriers the later subpasses need go before the render pass.
+// - Culling: passes whose results reach no output are not recorded.
+// - Transient images: created by the graph, images whose lifetimes (first to last pass
+//   using them) don't overlap share memory.
+//
+// The graph is declared again every frame (reset, declare, compile, execute): a few passes
+// cost next to nothing to compile. Render passes, framebuffers and transient images are
+// cached between frames and only made again when the frame changes shape (e.g. a resize),
+// the old ones go to the deletion queue: frames in flight may still use them.
+class RenderGraph
+{
+public:
+
+	using Resource = uint32_t;
+	using Pass = uint32_t;
+
+	// What a pass records with. Graphics passes begin and end their render pass themselves
+	// (they pick the subpass contents), renderPassBegin is ready for it, clear values included.
+	struct PassContext
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkRenderPassBeginInfo renderPassBegin{};
+		uint32_t subpass = 0; // Of the pass in its render pass, for secondary command buffers
+		bool lastSubpass = true;
+
+		// Begins the render pass, or goes on to the pass's subpass when it follows another
+		void beginRenderPass(VkSubpassContents contents) const;
+		// Ends the render pass after its last subpass only
+		void endRenderPass() const;
+	};
+	using RecordFunction = std::function<void(const PassContext&)>;
+
+	struct Stats
+	{
+		uint32_t passCount = 0; // Declared
+		uint32_t culledPassCount = 0;
+		uint32_t barrierCount = 0; // vkCmdPipelineBarrier calls
+		uint32_t subpassDependencyCount = 0; // Between subpasses, in place of barriers
+		uint32_t imageBarrierCount = 0;
+		uint32_t transientImageCount = 0;
+		VkDeviceSize transientBytes = 0; // Memory the transient images use
+		VkDeviceSize unaliasedTransientBytes = 0; // What they would use without aliasing
+	};
+
+	void init(VkDevice device, MemoryAllocator& allocator, DeletionQueue& deletionQueue);
+	void destroy();
+
+	// Forget the passes and resources declared, keep the cached objects
+	void reset();
+
+	// Images made outside of the graph (e.g. swapchain images). The graph changes them from
+	// initialLayout, after whatever ran before in srcStage, and leaves them in finalLayout.
+	// VK_IMAGE_LAYOUT_UNDEFINED as initial layout means the contents are thrown away.
+	Resource importImage(const std::string& name, VkImage image, VkImageView view, VkFormat format, VkExtent2D extent,
+		VkImageAspectFlags aspect, VkImageLayout initialLayout, VkPipelineStageFlags srcStage, VkImageLayout finalLayout);
+	// Buffers made outside of the graph. Only what passes of this frame do is synchronised.
+	Resource importBuffer(const std::string& name, VkBuffer buffer);
+	// Images made and owned by the graph, alive for the frame only. With TRANSIENT_ATTACHMENT
+	// usage they get lazily allocated memory when the device has it.
+	Resource createImage(const std::string& name, VkFormat format, VkExtent2D extent, VkImageUsageFlags usage, VkImageAspectFlags aspect);
+
+	// Kept even when no pass reads them (the swapchain image, data read back...)
+	void markOutput(Resource resource);
+
+	Pass addGraphicsPass(const std::string& name, RecordFunction record);
+	// Next subpass of the graphics pass added just before, in the same render pass. On its own
+	// when that pass is culled.
+	Pass addGraphicsSubpass(const std::string& name, RecordFunction record);
+	Pass addComputePass(const std::string& name, RecordFunction record); // Compute and transfer work
+
+	// Throw std::runtime_error if the usage doesn't go that way (e.g. read with StorageWrite)
+	void read(Pass pass, Resource resource, ResourceUsage usage);
+	void write(Pass pass, Resource resource, ResourceUsage usage);
+	// Attachment written with a clear first (LOAD_OP_CLEAR)
+	void writeCleared(Pass pass, Resource resource, ResourceUsage usage, VkClearValue clearValue);
+
+	// Cull, work out the barriers, get the render passes, framebuffers and transient images
+	void compile();
+	void execute(VkCommandBuffer commandBuffer);
+
+	// Valid after compile. Pipelines can be made with it and the pass's subpass, it stays the
+	// same while the render pass keeps the same subpasses and attachments.
+	VkRenderPass getRenderPass(Pass pass) const;
+	uint32_t getSubpass(Pass pass) const;
+	const Stats& getStats() const { return stats; }
+
+	// Framebuffers point to image views: call before destroying views the graph has seen.
+	// Release destroys the framebuffers now, retire hands the ones using views to the deletion queue.
+	void releaseFramebuffers();
+	void retireImageViews(const std::vector<VkImageView>& views);
+
+private:
+	static const uint32_t NO_PASS = ~0u;
+
+	struct Access
+	{
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		bool writes = false;
+	};
+
+	struct ResourceNode
+	{
+		std::string name;
+		bool isImage = false;
+		bool transient = false;
+		bool output = false;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent{};
+		VkImageUsageFlags usage = 0;
+		VkImageAspectFlags aspect = 0;
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags initialStages = 0;
+		VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		uint32_t transientIndex = 0; // In transientImages
+	};
+
+	struct ResourceUse
+	{
+		Resource resource = 0;
+		Access access;
+		bool clear = false;
+		VkClearValue clearValue{};
+		bool discard = false; // Compiled: contents undefined before the pass
+		bool usedAfter = false; // Compiled: a later pass or the frame's output needs what the pass leaves
+	};
+
+	struct PassNode
+	{
+		std::string name;
+		bool graphics = false;
+		bool subpassOfPrevious = false; // Asked for, see firstPass for what it got
+		RecordFunction record;
+		std::vector<ResourceUse> uses;
+		bool culled = false;
+
+		// Compiled
+		uint32_t firstPass = 0; // Of its render pass: begins it, and records the barriers of all its subpasses
+		uint32_t subpass = 0;
+		bool lastSubpass = true;
+		std::vector<VkSubpassDependency> dependencies; // From earlier subpasses to this one
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		VkMemoryBarrier memoryBarrier{};
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		VkExtent2D extent{};
+		std::vector<VkClearValue> clearValues;
+	};
+
+	// Where a resource stands between passes
+	struct ResourceState
+	{
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags writeStages = 0; // Last write
+		VkAccessFlags writeAccess = 0;
+		VkPipelineStageFlags readStages = 0; // Reads since the last write
+		VkPipelineStageFlags visibleStages = 0; // Already see the last write
+		VkAccessFlags visibleAccess = 0;
+		uint32_t renderPass = NO_PASS; // First pass of the render pass of its last use
+		uint32_t subpass = 0;
+		bool writtenInRenderPass = false; // By that render pass
+	};
+
+	struct SubpassAttachments
+	{
+		std::vector<VkAttachmentReference> colors; // In the order declared
+		VkAttachmentReference depth{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+	};
+
+	struct RenderPassEntry
+	{
+		// The key
+		std::vector<VkAttachmentDescription> attachments;
+		std::vector<SubpassAttachments> subpasses;
+		std::vector<VkSubpassDependency> dependencies;
+
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+	};
+
+	struct FramebufferEntry
+	{
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		std::vector<VkImageView> views;
+		VkExtent2D extent{};
+		VkFramebuffer framebuffer = VK_NULL_HANDLE;
+	};
+
+	// Image owned by the graph, lives from frame to frame while the graph keeps its shape
+	struct TransientImage
+	{
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent{};
+		VkImageUsageFlags usage = 0;
+		VkImageAspectFlags aspect = 0;
+		uint32_t firstPass = 0; // Lifetime in the frame, aliasing depends on it
+		uint32_t lastPass = 0;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkMemoryRequirements memoryRequirements{};
+		uint32_t memorySlot = 0;
+	};
+
+	// Memory shared by transient images one after the other
+	struct MemorySlot
+	{
+		MemoryAllocation allocation;
+		VkMemoryRequirements memoryRequirements{}; // What all its images need
+		std::vector<uint32_t> images; // In the order they are used in the frame
+		VkPipelineStageFlags lastStages = 0; // Last use of its last image, in the previous frame
+		VkAccessFlags lastWriteAccess = 0; // Its last write, to make available before the memory is written again
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	DeletionQueue* deletionQueue = nullptr;
+
+	std::vector<ResourceNode> resources;
+	std::vector<PassNode> passes;
+	std::vector<VkImageMemoryBarrier> finalBarriers; // To the imported images' final layouts
+	VkPipelineStageFlags finalSrcStages = 0;
+	Stats stats;
+
+	std::vector<RenderPassEntry> renderPasses;
+	std::vector<FramebufferEntry> framebuffers;
+	std::vector<TransientImage> transientImages;
+	std::vector<MemorySlot> memorySlots;
+
+	Resource addResource(ResourceNode node);
+	void use(Pass pass, Resource resource, ResourceUsage usage, bool writes, bool clear, VkClearValue clearValue);
+	void cullPasses();
+	void mergeSubpasses();
+	void createTransientImages();
+	void destroyTransientImages();
+	void retireTransientImages();
+	void computeBarriers();
+	// Into the pass's barrier, or into a subpass dependency when given one
+	void addBarrier(PassNode& pass, const ResourceNode& resource, ResourceState& state, const Access& access, VkSubpassDependency* dependency = nullptr);
+	void createRenderPasses();
+	VkRenderPass getOrCreateRenderPass(const RenderPassEntry& description);
+	VkFramebuffer getOrCreateFramebuffer(VkRenderPass renderPass, const std::vector<VkImageView>& views, VkExtent2D extent);
+};
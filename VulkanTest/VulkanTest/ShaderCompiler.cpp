@@ -0,0 +1,162 @@
+#include "ShaderCompiler.h"
+#include "FileUtilities.h"
+#include "CpuTracer.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef ENABLE_RUNTIME_SHADER_COMPILER
+#include <shaderc/shaderc.h>
+#include <glslang/build_info.h>
+#endif
+
+bool ShaderCompiler::isAvailable()
+{
+#ifdef ENABLE_RUNTIME_SHADER_COMPILER
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ShaderCompiler::init(const std::string& directory)
+{
+	cacheDirectory = directory;
+	cacheHits = 0;
+	cacheMisses = 0;
+
+	// Without cache directory we still compile, just every time
+	if (!createDirectory(cacheDirectory))
+	{
+		std::cerr << "Could not create shader cache directory " << cacheDirectory << std::endl;
+		cacheDirectory.clear();
+	}
+
+#ifdef ENABLE_RUNTIME_SHADER_COMPILER
+	compiler = shaderc_compiler_initialize();
+	if (compiler == nullptr)
+	{
+		throw std::runtime_error("Failed to initialise the shader compiler");
+	}
+#endif
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ShaderCompiler::destroy()
+{
+#ifdef ENABLE_RUNTIME_SHADER_COMPILER
+	if (compiler != nullptr) shaderc_compiler_release(static_cast<shaderc_compiler_t>(compiler));
+#endif
+	compiler = nullptr;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::vector<char> ShaderCompiler::compile(const std::string& sourcePath, const std::vector<std::string>& defines)
+{
+#ifdef ENABLE_RUNTIME_SHADER_COMPILER
+	CPU_ZONE("ShaderCompiler::compile");
+
+	// -- SOURCE -- //
+	std::ifstream sourceFile{ sourcePath, std::ios::binary };
+	if (!sourceFile.is_open())
+	{
+		throw std::runtime_error("Failed to open shader source " + sourcePath);
+	}
+	std::stringstream sourceStream;
+	sourceStream << sourceFile.rdbuf();
+	std::string source = sourceStream.str();
+
+	shaderc_shader_kind kind;
+	std::string extension = sourcePath.substr(sourcePath.find_last_of('.') + 1);
+	if (extension == "vert") kind = shaderc_vertex_shader;
+	else if (extension == "frag") kind = shaderc_fragment_shader;
+	else if (extension == "comp") kind = shaderc_compute_shader;
+	else throw std::runtime_error("Unknown shader stage for " + sourcePath);
+
+
+	// -- CACHE LOOKUP -- //
+	// Everything that changes the output is part of the key: a new SDK's glslang (the compiler
+	// behind shaderc) may generate other code from the same source
+	uint32_t compilerInfo[]{ CACHE_VERSION, GLSLANG_VERSION_MAJOR, GLSLANG_VERSION_MINOR, GLSLANG_VERSION_PATCH, static_cast<uint32_t>(kind) };
+
+	uint64_t key = hashBytes(compilerInfo, sizeof(compilerInfo));
+	key = hashBytes(source.data(), source.size(), key);
+	for (const std::string& define : defines)
+	{
+		key = hashBytes(define.c_str(), define.size() + 1, key); // With the '\0', so "A" "B" != "AB"
+	}
+
+	char keyText[17];
+	snprintf(keyText, sizeof(keyText), "%016llx", static_cast<unsigned long long>(key));
+	std::string cachePath = cacheDirectory.empty() ? "" : cacheDirectory + "/" + keyText + ".spv";
+
+	if (!cachePath.empty())
+	{
+		std::ifstream cachedFile{ cachePath, std::ios::binary | std::ios::ate };
+		if (cachedFile.is_open())
+		{
+			std::vector<char> spirv(static_cast<size_t>(cachedFile.tellg()));
+			cachedFile.seekg(0);
+			cachedFile.read(spirv.data(), spirv.size());
+
+			// SPIR-V is made of words and starts with its magic number
+			const uint32_t spirvMagic = 0x07230203;
+			if (cachedFile && spirv.size() >= 4 && spirv.size() % 4 == 0 && *reinterpret_cast<const uint32_t*>(spirv.data()) == spirvMagic)
+			{
+				++cacheHits;
+				return spirv;
+			}
+		}
+	}
+	++cacheMisses;
+
+
+	// -- COMPILATION -- //
+	shaderc_compile_options_t options = shaderc_compile_options_initialize();
+	shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_1);
+	shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
+	for (const std::string& define : defines)
+	{
+		size_t equal = define.find('=');
+		std::string name = define.substr(0, equal);
+		std::string value = equal == std::string::npos ? "" : define.substr(equal + 1);
+		shaderc_compile_options_add_macro_definition(options, name.c_str(), name.size(), value.c_str(), value.size());
+	}
+
+	shaderc_compilation_result_t result = shaderc_compile_into_spv(static_cast<shaderc_compiler_t>(compiler),
+		source.data(), source.size(), kind, sourcePath.c_str(), "main", options);
+	shaderc_compile_options_release(options);
+
+	if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success)
+	{
+		std::string error = "Failed to compile " + sourcePath + ":\n" + shaderc_result_get_error_message(result);
+		shaderc_result_release(result);
+		throw std::runtime_error(error);
+	}
+
+	std::vector<char> spirv(shaderc_result_get_bytes(result), shaderc_result_get_bytes(result) + shaderc_result_get_length(result));
+	shaderc_result_release(result);
+
+	// A failed write only costs a compilation at the next launch
+	if (!cachePath.empty()) writeFileAtomic(cachePath, spirv.data(), spirv.size());
+	return spirv;
+#else
+	(void)defines;
+	throw std::runtime_error("Runtime shader compilation is not enabled in this build, cannot compile " + sourcePath);
+#endif
+}
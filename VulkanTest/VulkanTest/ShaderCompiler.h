@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// GLSL to SPIR-V compilation inside the application, with shaderc (shipped with the Vulkan SDK).
+// Only built in when ENABLE_RUNTIME_SHADER_COMPILER is defined: the project then has to link
+// shaderc_shared.lib from $(VULKAN_SDK)\Lib. Without it, the precompiled .spv files are used.
+//
+// Compiled SPIR-V is cached on disk, keyed by a hash of the source, the defines and the
+// compiler version, so only edited shaders are compiled again at the next launch.
+// #include is not supported: the key would not see the included files change.
+class ShaderCompiler
+{
+public:
+
+	static bool isAvailable();
+
+	void init(const std::string& cacheDirectory);
+	void destroy();
+
+	// Stage comes from the extension: .vert, .frag or .comp. Defines are "NAME" or "NAME=VALUE".
+	// Throws std::runtime_error with the compiler log if the shader doesn't compile.
+	// Can be called from several threads at once (pipelines are compiled in parallel).
+	std::vector<char> compile(const std::string& sourcePath, const std::vector<std::string>& defines = {});
+
+	uint32_t getCacheHits() const { return cacheHits; }
+	uint32_t getCacheMisses() const { return cacheMisses; }
+
+private:
+
+	// Bump when the compile options change, old cache entries are then ignored
+	static const uint32_t CACHE_VERSION = 1;
+
+	void* compiler = nullptr; // shaderc_compiler_t, kept opaque so shaderc headers stay out of here
+	std::string cacheDirectory;
+	std::atomic<uint32_t> cacheHits{ 0 };
+	std::atomic<uint32_t> cacheMisses{ 0 };
+};
@@ -0,0 +1,56 @@
+#include "ShaderWatcher.h"
+#include <algorithm>
+
+constexpr std::chrono::milliseconds ShaderWatcher::POLL_INTERVAL;
+
+void ShaderWatcher::watch(const std::string& path, uint32_t pipelineId)
+{
+	auto found = std::find_if(files.begin(), files.end(), [&path](const WatchedFile& file) { return file.path == path; });
+	if (found == files.end())
+	{
+		files.push_back({ path, getFileStamp(path), {} });
+		found = files.end() - 1;
+	}
+	else
+	{
+		// Watched again after a rebuild: what was just compiled is the reference now
+		found->stamp = getFileStamp(path);
+	}
+
+	if (std::find(found->pipelineIds.begin(), found->pipelineIds.end(), pipelineId) == found->pipelineIds.end())
+	{
+		found->pipelineIds.push_back(pipelineId);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::vector<uint32_t> ShaderWatcher::poll()
+{
+	std::vector<uint32_t> changedPipelines;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now - lastPoll < POLL_INTERVAL) return changedPipelines;
+	lastPoll = now;
+
+	for (WatchedFile& file : files)
+	{
+		FileStamp stamp = getFileStamp(file.path);
+
+		// Editors often delete then rewrite the file, wait until it is back
+		if (stamp == file.stamp || stamp.size < 0) continue;
+		file.stamp = stamp;
+
+		for (uint32_t pipelineId : file.pipelineIds)
+		{
+			if (std::find(changedPipelines.begin(), changedPipelines.end(), pipelineId) == changedPipelines.end())
+			{
+				changedPipelines.push_back(pipelineId);
+			}
+		}
+	}
+	return changedPipelines;
+}
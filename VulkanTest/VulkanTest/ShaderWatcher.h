@@ -0,0 +1,35 @@
+#pragma once
+#include "FileUtilities.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Polls shader source files and tells which pipelines use a file that changed, so only
+// those pipelines are rebuilt.
+class ShaderWatcher
+{
+public:
+
+	// Same file can be used by several pipelines, watching it again just adds the pipeline
+	void watch(const std::string& path, uint32_t pipelineId);
+	void clear() { files.clear(); }
+
+	// Pipelines with at least one changed file since the last call. Files are only looked at
+	// every POLL_INTERVAL, calling it every frame is cheap.
+	std::vector<uint32_t> poll();
+
+private:
+
+	static constexpr std::chrono::milliseconds POLL_INTERVAL{ 250 };
+
+	struct WatchedFile
+	{
+		std::string path;
+		FileStamp stamp;
+		std::vector<uint32_t> pipelineIds;
+	};
+
+	std::vector<WatchedFile> files;
+	std::chrono::steady_clock::time_point lastPoll;
+};
@@ -0,0 +1,364 @@
+#include "StagingUploader.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void StagingUploader::init(VkDevice logicalDevice, MemoryAllocator& memoryAllocator, GpuTimeline& gpuTimeline,
+	VkQueue uploadQueue, uint32_t uploadFamily,
+	VkQueue drawQueue, uint32_t drawFamily, VkDeviceSize stagingPageSize)
+{
+	device = logicalDevice;
+	allocator = &memoryAllocator;
+	timeline = &gpuTimeline;
+	transferQueue = uploadQueue;
+	transferFamily = uploadFamily;
+	graphicsQueue = drawQueue;
+	graphicsFamily = drawFamily;
+	pageSize = stagingPageSize;
+
+	// The same timeline when both are the graphics queue
+	transferTimeline = timeline->addQueue(transferQueue);
+	graphicsTimeline = timeline->addQueue(graphicsQueue);
+
+	commandPool = createCommandPool(transferFamily);
+	if (transfersOwnership())
+	{
+		acquireCommandPool = createCommandPool(graphicsFamily);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void StagingUploader::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+
+	// Nothing recorded is lost: it is submitted then waited for
+	waitIdle();
+
+	for (Page& page : pages)
+	{
+		allocator->destroyBuffer(page.buffer, page.allocation);
+	}
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	if (acquireCommandPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, acquireCommandPool, nullptr);
+	}
+
+	pages.clear();
+	freePages.clear();
+	freeBatches.clear();
+	currentPage = NO_PAGE;
+	commandPool = VK_NULL_HANDLE;
+	acquireCommandPool = VK_NULL_HANDLE;
+	device = VK_NULL_HANDLE;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void StagingUploader::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+	VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, bool concurrent)
+{
+	const char* bytes = static_cast<const char*>(data);
+	VkDeviceSize uploadOffset = dstOffset;
+	VkDeviceSize uploadSize = size;
+	while (size > 0)
+	{
+		if (currentPage == NO_PAGE || pageOffset >= pageSize)
+		{
+			// May flush the batch when the staging memory is exhausted, so take the page first
+			uint32_t page = takePage();
+			if (!recording) beginBatch();
+			recordingBatch.pages.push_back(page);
+			currentPage = page;
+			pageOffset = 0;
+		}
+
+		// Write to the staging page, and have the GPU copy it where it belongs
+		VkDeviceSize chunkSize = std::min(size, pageSize - pageOffset);
+		memcpy(static_cast<char*>(pages[currentPage].allocation.mapped) + pageOffset, bytes, static_cast<size_t>(chunkSize));
+
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = pageOffset;
+		copyRegion.dstOffset = dstOffset;
+		copyRegion.size = chunkSize;
+		vkCmdCopyBuffer(recordingBatch.commandBuffer, pages[currentPage].buffer, dstBuffer, 1, &copyRegion);
+
+		// Next copy starts aligned, memcpy is faster on aligned addresses
+		pageOffset = (pageOffset + chunkSize + 15) & ~VkDeviceSize(15);
+		bytes += chunkSize;
+		dstOffset += chunkSize;
+		size -= chunkSize;
+	}
+
+	pendingDstStages |= dstStage;
+	pendingDstAccess |= dstAccess;
+
+	// The graphics family can only use the buffer once the transfer family gave it away
+	if (transfersOwnership() && !concurrent && uploadSize > 0)
+	{
+		VkBufferMemoryBarrier ownershipBarrier{};
+		ownershipBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		ownershipBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		ownershipBarrier.dstAccessMask = dstAccess;
+		ownershipBarrier.srcQueueFamilyIndex = transferFamily;
+		ownershipBarrier.dstQueueFamilyIndex = graphicsFamily;
+		ownershipBarrier.buffer = dstBuffer;
+		ownershipBarrier.offset = uploadOffset;
+		ownershipBarrier.size = uploadSize;
+		pendingOwnershipBarriers.push_back(ownershipBarrier);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint64_t StagingUploader::flush()
+{
+	if (!recording) return 0;
+
+	VkPipelineStageFlags dstStages = pendingDstStages != 0 ? pendingDstStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	if (transfersOwnership())
+	{
+		// Release: the access masks on the other family's side are ignored here
+		std::vector<VkBufferMemoryBarrier> releaseBarriers = pendingOwnershipBarriers;
+		for (VkBufferMemoryBarrier& barrier : releaseBarriers) barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(recordingBatch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(), 0, nullptr);
+	}
+	else if (!isAsync())
+	{
+		// One barrier for the whole batch: copies done before anything reads the buffers
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = pendingDstAccess;
+		vkCmdPipelineBarrier(recordingBatch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages,
+			0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+	// Second queue of the graphics family: the timeline wait alone makes the copies visible
+
+	VkResult result = vkEndCommandBuffer(recordingBatch.commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to stop recording an upload command buffer");
+	}
+
+	uint64_t copiesDone = timeline->submit(transferTimeline, &recordingBatch.commandBuffer, 1, nullptr, 0);
+	recordingBatch.doneQueue = transferTimeline;
+	recordingBatch.doneValue = copiesDone;
+
+	if (isAsync())
+	{
+		// The graphics queue waits for the copies, only in the stages reading the buffers. Frames
+		// submitted before keep running. The batch is done once this submit is: the acquire
+		// command buffer has run too.
+		GpuTimeline::Wait copies = timeline->waitFor(transferTimeline, copiesDone, dstStages);
+		uint32_t commandBufferCount = 0;
+		if (transfersOwnership())
+		{
+			recordAcquire(dstStages);
+			commandBufferCount = 1;
+		}
+		recordingBatch.doneQueue = graphicsTimeline;
+		recordingBatch.doneValue = timeline->submit(graphicsTimeline, &recordingBatch.acquireCommandBuffer, commandBufferCount, &copies, 1);
+	}
+
+	// The partly used page leaves with the batch, the next batch starts on a fresh one
+	uint64_t batchNumber = recordingBatch.number;
+	submittedBatches.push_back(std::move(recordingBatch));
+	recordingBatch = Batch{};
+	recording = false;
+	currentPage = NO_PAGE;
+	pendingDstStages = 0;
+	pendingDstAccess = 0;
+	pendingOwnershipBarriers.clear();
+	return batchNumber;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void StagingUploader::collect()
+{
+	// Batches finish in submission order, stop at the first one still running
+	while (!submittedBatches.empty() && timeline->isComplete(submittedBatches.front().doneQueue, submittedBatches.front().doneValue))
+	{
+		Batch& batch = submittedBatches.front();
+		freePages.insert(freePages.end(), batch.pages.begin(), batch.pages.end());
+		batch.pages.clear();
+		completedBatch = batch.number;
+		freeBatches.push_back(std::move(batch));
+		submittedBatches.pop_front();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void StagingUploader::waitIdle()
+{
+	flush();
+	for (const Batch& batch : submittedBatches)
+	{
+		timeline->wait(batch.doneQueue, batch.doneValue);
+	}
+	collect();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void StagingUploader::beginBatch()
+{
+	// Reuse a finished batch if there is one
+	if (!freeBatches.empty())
+	{
+		recordingBatch = std::move(freeBatches.back());
+		freeBatches.pop_back();
+		vkResetCommandBuffer(recordingBatch.commandBuffer, 0);
+		if (recordingBatch.acquireCommandBuffer != VK_NULL_HANDLE)
+		{
+			vkResetCommandBuffer(recordingBatch.acquireCommandBuffer, 0);
+		}
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &recordingBatch.commandBuffer);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate an upload command buffer");
+		}
+
+		if (transfersOwnership())
+		{
+			allocInfo.commandPool = acquireCommandPool;
+			result = vkAllocateCommandBuffers(device, &allocInfo, &recordingBatch.acquireCommandBuffer);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to allocate an upload acquire command buffer");
+			}
+		}
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VkResult result = vkBeginCommandBuffer(recordingBatch.commandBuffer, &beginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording an upload command buffer");
+	}
+
+	recordingBatch.number = nextBatchNumber++;
+	recording = true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t StagingUploader::takePage()
+{
+	collect();
+
+	// Every page is in use: wait until the GPU is done with the oldest batch
+	if (freePages.empty() && pages.size() >= MAX_PAGES)
+	{
+		// The batch being recorded may be the one holding all the pages
+		if (submittedBatches.empty()) flush();
+		timeline->wait(submittedBatches.front().doneQueue, submittedBatches.front().doneValue);
+		collect();
+	}
+
+	if (freePages.empty())
+	{
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = pageSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		Page page;
+		allocator->createBuffer(bufferInfo, MemoryUsage::Staging, page.buffer, page.allocation);
+		pages.push_back(page);
+		freePages.push_back(static_cast<uint32_t>(pages.size() - 1));
+	}
+
+	uint32_t page = freePages.back();
+	freePages.pop_back();
+	return page;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void StagingUploader::recordAcquire(VkPipelineStageFlags dstStages)
+{
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VkResult result = vkBeginCommandBuffer(recordingBatch.acquireCommandBuffer, &beginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording an upload acquire command buffer");
+	}
+
+	// Same barriers as the release, on this side only the destination masks count. It starts
+	// in the stages the timeline wait blocks, so it runs after the copies.
+	std::vector<VkBufferMemoryBarrier> acquireBarriers = pendingOwnershipBarriers;
+	for (VkBufferMemoryBarrier& barrier : acquireBarriers) barrier.srcAccessMask = 0;
+	vkCmdPipelineBarrier(recordingBatch.acquireCommandBuffer, dstStages, dstStages,
+		0, 0, nullptr, static_cast<uint32_t>(acquireBarriers.size()), acquireBarriers.data(), 0, nullptr);
+
+	result = vkEndCommandBuffer(recordingBatch.acquireCommandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to stop recording an upload acquire command buffer");
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkCommandPool StagingUploader::createCommandPool(uint32_t queueFamilyIndex)
+{
+	// Command buffers are short lived and reused one by one
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	VkCommandPool pool;
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &pool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create an upload command pool");
+	}
+	return pool;
+}
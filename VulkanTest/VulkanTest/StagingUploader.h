@@ -0,0 +1,108 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <vector>
+#include "MemoryAllocator.h"
+#include "GpuTimeline.h"
+
+// Uploads data to device local buffers through host visible staging memory.
+// Copies are batched: uploadBuffer only copies the data to a staging page and records a
+// vkCmdCopyBuffer, flush() submits every copy recorded so far in a single command buffer.
+// Nothing waits for the GPU, except when all the staging pages are in use (back-pressure).
+//
+// Copies can run on their own queue (a transfer-only family, or a second graphics queue) so
+// upload bursts don't sit in front of the frames on the graphics queue. The graphics queue
+// then waits for the batch's value on the transfer timeline, and when the families differ the
+// buffers change owner: released by the transfer queue, acquired by the graphics queue.
+// Either way, work submitted to the graphics queue after a flush sees the uploaded data.
+// Batches are tracked on the GPU timelines, they own no fence nor semaphore.
+class StagingUploader
+{
+public:
+
+	static const VkDeviceSize DEFAULT_PAGE_SIZE = 16ull * 1024 * 1024;
+	static const uint32_t MAX_PAGES = 16; // Staging memory cap: MAX_PAGES * pageSize
+
+	// Pass the graphics queue twice to upload on it directly
+	void init(VkDevice device, MemoryAllocator& allocator, GpuTimeline& timeline, VkQueue transferQueue, uint32_t transferFamily,
+		VkQueue graphicsQueue, uint32_t graphicsFamily, VkDeviceSize pageSize = DEFAULT_PAGE_SIZE);
+	void destroy();
+
+	// Uploads bigger than a page are split. dstStage and dstAccess say how the buffer is read
+	// afterwards (e.g. VERTEX_INPUT / VERTEX_ATTRIBUTE_READ), the data is made visible to them.
+	// Buffers created with VK_SHARING_MODE_CONCURRENT have no owner to change, say so with concurrent.
+	void uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, bool concurrent = false);
+
+	// Submit what was recorded since the last flush. Returns the batch number, 0 if there was nothing to submit.
+	uint64_t flush();
+
+	// Give back the staging pages of the batches the GPU has finished. Never waits.
+	void collect();
+
+	// Flush and wait for every batch
+	void waitIdle();
+
+	bool isComplete(uint64_t batchNumber) const { return batchNumber <= completedBatch; }
+
+	// Copies run on another queue than drawing
+	bool isAsync() const { return transferQueue != graphicsQueue; }
+	// Buffers go from the transfer family to the graphics family after each copy
+	bool transfersOwnership() const { return transferFamily != graphicsFamily; }
+
+private:
+
+	struct Page
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation allocation;
+	};
+
+	struct Batch
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE; // Graphics side of the ownership transfer
+		GpuTimeline::Queue doneQueue = 0; // Reusable once doneQueue reached doneValue
+		uint64_t doneValue = 0;
+		std::vector<uint32_t> pages;
+		uint64_t number = 0;
+	};
+
+	static const uint32_t NO_PAGE = ~0u;
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	GpuTimeline* timeline = nullptr;
+	GpuTimeline::Queue transferTimeline = 0;
+	GpuTimeline::Queue graphicsTimeline = 0;
+	VkQueue transferQueue = VK_NULL_HANDLE;
+	VkQueue graphicsQueue = VK_NULL_HANDLE;
+	uint32_t transferFamily = 0;
+	uint32_t graphicsFamily = 0;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkCommandPool acquireCommandPool = VK_NULL_HANDLE; // Only with an ownership transfer
+	VkDeviceSize pageSize = DEFAULT_PAGE_SIZE;
+
+	std::vector<Page> pages;
+	std::vector<uint32_t> freePages;
+
+	// Batch being recorded, then batches on the GPU (oldest first), then batches to reuse
+	bool recording = false;
+	Batch recordingBatch;
+	std::deque<Batch> submittedBatches;
+	std::vector<Batch> freeBatches;
+
+	uint32_t currentPage = NO_PAGE;
+	VkDeviceSize pageOffset = 0;
+	VkPipelineStageFlags pendingDstStages = 0;
+	VkAccessFlags pendingDstAccess = 0;
+	std::vector<VkBufferMemoryBarrier> pendingOwnershipBarriers; // Release barriers, one per upload
+
+	uint64_t nextBatchNumber = 1;
+	uint64_t completedBatch = 0;
+
+	void beginBatch();
+	void recordAcquire(VkPipelineStageFlags dstStages);
+	VkCommandPool createCommandPool(uint32_t queueFamilyIndex);
+	uint32_t takePage();
+};
@@ -0,0 +1,119 @@
+#include "ThreadPool.h"
+
+void ThreadPool::init(uint32_t threadCount)
+{
+	destroy();
+	stopping = false;
+	for (uint32_t i = 1; i < threadCount; ++i)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ThreadPool::destroy()
+{
+	if (workers.empty()) return;
+
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		tasks.push_back(std::move(task));
+		++unfinishedTasks;
+	}
+	taskAvailable.notify_one();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock{ mutex };
+	while (unfinishedTasks > 0)
+	{
+		// Help instead of sleeping while there is something to run
+		if (!tasks.empty())
+		{
+			std::function<void()> task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			runTask(task);
+			lock.lock();
+			continue;
+		}
+		allDone.wait(lock);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& function)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		submit([&function, i]() { function(i); });
+	}
+	wait();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ThreadPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock{ mutex };
+	while (true)
+	{
+		taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+		if (tasks.empty()) return; // Stopping, and nothing left to run
+
+		std::function<void()> task = std::move(tasks.front());
+		tasks.pop_front();
+		lock.unlock();
+		runTask(task);
+		lock.lock();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void ThreadPool::runTask(std::function<void()>& task)
+{
+	task();
+
+	std::lock_guard<std::mutex> lock{ mutex };
+	if (--unfinishedTasks == 0) allDone.notify_all();
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed from one queue protected by a mutex.
+// Tasks are pushed, then the caller waits for them, helping to run them meanwhile.
+// The renderer uses the JobSystem; this stays as the simple baseline it is benchmarked against.
+class ThreadPool
+{
+public:
+
+	// threadCount includes the calling thread: 1 means no worker, everything runs in wait()
+	void init(uint32_t threadCount);
+	void destroy();
+	~ThreadPool() { destroy(); }
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+	void submit(std::function<void()> task);
+
+	// Run queued tasks on this thread too, until every submitted task has finished
+	void wait();
+
+	// Call function(i) for i in [0, count), spread over the threads, and wait
+	void parallelFor(uint32_t count, const std::function<void(uint32_t)>& function);
+
+private:
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable taskAvailable;
+	std::condition_variable allDone;
+	std::deque<std::function<void()>> tasks;
+	uint32_t unfinishedTasks = 0;
+	bool stopping = false;
+
+	void workerLoop();
+	void runTask(std::function<void()>& task);
+};
@@ -0,0 +1,180 @@
+#include "UniformRing.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	// Vulkan alignments are powers of two
+	VkDeviceSize alignUp(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		return (size + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void UniformRing::init(VkDevice logicalDevice, MemoryAllocator& allocator, const VkPhysicalDeviceLimits& limits, uint32_t framesInFlight,
+	VkDeviceSize regionSize, uint32_t blockSize)
+{
+	device = logicalDevice;
+
+	// Allocations on whole atoms too: a flushed range never takes in bytes of another frame,
+	// whatever the memory type turns out to be
+	alignment = std::max({ limits.minUniformBufferOffsetAlignment, limits.nonCoherentAtomSize, static_cast<VkDeviceSize>(1) });
+	maxBlockSize = std::min(blockSize, limits.maxUniformBufferRange);
+	frameSize = alignUp(regionSize, alignment);
+	frameStart = 0;
+	frameUsed = 0;
+	flushedUpTo = 0;
+	stats = Stats{};
+
+	// The descriptor sees maxBlockSize bytes past any offset: room for it after the last region
+	VkBufferCreateInfo bufferCreateInfo{};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = frameSize * framesInFlight + alignUp(maxBlockSize, alignment);
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	allocator.createBuffer(bufferCreateInfo, MemoryUsage::CpuToGpu, buffer, allocation);
+	mapped = static_cast<char*>(allocation.mapped);
+	coherent = allocator.isHostCoherent(allocation);
+
+	VkDescriptorSetLayoutBinding binding{};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	binding.descriptorCount = 1;
+	binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = 1;
+	layoutCreateInfo.pBindings = &binding;
+	if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &setLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the uniform ring descriptor set layout");
+	}
+
+	VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 };
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = 1;
+	poolCreateInfo.poolSizeCount = 1;
+	poolCreateInfo.pPoolSizes = &poolSize;
+	if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the uniform ring descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = descriptorPool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &setLayout;
+	if (vkAllocateDescriptorSets(device, &allocateInfo, &set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate the uniform ring descriptor set");
+	}
+
+	// Written once: the buffer never changes, only the offsets it is bound with
+	VkDescriptorBufferInfo bufferInfo{ buffer, 0, maxBlockSize };
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = set;
+	write.dstBinding = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	write.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void UniformRing::destroy(MemoryAllocator& allocator)
+{
+	if (device == VK_NULL_HANDLE) return;
+
+	// The set goes with its pool
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+	if (buffer != VK_NULL_HANDLE) allocator.destroyBuffer(buffer, allocation);
+	descriptorPool = VK_NULL_HANDLE;
+	setLayout = VK_NULL_HANDLE;
+	set = VK_NULL_HANDLE;
+	buffer = VK_NULL_HANDLE;
+	mapped = nullptr;
+	device = VK_NULL_HANDLE;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void UniformRing::beginFrame(uint32_t frameSlot)
+{
+	frameStart = frameSlot * frameSize;
+	frameUsed = 0;
+	flushedUpTo = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+UniformRing::Allocation UniformRing::allocate(uint32_t size)
+{
+	if (size > maxBlockSize)
+	{
+		throw std::runtime_error("Uniform block bigger than the uniform ring's block size");
+	}
+
+	VkDeviceSize alignedSize = alignUp(size, alignment);
+	VkDeviceSize offset = frameUsed.fetch_add(alignedSize);
+	if (offset + alignedSize > frameSize)
+	{
+		throw std::runtime_error("The uniform ring is full for this frame");
+	}
+
+	Allocation ringAllocation;
+	ringAllocation.data = mapped + frameStart + offset;
+	ringAllocation.offset = static_cast<uint32_t>(frameStart + offset);
+	return ringAllocation;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void UniformRing::flush()
+{
+	// An allocation that didn't fit still moved the pointer
+	VkDeviceSize used = std::min(frameUsed.load(), frameSize);
+	stats.frameBytes = used;
+	stats.peakFrameBytes = std::max(stats.peakFrameBytes, used);
+	if (coherent || used <= flushedUpTo)
+	{
+		flushedUpTo = used;
+		return;
+	}
+
+	// What was written since the last flush of this frame, in one range. Every allocation
+	// starts and ends on an atom, and the allocation's offset in its memory is a multiple of them.
+	VkMappedMemoryRange range{};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = allocation.memory;
+	range.offset = allocation.offset + frameStart + flushedUpTo;
+	range.size = used - flushedUpTo;
+	if (vkFlushMappedMemoryRanges(device, 1, &range) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to flush the uniform ring");
+	}
+	flushedUpTo = used;
+	++stats.flushes;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "MemoryAllocator.h"
+
+// Uniform data written every frame (per frame and per draw constants), in one host visible
+// buffer mapped once for good. Each frame in flight owns a region of it: beginFrame starts
+// over at the beginning of the slot's region (its last frame is done with it), allocations
+// take the next aligned bytes. No vkMapMemory, no staging copy, no descriptor write: the one
+// descriptor set points to the whole buffer with a dynamic offset (UNIFORM_BUFFER_DYNAMIC),
+// each allocation is bound with the offset it returns.
+//
+// Allocations are aligned to minUniformBufferOffsetAlignment and can be made from several
+// threads at once (an atomic bump). On non coherent memory, flush makes the frame's writes
+// visible with a single vkFlushMappedMemoryRanges before the submit.
+class UniformRing
+{
+public:
+
+	static const VkDeviceSize DEFAULT_FRAME_SIZE = 256 * 1024;
+	static const uint32_t DEFAULT_MAX_BLOCK_SIZE = 1024; // What a shader sees past a dynamic offset
+
+	struct Allocation
+	{
+		void* data = nullptr; // Write here
+		uint32_t offset = 0; // Dynamic offset to bind the set with
+	};
+
+	struct Stats
+	{
+		VkDeviceSize frameBytes = 0; // Used by the last frame, alignment included
+		VkDeviceSize peakFrameBytes = 0;
+		uint64_t flushes = 0; // vkFlushMappedMemoryRanges calls, none on coherent memory
+	};
+
+	void init(VkDevice device, MemoryAllocator& allocator, const VkPhysicalDeviceLimits& limits, uint32_t framesInFlight,
+		VkDeviceSize frameSize = DEFAULT_FRAME_SIZE, uint32_t maxBlockSize = DEFAULT_MAX_BLOCK_SIZE);
+	void destroy(MemoryAllocator& allocator);
+
+	// The frame slot's last frame has to be done: its allocations get written over
+	void beginFrame(uint32_t frameSlot);
+
+	// Throws when the frame's region is full, or size is over the block size
+	Allocation allocate(uint32_t size);
+
+	// Copies data, returns its dynamic offset
+	template<typename T>
+	uint32_t push(const T& data)
+	{
+		Allocation allocation = allocate(sizeof(T));
+		memcpy(allocation.data, &data, sizeof(T));
+		return allocation.offset;
+	}
+
+	// Once the frame is written, before it is submitted
+	void flush();
+
+	VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+	VkDescriptorSet getSet() const { return set; }
+	bool isCoherent() const { return coherent; }
+	const Stats& getStats() const { return stats; }
+
+private:
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	MemoryAllocation allocation;
+	char* mapped = nullptr;
+	bool coherent = true;
+	VkDeviceSize alignment = 1; // Of every allocation, and of flushed ranges
+	VkDeviceSize frameSize = 0; // Region of each frame in flight
+	uint32_t maxBlockSize = 0;
+
+	VkDeviceSize frameStart = 0; // Region of the current frame
+	std::atomic<VkDeviceSize> frameUsed{ 0 };
+	VkDeviceSize flushedUpTo = 0; // In the current frame's region
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	Stats stats;
+};
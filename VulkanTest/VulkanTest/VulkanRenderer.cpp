@@ -1,5 +1,6 @@
 #include "VulkanRenderer.h"
-#include <set>
+#include <map>
+#include <algorithm>
 #include <array>
 
 const std::vector<const char*> VulkanRenderer::validationLayers{ "VK_LAYER_KHRONOS_validation" };
@@ -27,20 +28,68 @@ VulkanRenderer::~VulkanRenderer()
 int VulkanRenderer::init(GLFWwindow* windowP)
 {
 	window = windowP;
+	headless = false;
+
+	// Resizes are caught here, the swapchain is made again on the next draw
+	glfwSetWindowUserPointer(window, this);
+	glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+	return initVulkan();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+int VulkanRenderer::initHeadless(uint32_t width, uint32_t height)
+{
+	window = nullptr;
+	headless = true;
+	headlessExtent = { width, height };
+	return initVulkan();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+int VulkanRenderer::initVulkan()
+{
+	CPU_ZONE("VulkanRenderer::init");
 	try
 	{
+		createJobSystem();
+		chooseFramesInFlight();
+		loadAssetArchive();
 		createInstance();
 		setupDebugMessenger();
-		createSurface();
+
+		// No window means no surface and no swapchain: we render into our own images
+		if (!headless) createSurface();
 		getPhysicalDevice();
 		createLogicalDevice();
-		createSwapchain();
+		createSynchronisation();
+		chooseDepthFormat();
+		createMemoryAllocator();
+		createDescriptors();
+		createPipelineCache();
+		createShaderCompiler();
+		if (headless) createOffscreenTargets();
+		else createSwapchain();
 		createRenderPass();
-		createGraphicsPipeline();
-		createFramebuffers();
+		createPipelines();
 		createGraphicsCommandPool();
-		recordCommands();
-		createSynchronisation();
+		createGraphicsCommandBuffers();
+		createSecondaryCommandBuffers();
+		createUploader();
+		createMeshes();
+		createParticles();
+		createCullFrames();
+		createComputeCommandBuffers();
+		createGpuProfiler();
+		recordComputeCommands();
+		createFramePacer();
 	}
 	catch (const std::runtime_error& e)
 	{
@@ -101,31 +150,100 @@ bool VulkanRenderer::checkInstanceExtensionSupport(const std::vector<const char*
 
 void VulkanRenderer::clean()
 {
+	// Nothing to clean: never initialised, or already cleaned (e.g. by the destructor after
+	// an explicit clean). Renderers can be created one after another, like in the benchmark.
+	assetArchive.close();
+	if (instance == VK_NULL_HANDLE) return;
 
-
-	vkDeviceWaitIdle(mainDevice.logicalDevice);
-	for (size_t i = 0; i < MAX_FRAME_DRAWS; ++i)
+	// Init may have failed before the device was created
+	if (mainDevice.logicalDevice == VK_NULL_HANDLE)
 	{
-		vkDestroySemaphore(mainDevice.logicalDevice, rendersFinished[i], nullptr);
-		vkDestroySemaphore(mainDevice.logicalDevice, imagesAvailable[i], nullptr);
-		vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
+		if (enableValidationLayers) destroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+		vkDestroyInstance(instance, nullptr);
+		instance = VK_NULL_HANDLE;
+		return;
 	}
 
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+	// The instance buffers go below: their bindless indices are retired with the rest
+	for (uint32_t index : instanceBufferBindlessIndices) bindless.removeBuffer(index);
+	instanceBufferBindlessIndices.clear();
+
+	// Idle: whatever is still retired can go, old swapchains whose presents were never seen too
+	releaseRetiredSwapchains(true);
+	deletionQueue.flush();
+
 
-	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
+	gpuProfiler.destroy();
+	for (Mesh& mesh : meshes)
+	{
+		mesh.destroy(memoryAllocator);
+	}
+	for (InstanceBuffer& instanceBuffer : instanceBuffers)
+	{
+		instanceBuffer.destroy(memoryAllocator);
+	}
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		if (particleBuffers[i] != VK_NULL_HANDLE) memoryAllocator.destroyBuffer(particleBuffers[i], particleAllocations[i]);
+		particleBuffers[i] = VK_NULL_HANDLE;
+	}
+	for (CullFrame& cullFrame : cullFrames)
+	{
+		if (cullFrame.visibleInstances != VK_NULL_HANDLE) memoryAllocator.destroyBuffer(cullFrame.visibleInstances, cullFrame.visibleInstancesAllocation);
+		if (cullFrame.drawCommands != VK_NULL_HANDLE) memoryAllocator.destroyBuffer(cullFrame.drawCommands, cullFrame.drawCommandsAllocation);
+		if (cullFrame.drawCount != VK_NULL_HANDLE) memoryAllocator.destroyBuffer(cullFrame.drawCount, cullFrame.drawCountAllocation);
+	}
+	cullFrames.clear();
+	uploader.destroy();
 
-	for (auto framebuffer : swapchainFramebuffers)
+	// After the uploader: it waits on the timelines. Every pooled semaphore goes with them.
+	gpuTimeline.destroy();
+	vkDestroyCommandPool(mainDevice.logicalDevice, computeCommandPool, nullptr);
+	for (VkCommandPool commandPool : graphicsCommandPools)
 	{
-		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+		vkDestroyCommandPool(mainDevice.logicalDevice, commandPool, nullptr);
+	}
+	for (const std::vector<VkCommandPool>& framePools : secondaryCommandPools)
+	{
+		for (VkCommandPool commandPool : framePools)
+		{
+			vkDestroyCommandPool(mainDevice.logicalDevice, commandPool, nullptr);
+		}
 	}
+	jobSystem.destroy();
+
+	// Its render passes, framebuffers and transient images
+	frameGraph.destroy();
 
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
 	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
-	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, depthPrepassPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, afterPrepassPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, computePipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, computePipelineLayout, nullptr);
+	vkDestroyDescriptorPool(mainDevice.logicalDevice, computeDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, computeDescriptorSetLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, cullPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, cullPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, cullDescriptorSetLayout, nullptr);
+
+	// Every frame's pools and the bindless set. Indices retired since went with the deletion queue.
+	frameDescriptors.destroy();
+	bindless.destroy();
+	uniformRing.destroy(memoryAllocator);
 
 	for (auto image : swapchainImages)
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
+
+		// Swapchain images belong to the swapchain, offscreen ones belong to us
+		if (headless)
+		{
+			memoryAllocator.destroyImage(image.image, image.allocation);
+		}
 	}
 
 	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
@@ -135,8 +253,120 @@ void VulkanRenderer::clean()
 		destroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 	}
 
+	// Keep what the driver compiled for the next launch
+	pipelineCache.save();
+	pipelineCache.destroy();
+	shaderCompiler.destroy();
+	shaderWatcher.clear();
+	memoryAllocator.destroy();
+
 	vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 	vkDestroyInstance(instance, nullptr);					// Second argument is a custom de-allocator
+
+	// Forget everything so a second clean (or a new init) starts from scratch
+	mainDevice.logicalDevice = VK_NULL_HANDLE;
+	mainDevice.physicalDevice = VK_NULL_HANDLE;
+	instance = VK_NULL_HANDLE;
+	surface = VK_NULL_HANDLE;
+	swapchain = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	graphicsPipeline = VK_NULL_HANDLE;
+	depthPrepassPipeline = VK_NULL_HANDLE;
+	afterPrepassPipeline = VK_NULL_HANDLE;
+	depthPrepassRenderPass = VK_NULL_HANDLE;
+	depthFormat = VK_FORMAT_UNDEFINED;
+	depthAspect = 0;
+	computeQueue = VK_NULL_HANDLE;
+	computeCommandPool = VK_NULL_HANDLE;
+	computePipeline = VK_NULL_HANDLE;
+	computePipelineLayout = VK_NULL_HANDLE;
+	computeDescriptorPool = VK_NULL_HANDLE;
+	computeDescriptorSetLayout = VK_NULL_HANDLE;
+	cullPipeline = VK_NULL_HANDLE;
+	cullPipelineLayout = VK_NULL_HANDLE;
+	cullDescriptorSetLayout = VK_NULL_HANDLE;
+	descriptorIndexingSupported = false;
+	cmdDrawIndexedIndirectCount = nullptr;
+	waitForPresent = nullptr;
+	gpuDrivenSupported = false;
+	multiDrawIndirectSupported = false;
+	renderPass = VK_NULL_HANDLE;
+	debugMessenger = VK_NULL_HANDLE;
+	swapchainImages.clear();
+	commandBuffers.clear();
+	graphicsCommandPools.clear();
+	secondaryCommandPools.clear();
+	secondaryCommandBuffers.clear();
+	computeCommandBuffers.clear();
+	frameValues.clear();
+	simulationValues.clear();
+	presentSemaphores.clear();
+	synchronization2Supported = false;
+	meshes.clear();
+	instanceBuffers.clear();
+	instanceBufferBindlessIndices.clear();
+	currentFrame = 0;
+	frameNumber = 0;
+	frameBeginNs.clear();
+	resetLatencyStats();
+	deletionQueue.setSubmittedFrames(0);
+	swapchainOutOfDate = false;
+	computeFrame = 0;
+	lastSimulationValue = 0;
+	lastParticleFrameValue = 0;
+	offscreenImageIndex = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::setDrawSettings(const DrawSettings& settings)
+{
+	// Frames are recorded in draw(), nothing to wait for
+	drawSettings = settings;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::setParticleSimulation(uint32_t count, uint32_t stepsPerFrame)
+{
+	particleCount = count;
+	particleSteps = std::max(stepsPerFrame, 1u);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::waitIdle()
+{
+	if (mainDevice.logicalDevice != VK_NULL_HANDLE)
+	{
+		// Pending uploads are part of the work to finish
+		uploader.flush();
+		vkDeviceWaitIdle(mainDevice.logicalDevice);
+		uploader.collect();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::string VulkanRenderer::getDeviceName()
+{
+	if (mainDevice.physicalDevice == VK_NULL_HANDLE) return "";
+
+	VkPhysicalDeviceProperties deviceProperties{};
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+	return deviceProperties.deviceName;
 }
 
 
@@ -146,6 +376,7 @@ void VulkanRenderer::clean()
 
 void VulkanRenderer::createSurface()
 {
+	CPU_ZONE("createSurface");
 	// Create a surface relatively to our window
 	VkResult result = glfwCreateWindowSurface(instance, window, nullptr, &surface);
 	if (result != VK_SUCCESS)
@@ -159,13 +390,40 @@ void VulkanRenderer::createSurface()
 /*------------------------------------------------------------------------------------------------------------------------*/
 
 
+void VulkanRenderer::createPipelines()
+{
+	CPU_ZONE("createPipelines");
+
+	// The driver compiles each pipeline on the calling thread: compile them side by side.
+	// They share nothing but the pipeline cache, which is thread safe.
+	JobCounter pipelinesCreated;
+	jobSystem.run([this]() { createGraphicsPipeline(); }, &pipelinesCreated);
+	jobSystem.run([this]() { createComputePipeline(); }, &pipelinesCreated);
+	jobSystem.run([this]() { createCullPipeline(); }, &pipelinesCreated);
+	jobSystem.wait(pipelinesCreated);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
 void VulkanRenderer::createGraphicsPipeline()
 {
+	CPU_ZONE("createGraphicsPipeline");
 	// Read shader code and format it through a shader module
-	auto vertexShaderCode = readShaderFile("rsc\\Shader\\vert.spv");
-	auto fragmentShaderCode = readShaderFile("rsc\\Shader\\frag.spv");
-	VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
-	VkShaderModule fragmentShaderModule = createShaderModule(fragmentShaderCode);
+	VkShaderModule vertexShaderModule = loadShaderModule("Shader/shader.vert", "Shader/vert.spv", GRAPHICS_PIPELINE_ID);
+	VkShaderModule fragmentShaderModule;
+	try
+	{
+		fragmentShaderModule = loadShaderModule("Shader/shader.frag", "Shader/frag.spv", GRAPHICS_PIPELINE_ID);
+	}
+	catch (const std::runtime_error&)
+	{
+		// Can happen on a hot reload with a broken shader, don't leak the other one
+		vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+		throw;
+	}
 	
 	
 	
@@ -197,17 +455,54 @@ void VulkanRenderer::createGraphicsPipeline()
 	
 	// -- VERTEX INPUT STAGE --
 	
-	// TODO: Put in vertex description when resources created
+	// How the data for a single vertex is laid out (position, color...) as a whole
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions{};
+	bindingDescriptions[0].binding = 0; // Can bind multiple streams of data, this defines which one
+	bindingDescriptions[0].stride = sizeof(Vertex); // Size of a single vertex object
+	bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // Move to the next data entry after each vertex
+
+	// Second stream: the instance buffer, one entry per instance instead of per vertex
+	bindingDescriptions[1].binding = 1;
+	bindingDescriptions[1].stride = sizeof(InstanceData);
+	bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	// How the data for an attribute is defined within a vertex
+	std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
+
+	// Position attribute
+	attributeDescriptions[0].binding = 0; // Which binding the data is at (same as above)
+	attributeDescriptions[0].location = 0; // Location in shader where data will be read from
+	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT; // Format the data will take (also helps define size of data)
+	attributeDescriptions[0].offset = offsetof(Vertex, position); // Where this attribute is defined in the data for a single vertex
+
+	// Color attribute
+	attributeDescriptions[1].binding = 0;
+	attributeDescriptions[1].location = 1;
+	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+	attributeDescriptions[1].offset = offsetof(Vertex, color);
+
+	// Instance transform: offset and scale in one vec4
+	attributeDescriptions[2].binding = 1;
+	attributeDescriptions[2].location = 2;
+	attributeDescriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	attributeDescriptions[2].offset = offsetof(InstanceData, offset);
+
+	// Instance color
+	attributeDescriptions[3].binding = 1;
+	attributeDescriptions[3].location = 3;
+	attributeDescriptions[3].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	attributeDescriptions[3].offset = offsetof(InstanceData, color);
+
 	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
 	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
 
 	// List of vertex binding desc. (data spacing, stride...)
-	vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
-	vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
+	vertexInputCreateInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
 
 	// List of vertex attribute desc. (data format and where to bind to/from)
-	vertexInputCreateInfo.pVertexAttributeDescriptions = nullptr;
+	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
 
 
@@ -225,27 +520,12 @@ void VulkanRenderer::createGraphicsPipeline()
 
 	// -- VIEWPORT AND SCISSOR --
 
-	// Create a viewport info struct
-	VkViewport viewport{};
-	viewport.x = 0.0f; // X start coordinate
-	viewport.y = 0.0f; // Y start coordinate
-
-	viewport.width = (float)swapchainExtent.width; // Width of viewport
-	viewport.height = (float)swapchainExtent.height; // Height of viewport
-
-	viewport.minDepth = 0.0f; // Min framebuffer depth
-	viewport.maxDepth = 1.0f; // Max framebuffer depth
-
-	// Create a scissor info struct, everything outside is cut
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapchainExtent;
+	// Set when recording (see setViewportAndScissor): the swapchain can change size, the
+	// pipelines stay
 	VkPipelineViewportStateCreateInfo viewportStateCreateInfo{};
 	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportStateCreateInfo.viewportCount = 1;
-	viewportStateCreateInfo.pViewports = &viewport;
 	viewportStateCreateInfo.scissorCount = 1;
-	viewportStateCreateInfo.pScissors = &scissor;
 
 	
 
@@ -253,21 +533,15 @@ void VulkanRenderer::createGraphicsPipeline()
 	// 
 	// This will be alterable, so you don't have to create an entire pipeline
 	// when you want to change parameters.
-	// We won't use this feature, this is an example.
-
-	/*
-	vector<VkDynamicState> dynamicStateEnables;
 	// Viewport can be resized in the command buffer with
 	// vkCmdSetViewport(commandBuffer, 0, 1, &newViewport);
-	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);
 	// Scissors can be resized in the command buffer with
 	// vkCmdSetScissor(commandBuffer, 0, 1, &newScissor);
-	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);
+	VkDynamicState dynamicStates[]{ VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
 	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
 	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
-	dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
-	*/
+	dynamicStateCreateInfo.dynamicStateCount = 2;
+	dynamicStateCreateInfo.pDynamicStates = dynamicStates;
 
 
 
@@ -347,13 +621,20 @@ void VulkanRenderer::createGraphicsPipeline()
 
 	// -- PIPELINE LAYOUT --
 
-	// TODO: apply future descriptorset layout
+	// Set 0 is the bindless set (empty without descriptor indexing), set 1 the uniform ring with
+	// the frame's constants. Both are bound once per command buffer, draws push their constants.
+	VkDescriptorSetLayout setLayouts[]{ bindless.getLayout(), uniformRing.getSetLayout() };
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DrawConstants);
+
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutCreateInfo.setLayoutCount = 0;
-	pipelineLayoutCreateInfo.pSetLayouts = nullptr;
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+	pipelineLayoutCreateInfo.setLayoutCount = 2;
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 	
 	// Create pipeline layout
 	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
@@ -366,7 +647,15 @@ void VulkanRenderer::createGraphicsPipeline()
 
 	// -- DEPTH STENCIL TESTING --
 
-	// TODO: Set up depth stencil testing
+	// Nearer fragments win. Or equal: copies at the same depth still draw in order (blended
+	// layers), and after a depth prepass the nearest fragment finds its own depth there.
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
+	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilCreateInfo.depthTestEnable = VK_TRUE;
+	depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
+	depthStencilCreateInfo.depthCompareOp = reversedZ ? VK_COMPARE_OP_GREATER_OR_EQUAL : VK_COMPARE_OP_LESS_OR_EQUAL;
+	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
 
 
 
@@ -385,11 +674,11 @@ void VulkanRenderer::createGraphicsPipeline()
 	graphicsPipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
 	graphicsPipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
 	graphicsPipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-	graphicsPipelineCreateInfo.pDynamicState = nullptr;
+	graphicsPipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
 	graphicsPipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
 	graphicsPipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
 	graphicsPipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
-	graphicsPipelineCreateInfo.pDepthStencilState = nullptr;
+	graphicsPipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
 	graphicsPipelineCreateInfo.layout = pipelineLayout;
 
 	// Renderpass description the pipeline is compatible with. This pipeline will be used
@@ -404,14 +693,38 @@ void VulkanRenderer::createGraphicsPipeline()
 
 	// Index of pipeline being created to derive from (in case of creating multiple at once)
 	graphicsPipelineCreateInfo.basePipelineIndex = -1;
-	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice,
-		VK_NULL_HANDLE, 1, &graphicsPipelineCreateInfo, nullptr, &graphicsPipeline);
 
-	// The handle is a cache when you want to save your pipeline to create an other later
+	// Depth prepass: same vertex stage, no fragment shader and no color attachment, for the
+	// first subpass of the prepass render pass
+	VkPipelineColorBlendStateCreateInfo noColorBlendingCreateInfo{};
+	noColorBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	VkGraphicsPipelineCreateInfo depthPrepassPipelineCreateInfo = graphicsPipelineCreateInfo;
+	depthPrepassPipelineCreateInfo.stageCount = 1;
+	depthPrepassPipelineCreateInfo.pColorBlendState = &noColorBlendingCreateInfo;
+	depthPrepassPipelineCreateInfo.renderPass = depthPrepassRenderPass;
+
+	// The main pass after the prepass: the same pipeline, for the second subpass
+	VkGraphicsPipelineCreateInfo afterPrepassPipelineCreateInfo = graphicsPipelineCreateInfo;
+	afterPrepassPipelineCreateInfo.renderPass = depthPrepassRenderPass;
+	afterPrepassPipelineCreateInfo.subpass = 1;
+
+	// The cache handle lets the driver skip the compilation if it already did it, in this
+	// launch or in a previous one (the cache is saved on disk)
+	VkGraphicsPipelineCreateInfo pipelineCreateInfos[]{ graphicsPipelineCreateInfo, depthPrepassPipelineCreateInfo, afterPrepassPipelineCreateInfo };
+	VkPipeline pipelines[3]{};
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice,
+		pipelineCache.getHandle(), 3, pipelineCreateInfos, nullptr, pipelines);
 	if (result != VK_SUCCESS)
 	{
+		// One of them may have been made
+		for (VkPipeline pipeline : pipelines) vkDestroyPipeline(mainDevice.logicalDevice, pipeline, nullptr);
+		vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+		vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
 		throw std::runtime_error("Cound not create a graphics pipeline");
 	}
+	graphicsPipeline = pipelines[0];
+	depthPrepassPipeline = pipelines[1];
+	afterPrepassPipeline = pipelines[2];
 
 
 	// Destroy shader modules
@@ -427,10 +740,21 @@ void VulkanRenderer::createGraphicsPipeline()
 
 VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 {
+	return createShaderModule(code.data(), code.size());
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+VkShaderModule VulkanRenderer::createShaderModule(const char* code, size_t codeSize)
+{
+	// pCode is read as uint32_t: archive entries are aligned for it
 	VkShaderModuleCreateInfo shaderModuleCreateInfo{};
 	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	shaderModuleCreateInfo.codeSize = code.size();
-	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	shaderModuleCreateInfo.codeSize = codeSize;
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code);
 	
 	// Conversion between pointer types with reinterpret_cast
 	VkShaderModule shaderModule;
@@ -447,39 +771,68 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 /*------------------------------------------------------------------------------------------------------------------------*/
 
 
-void VulkanRenderer::createFramebuffers()
+VkShaderModule VulkanRenderer::loadShaderModule(const std::string& sourceName, const std::string& spirvName, PipelineId pipeline)
 {
-	// Create one framebuffer for each swapchain image
-	swapchainFramebuffers.resize(swapchainImages.size());
+	// Development path: compile the GLSL source (or take it from the shader cache)
+	std::string sourcePath = "rsc/" + sourceName;
+	if (ShaderCompiler::isAvailable() && getFileStamp(sourcePath).size >= 0)
+	{
+		if (shaderHotReload)
+		{
+			std::lock_guard<std::mutex> lock{ shaderWatcherMutex };
+			shaderWatcher.watch(sourcePath, pipeline);
+		}
+		return createShaderModule(shaderCompiler.compile(sourcePath));
+	}
 
-	for (size_t i = 0; i < swapchainFramebuffers.size(); ++i)
+	// Straight from the mapped archive, no copy
+	AssetArchive::Asset asset;
+	if (assetArchive.find(spirvName, asset))
 	{
-		// Setup attachments
-		std::array<VkImageView, 1> attachments{ swapchainImages[i].imageView };
+		return createShaderModule(asset.data, asset.size);
+	}
+
+	// Loose file, one open and read per shader
+	return createShaderModule(readShaderFile("rsc/" + spirvName));
+}
+
 
-		// Create info
-		VkFramebufferCreateInfo framebufferCreateInfo{};
-		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-		// Render pass layout the framebuffer will be used with
-		framebufferCreateInfo.renderPass = renderPass;
-		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
 
-		// List of attachments (1:1 with render pass, thanks to variable i)
-		framebufferCreateInfo.pAttachments = attachments.data();
-		framebufferCreateInfo.width = swapchainExtent.width;
-		framebufferCreateInfo.height = swapchainExtent.height;
+void VulkanRenderer::reloadChangedShaders()
+{
+	std::vector<uint32_t> changedPipelines = shaderWatcher.poll();
+	if (changedPipelines.empty()) return;
 
-		// Framebuffer layers
-		framebufferCreateInfo.layers = 1;
-		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &swapchainFramebuffers[i]);
-		
-		if (result != VK_SUCCESS)
+	CPU_ZONE("reloadChangedShaders");
+
+	// The pipelines may be used by frames in flight
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+	for (uint32_t pipelineId : changedPipelines)
+	{
+		switch (pipelineId)
 		{
-			throw std::runtime_error("Failed to create a framebuffer");
+		case GRAPHICS_PIPELINE_ID:
+			rebuildGraphicsPipeline();
+			break;
+		case COMPUTE_PIPELINE_ID:
+			rebuildComputePipeline();
+			break;
+		case CULL_PIPELINE_ID:
+			rebuildCullPipeline();
+			break;
 		}
 	}
 
+	// Compute command buffers are recorded once and bind the old pipeline handle. The graphics
+	// ones are recorded every frame, they pick up the new pipeline on their own.
+	if (computeCommandPool != VK_NULL_HANDLE)
+	{
+		vkResetCommandPool(mainDevice.logicalDevice, computeCommandPool, 0);
+		recordComputeCommands();
+	}
 }
 
 
@@ -487,20 +840,55 @@ void VulkanRenderer::createFramebuffers()
 /*------------------------------------------------------------------------------------------------------------------------*/
 
 
-void VulkanRenderer::createGraphicsCommandPool()
+void VulkanRenderer::rebuildGraphicsPipeline()
 {
-	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
-	VkCommandPoolCreateInfo poolInfo{};
-	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	VkPipeline oldPipeline = graphicsPipeline;
+	VkPipeline oldDepthPrepassPipeline = depthPrepassPipeline;
+	VkPipeline oldAfterPrepassPipeline = afterPrepassPipeline;
+	VkPipelineLayout oldPipelineLayout = pipelineLayout;
+	try
+	{
+		createGraphicsPipeline();
+	}
+	catch (const std::runtime_error& e)
+	{
+		// Keep drawing with the old pipelines until the shader is fixed
+		std::cerr << "Shader reload failed: " << e.what() << std::endl;
+		if (pipelineLayout != oldPipelineLayout) vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
+		graphicsPipeline = oldPipeline;
+		depthPrepassPipeline = oldDepthPrepassPipeline;
+		afterPrepassPipeline = oldAfterPrepassPipeline;
+		pipelineLayout = oldPipelineLayout;
+		return;
+	}
 
-	// Queue family type that buffers from this command pool will use
-	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &graphicsCommandPool);
+	vkDestroyPipeline(mainDevice.logicalDevice, oldPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, oldDepthPrepassPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, oldAfterPrepassPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, oldPipelineLayout, nullptr);
+}
 
-	if (result != VK_SUCCESS)
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::rebuildComputePipeline()
+{
+	// Same layout, only the shader changes
+	VkPipeline oldPipeline = computePipeline;
+	try
+	{
+		createComputePipeline();
+	}
+	catch (const std::runtime_error& e)
 	{
-		throw std::runtime_error("Failed to create graphics command pool");
+		std::cerr << "Shader reload failed: " << e.what() << std::endl;
+		computePipeline = oldPipeline;
+		return;
 	}
+
+	vkDestroyPipeline(mainDevice.logicalDevice, oldPipeline, nullptr);
 }
 
 
@@ -508,26 +896,30 @@ void VulkanRenderer::createGraphicsCommandPool()
 /*------------------------------------------------------------------------------------------------------------------------*/
 
 
-void VulkanRenderer::createGraphicsCommandBuffers()
+void VulkanRenderer::rebuildCullPipeline()
 {
-	// Create one command buffer for each framebuffer
-	commandBuffers.resize(swapchainFramebuffers.size());
-
-	// We are using a pool
-	VkCommandBufferAllocateInfo commandBufferAllocInfo{};
-	commandBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferAllocInfo.commandPool = graphicsCommandPool;
-	commandBufferAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
-	commandBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	// Not in use: made with the new shader when a GPU driven frame needs it
+	if (!isGpuDriven())
+	{
+		vkDestroyPipeline(mainDevice.logicalDevice, cullPipeline, nullptr);
+		cullPipeline = VK_NULL_HANDLE;
+		return;
+	}
 
-	// Primary means the command buffer will submit directly to a queue.
-	// Secondary cannot be called by a queue, but by an other primary command buffer,
-	// via vkCmdExecuteCommands.
-	VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &commandBufferAllocInfo, commandBuffers.data());
-	if (result != VK_SUCCESS)
+	// Same layout, only the shader changes
+	VkPipeline oldPipeline = cullPipeline;
+	try
+	{
+		createCullPipeline();
+	}
+	catch (const std::runtime_error& e)
 	{
-		throw std::runtime_error("Failed to allocate graphics command buffers");
+		std::cerr << "Shader reload failed: " << e.what() << std::endl;
+		cullPipeline = oldPipeline;
+		return;
 	}
+
+	vkDestroyPipeline(mainDevice.logicalDevice, oldPipeline, nullptr);
 }
 
 
@@ -535,67 +927,111 @@ void VulkanRenderer::createGraphicsCommandBuffers()
 /*------------------------------------------------------------------------------------------------------------------------*/
 
 
-void VulkanRenderer::recordCommands()
+void VulkanRenderer::createGraphicsCommandPool()
 {
-	// How to begin each command buffer
-	VkCommandBufferBeginInfo commandBufferBeginInfo{};
-	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	CPU_ZONE("createGraphicsCommandPool");
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 
-	// Buffer can be resubmited when it has already been submited
-	//commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	// Command buffers live for one frame: the driver can allocate them with that in mind.
+	// No RESET_COMMAND_BUFFER flag, the whole pool is reset at once, which is cheaper.
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	// Queue family type that buffers from this command pool will use
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
 
-	// Information about how to being a render pass (only for graphical apps)
-	VkRenderPassBeginInfo renderPassBeginInfo{};
-	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	// A pool for each frame in flight: the one being recorded is never used by the GPU
+	graphicsCommandPools.resize(framesInFlight, VK_NULL_HANDLE);
+	for (VkCommandPool& commandPool : graphicsCommandPools)
+	{
+		VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &commandPool);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create graphics command pool");
+		}
+	}
+}
 
-	// Render pass to begin
-	renderPassBeginInfo.renderPass = renderPass;
 
-	// Start point of render pass in pixel
-	renderPassBeginInfo.renderArea.offset = { 0, 0 };
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// Size of region to run render pass on
-	renderPassBeginInfo.renderArea.extent = swapchainExtent;
-	VkClearValue clearValues[]{ { 0.6f, 0.65f, 0.4f, 1.0f} };
 
-	// List of clear values (TODO: add depth attachment clear value)
-	renderPassBeginInfo.pClearValues = clearValues;
-	renderPassBeginInfo.clearValueCount = 1;
+void VulkanRenderer::createGraphicsCommandBuffers()
+{
+	CPU_ZONE("createGraphicsCommandBuffers");
+	// Create one command buffer for each frame in flight, from its own pool
+	commandBuffers.resize(graphicsCommandPools.size());
 
 	for (size_t i = 0; i < commandBuffers.size(); ++i)
 	{
-		// Because 1-to-1 relationship
-		renderPassBeginInfo.framebuffer = swapchainFramebuffers[i];
-
-		// Start recording commands to command buffer
-		VkResult result = vkBeginCommandBuffer(commandBuffers[i], &commandBufferBeginInfo);
-
+		// We are using a pool
+		VkCommandBufferAllocateInfo commandBufferAllocInfo{};
+		commandBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		commandBufferAllocInfo.commandPool = graphicsCommandPools[i];
+		commandBufferAllocInfo.commandBufferCount = 1;
+		commandBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+		// Primary means the command buffer will submit directly to a queue.
+		// Secondary cannot be called by a queue, but by an other primary command buffer,
+		// via vkCmdExecuteCommands.
+		VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &commandBufferAllocInfo, &commandBuffers[i]);
 		if (result != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to start recording to command buffer");
+			throw std::runtime_error("Failed to allocate graphics command buffers");
 		}
+	}
+}
+
 
-		// Begin render pass
-		// All draw commands inline (no secondary command buffers)
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-		// Bind pipeline to be used in render pass, you could switch pipelines
-		// for different subpasses
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
-		// Execute pipeline
-		// Draw 3 vertices, 1 instance, with no offset. Instance allow you to draw several
-		// instances with one draw call.
-		vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
+void VulkanRenderer::createSecondaryCommandBuffers()
+{
+	CPU_ZONE("createSecondaryCommandBuffers");
 
-		// End render pass
-		vkCmdEndRenderPass(commandBuffers[i]);
+	// At most one chunk per thread
+	uint32_t chunkCount = jobSystem.getThreadCount();
+	if (chunkCount == 1) return;
 
-		// Stop recordind to command buffer
-		result = vkEndCommandBuffer(commandBuffers[i]);
-		if (result != VK_SUCCESS)
+	// Secondary command buffers of a chunk, for each frame in flight
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+
+	secondaryCommandPools.resize(framesInFlight, std::vector<VkCommandPool>(chunkCount, VK_NULL_HANDLE));
+	secondaryCommandBuffers.resize(framesInFlight, std::vector<VkCommandBuffer>(DRAW_PASS_COUNT * chunkCount, VK_NULL_HANDLE));
+	for (size_t frame = 0; frame < secondaryCommandPools.size(); ++frame)
+	{
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
 		{
-			throw std::runtime_error("Failed to stop recording to command buffer");
+			VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &secondaryCommandPools[frame][chunk]);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create a recording thread command pool");
+			}
+
+			// Secondary: only executed from the primary command buffer, inside its render pass.
+			// One per draw pass, the chunk's thread records them one after the other.
+			VkCommandBufferAllocateInfo commandBufferAllocInfo{};
+			commandBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			commandBufferAllocInfo.commandPool = secondaryCommandPools[frame][chunk];
+			commandBufferAllocInfo.commandBufferCount = 1;
+			commandBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			for (uint32_t drawPass = 0; drawPass < DRAW_PASS_COUNT; ++drawPass)
+			{
+				result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &commandBufferAllocInfo,
+					&secondaryCommandBuffers[frame][drawPass * chunkCount + chunk]);
+				if (result != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to allocate a secondary command buffer");
+				}
+			}
 		}
 	}
 }
@@ -605,72 +1041,1243 @@ void VulkanRenderer::recordCommands()
 /*------------------------------------------------------------------------------------------------------------------------*/
 
 
-void VulkanRenderer::draw()
+void VulkanRenderer::createJobSystem()
 {
-	// 0. Freeze code until the drawFences[currentFrame] is open
-	vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint32_t>::max());
+	CPU_ZONE("createJobSystem");
+	uint32_t count = threadCount;
+	if (count == 0) count = std::max(std::thread::hardware_concurrency(), 1u);
+	jobSystem.init(count);
+}
 
-	// When passing the fence, we close it behind us
-	vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
 
-	// 1. Get next available image to draw and set a semaphore to signal
-	// when we're finished with the image.
-	uint32_t imageToBeDrawnIndex;
-	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint32_t>::max(), imageAvailable, VK_NULL_HANDLE, &imageToBeDrawnIndex);
-	
+void VulkanRenderer::loadAssetArchive()
+{
+	CPU_ZONE("loadAssetArchive");
 
+	// A missing archive is fine (loose files are used), a broken one throws
+	assetArchive.open(assetArchivePath, &jobSystem);
+}
 
-	// 2. Submit command buffer to queue for execution, make sure it waits
-	// for the image to be signaled as available before drawing, and
-	// signals when it has finished rendering.
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &imagesAvailable[currentFrame];
-	
-	// Keep doing command buffer until imageAvailable is true
-	VkPipelineStageFlags waitStages[]{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	
-	// Stages to check semaphores at
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	
-	// Command buffer to submit
-	submitInfo.pCommandBuffers = &commandBuffers[imageToBeDrawnIndex];
-	submitInfo.signalSemaphoreCount = 1;
-	
-	// Semaphores to signal when command buffer finishes
-	submitInfo.pSignalSemaphores = &rendersFinished[currentFrame];
-	VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences[currentFrame]);
-	
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to submit command buffer to queue");
-	}
-	
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// 3. Present image to screen when it has signalled finished rendering
-	VkPresentInfoKHR presentInfo{};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &rendersFinished[currentFrame];
-	presentInfo.swapchainCount = 1;
-	
-	// Swapchains to present to
-	presentInfo.pSwapchains = &swapchain;
-	
-	// Index of images in swapchains to present
-	presentInfo.pImageIndices = &imageToBeDrawnIndex;
-	result = vkQueuePresentKHR(presentationQueue, &presentInfo);
-	if (result != VK_SUCCESS)
+
+void VulkanRenderer::createShaderCompiler()
+{
+	CPU_ZONE("createShaderCompiler");
+	if (!ShaderCompiler::isAvailable()) return;
+
+	// Kept out of rsc/ so it doesn't end up in the asset archive
+	shaderCompiler.init("shader_cache");
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createMemoryAllocator()
+{
+	CPU_ZONE("createMemoryAllocator");
+	memoryAllocator.init(mainDevice.physicalDevice, mainDevice.logicalDevice);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createPipelineCache()
+{
+	CPU_ZONE("createPipelineCache");
+	pipelineCache.create(mainDevice.physicalDevice, mainDevice.logicalDevice, pipelineCachePath);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createUploader()
+{
+	CPU_ZONE("createUploader");
+
+	// Uploads run on the transfer queue, the graphics queue waits for them only where it reads
+	// the data. On devices with a single queue it is the graphics queue itself.
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+	uploader.init(mainDevice.logicalDevice, memoryAllocator, gpuTimeline, transferQueue, queueFamilyIndices.transferFamily,
+		graphicsQueue, queueFamilyIndices.graphicsFamily);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createMeshes()
+{
+	CPU_ZONE("createMeshes");
+
+	// Mesh 0: the triangle the vertex shader used to hard-code
+	std::vector<Vertex> triangleVertices
+	{
+		{ { 0.0f, -0.4f, 0.0f }, { 1.0f, 0.0f, 0.0f } },
+		{ { 0.4f, 0.4f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+		{ { -0.4f, 0.4f, 0.0f }, { 0.0f, 0.0f, 1.0f } }
+	};
+	std::vector<uint32_t> triangleIndices{ 0, 1, 2 };
+	createMesh(triangleVertices, triangleIndices);
+
+	// Instance buffer 0: the mesh as it is, for draws that don't give their own instances
+	createInstanceBuffer({ { { 0.0f, 0.0f, 0.0f }, 1.0f, { 1.0f, 1.0f, 1.0f, 1.0f } } });
+
+	// Submitted now, the first frame comes after it on the same queue
+	uploader.flush();
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t VulkanRenderer::createMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	CPU_ZONE("createMesh");
+	Mesh mesh;
+	mesh.create(memoryAllocator, uploader, vertices, indices);
+	meshes.push_back(mesh);
+	return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint32_t VulkanRenderer::createInstanceBuffer(const std::vector<InstanceData>& instances)
+{
+	CPU_ZONE("createInstanceBuffer");
+	if (instances.empty())
+	{
+		throw std::runtime_error("An instance buffer needs at least one instance");
+	}
+
+	InstanceBuffer instanceBuffer;
+	instanceBuffer.create(memoryAllocator, uploader, instances);
+	instanceBuffers.push_back(instanceBuffer);
+
+	// Written to the bindless set before the next frame is submitted, with the upload
+	instanceBufferBindlessIndices.push_back(bindless.addBuffer(instanceBuffer.getBuffer()));
+	return static_cast<uint32_t>(instanceBuffers.size() - 1);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createGpuProfiler()
+{
+	CPU_ZONE("createGpuProfiler");
+	if (!gpuProfilingEnabled) return;
+
+	// One slot of queries for each frame in flight
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+	gpuProfiler.init(mainDevice.physicalDevice, mainDevice.logicalDevice, queueFamilyIndices.graphicsFamily,
+		static_cast<uint32_t>(commandBuffers.size()), MAX_GPU_ZONES);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createComputePipeline()
+{
+	CPU_ZONE("createComputePipeline");
+	if (particleCount == 0) return;
+
+	// Layouts are kept when the pipeline is rebuilt for a hot reload
+	if (computeDescriptorSetLayout == VK_NULL_HANDLE)
+	{
+		// Binding 0: particles of the previous frame, binding 1: particles written this frame
+		VkDescriptorSetLayoutBinding bindings[2]{};
+		for (uint32_t i = 0; i < 2; ++i)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{};
+		setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		setLayoutCreateInfo.bindingCount = 2;
+		setLayoutCreateInfo.pBindings = bindings;
+		VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &setLayoutCreateInfo, nullptr, &computeDescriptorSetLayout);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create the compute descriptor set layout");
+		}
+
+		// Particle count, steps and time step: the Simulation block of particles.comp
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = 3 * sizeof(uint32_t);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCreateInfo.setLayoutCount = 1;
+		pipelineLayoutCreateInfo.pSetLayouts = &computeDescriptorSetLayout;
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &computePipelineLayout);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create the compute pipeline layout");
+		}
+	}
+
+	// A compute pipeline is a single shader stage, no fixed function state
+	VkShaderModule computeShaderModule = loadShaderModule("Shader/particles.comp", "Shader/particles.spv", COMPUTE_PIPELINE_ID);
+
+	VkComputePipelineCreateInfo computePipelineCreateInfo{};
+	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computePipelineCreateInfo.stage.module = computeShaderModule;
+	computePipelineCreateInfo.stage.pName = "main";
+	computePipelineCreateInfo.layout = computePipelineLayout;
+	computePipelineCreateInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateComputePipelines(mainDevice.logicalDevice, pipelineCache.getHandle(), 1, &computePipelineCreateInfo, nullptr, &computePipeline);
+	vkDestroyShaderModule(mainDevice.logicalDevice, computeShaderModule, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not create the compute pipeline");
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createCullPipeline()
+{
+	CPU_ZONE("createCullPipeline");
+	if (!isGpuDriven()) return;
+
+	// Layouts are kept when the pipeline is rebuilt for a hot reload
+	if (cullDescriptorSetLayout == VK_NULL_HANDLE)
+	{
+		// Objects in, visible instances, draw commands and draw count out (see cull.comp)
+		VkDescriptorSetLayoutBinding bindings[4]{};
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{};
+		setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		setLayoutCreateInfo.bindingCount = 4;
+		setLayoutCreateInfo.pBindings = bindings;
+		VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &setLayoutCreateInfo, nullptr, &cullDescriptorSetLayout);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create the culling descriptor set layout");
+		}
+
+		// Object count, index count and bounding radius: the Culling block of cull.comp
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = 3 * sizeof(uint32_t);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCreateInfo.setLayoutCount = 1;
+		pipelineLayoutCreateInfo.pSetLayouts = &cullDescriptorSetLayout;
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &cullPipelineLayout);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create the culling pipeline layout");
+		}
+	}
+
+	VkShaderModule cullShaderModule = loadShaderModule("Shader/cull.comp", "Shader/cull.spv", CULL_PIPELINE_ID);
+
+	VkComputePipelineCreateInfo computePipelineCreateInfo{};
+	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computePipelineCreateInfo.stage.module = cullShaderModule;
+	computePipelineCreateInfo.stage.pName = "main";
+	computePipelineCreateInfo.layout = cullPipelineLayout;
+	computePipelineCreateInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateComputePipelines(mainDevice.logicalDevice, pipelineCache.getHandle(), 1, &computePipelineCreateInfo, nullptr, &cullPipeline);
+	vkDestroyShaderModule(mainDevice.logicalDevice, cullShaderModule, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not create the culling pipeline");
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createParticles()
+{
+	CPU_ZONE("createParticles");
+	if (particleCount == 0) return;
+
+	// Both queues use the buffers every frame: concurrent sharing instead of ownership
+	// transfers back and forth
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+	uint32_t sharingFamilies[]{ static_cast<uint32_t>(queueFamilyIndices.graphicsFamily), static_cast<uint32_t>(queueFamilyIndices.computeFamily) };
+	bool concurrent = isComputeAsync() && sharingFamilies[0] != sharingFamilies[1];
+
+	VkBufferCreateInfo bufferCreateInfo{};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = sizeof(Particle) * static_cast<VkDeviceSize>(particleCount);
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferCreateInfo.sharingMode = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+	bufferCreateInfo.queueFamilyIndexCount = concurrent ? 2 : 0;
+	bufferCreateInfo.pQueueFamilyIndices = concurrent ? sharingFamilies : nullptr;
+
+	// Spread on the screen, slowly turning around the centre. The w of the position is the
+	// scale the mesh is drawn with, the simulation keeps it.
+	const float particleScale = 0.01f;
+	std::vector<Particle> particles(particleCount);
+	for (uint32_t i = 0; i < particleCount; ++i)
+	{
+		float x = static_cast<float>(i % 1024) / 512.0f - 1.0f;
+		float y = static_cast<float>((i / 1024) % 1024) / 512.0f - 1.0f;
+		particles[i] = { { x, y, 0.0f, particleScale }, { -y * 0.5f, x * 0.5f, 0.0f, 0.0f } };
+	}
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		memoryAllocator.createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, particleBuffers[i], particleAllocations[i]);
+		// The first async frame draws the initial state
+		uploader.uploadBuffer(particleBuffers[i], 0, particles.data(), bufferCreateInfo.size,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, concurrent);
+	}
+
+	// The uploader hands its buffers to the graphics queue, not the compute one: wait here,
+	// once, rather than adding a semaphore to every simulation
+	uploader.waitIdle();
+
+	// One set per destination buffer, reading from the other one
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 4;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = 2;
+	poolCreateInfo.poolSizeCount = 1;
+	poolCreateInfo.pPoolSizes = &poolSize;
+	VkResult result = vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &computeDescriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the compute descriptor pool");
+	}
+
+	VkDescriptorSetLayout setLayouts[]{ computeDescriptorSetLayout, computeDescriptorSetLayout };
+	VkDescriptorSetAllocateInfo setAllocateInfo{};
+	setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocateInfo.descriptorPool = computeDescriptorPool;
+	setAllocateInfo.descriptorSetCount = 2;
+	setAllocateInfo.pSetLayouts = setLayouts;
+	result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocateInfo, computeDescriptorSets);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate the compute descriptor sets");
+	}
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		VkDescriptorBufferInfo bufferInfos[2]{};
+		bufferInfos[0] = { particleBuffers[1 - i], 0, VK_WHOLE_SIZE };
+		bufferInfos[1] = { particleBuffers[i], 0, VK_WHOLE_SIZE };
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = computeDescriptorSets[i];
+		write.dstBinding = 0;
+		write.descriptorCount = 2;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = bufferInfos;
+		vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &write, 0, nullptr);
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createCullFrames()
+{
+	CPU_ZONE("createCullFrames");
+
+	// One per frame in flight, its buffers are made when the first GPU driven frame needs them.
+	// Its descriptor set is allocated with the frame.
+	cullFrames.resize(framesInFlight);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createComputeCommandBuffers()
+{
+	CPU_ZONE("createComputeCommandBuffers");
+	if (particleCount == 0) return;
+
+	// Submitted to the compute queue, or with the frame on the graphics queue
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = isComputeAsync() ? queueFamilyIndices.computeFamily : queueFamilyIndices.graphicsFamily;
+	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &computeCommandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create compute command pool");
+	}
+
+	computeCommandBuffers.resize(2);
+	VkCommandBufferAllocateInfo commandBufferAllocInfo{};
+	commandBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferAllocInfo.commandPool = computeCommandPool;
+	commandBufferAllocInfo.commandBufferCount = static_cast<uint32_t>(computeCommandBuffers.size());
+	commandBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &commandBufferAllocInfo, computeCommandBuffers.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate compute command buffers");
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::recordCommands(uint32_t imageIndex)
+{
+	CPU_ZONE("recordCommands");
+	uint64_t recordBeginNs = CpuTracer::nowNs();
+
+	// This frame slot was waited on: nothing from the pool is in use anymore.
+	// Resetting the pool gives back the memory of its command buffers in one go.
+	vkResetCommandPool(mainDevice.logicalDevice, graphicsCommandPools[currentFrame], 0);
+	VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
+
+	// How to begin each command buffer
+	VkCommandBufferBeginInfo commandBufferBeginInfo{};
+	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	// Submitted once, recorded again next time
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (drawSettings.meshIndex >= meshes.size())
+	{
+		throw std::runtime_error("Draw settings use a mesh that doesn't exist");
+	}
+	const Mesh& mesh = meshes[drawSettings.meshIndex];
+
+	// Instances past the end of the buffer would read outside of it
+	if (drawSettings.instanceBufferIndex >= instanceBuffers.size()
+		|| drawSettings.instanceCount > instanceBuffers[drawSettings.instanceBufferIndex].getInstanceCount())
+	{
+		throw std::runtime_error("Draw settings draw more instances than their instance buffer holds");
+	}
+	const InstanceBuffer& instanceBuffer = instanceBuffers[drawSettings.instanceBufferIndex];
+
+	// Particles come from the buffer the frame's submit waits on. Async: the previous
+	// simulation's (the initial state before the first), serial: the one submitted in front.
+	particleDrawBuffer = VK_NULL_HANDLE;
+	if (!computeCommandBuffers.empty())
+	{
+		particleDrawBuffer = particleBuffers[(computeFrame + (isComputeAsync() ? 1 : 0)) % 2];
+	}
+
+	// Straight into the mapped ring, bound with its offset by every draw pass
+	FrameConstants frameConstants{};
+	memcpy(frameConstants.tint, drawSettings.tint, sizeof(frameConstants.tint));
+	frameConstants.frameNumber = static_cast<uint32_t>(frameNumber);
+	frameConstantsOffset = uniformRing.push(frameConstants);
+
+	// GPU driven: the instances are the objects to cull, the GPU writes the draws
+	bool gpuDrivenFrame = isGpuDriven();
+	CullFrame& cullFrame = cullFrames[currentFrame];
+	drawRanges.clear();
+	visibleObjectCount = drawSettings.instanceCount;
+	if (gpuDrivenFrame)
+	{
+		// Turned on after init
+		if (cullPipeline == VK_NULL_HANDLE) createCullPipeline();
+		prepareCullFrame(cullFrame, instanceBuffer, drawSettings.instanceCount);
+	}
+	else if (cpuCulling)
+	{
+		cullObjects(instanceBuffer, mesh, drawSettings.instanceCount);
+	}
+	else
+	{
+		drawRanges.push_back({ 0, drawSettings.instanceCount });
+	}
+
+	// Each of the drawCount calls becomes one call per range
+	uint32_t totalDraws = drawSettings.drawCount * static_cast<uint32_t>(drawRanges.size());
+
+	// The frame as a graph: culling (GPU driven only), the depth prepass (if enabled), then
+	// the main pass. The graph places the barriers between them and around the swapchain image.
+	frameGraph.reset();
+	RenderGraph::Resource backbuffer = importBackbuffer(imageIndex);
+	RenderGraph::Resource depth = createDepthBuffer();
+	RenderGraph::Resource visibleInstances = 0;
+	RenderGraph::Resource drawCommands = 0;
+	RenderGraph::Resource drawCount = 0;
+	if (gpuDrivenFrame)
+	{
+		RenderGraph::Resource objects = frameGraph.importBuffer("Objects", instanceBuffer.getBuffer());
+		visibleInstances = frameGraph.importBuffer("Visible instances", cullFrame.visibleInstances);
+		drawCommands = frameGraph.importBuffer("Draw commands", cullFrame.drawCommands);
+		drawCount = frameGraph.importBuffer("Draw count", cullFrame.drawCount);
+
+		// Culling can't run inside a render pass
+		RenderGraph::Pass cullingPass = frameGraph.addComputePass("Culling", [&](const RenderGraph::PassContext& context)
+		{
+			recordCulling(context.commandBuffer, cullFrame, mesh, drawSettings.instanceCount);
+		});
+		frameGraph.read(cullingPass, objects, ResourceUsage::StorageRead);
+		frameGraph.write(cullingPass, visibleInstances, ResourceUsage::StorageWrite);
+
+		// Cleared, then written by the shader
+		frameGraph.write(cullingPass, drawCommands, ResourceUsage::TransferWrite);
+		frameGraph.write(cullingPass, drawCommands, ResourceUsage::StorageWrite);
+		frameGraph.write(cullingPass, drawCount, ResourceUsage::TransferWrite);
+		frameGraph.write(cullingPass, drawCount, ResourceUsage::StorageWrite);
+	}
+
+	// GPU timestamps of this frame use the slot of the frame in flight (no-op when profiling is disabled)
+	uint32_t profilerSlot = static_cast<uint32_t>(currentFrame);
+
+	// Secondary command buffers of both draw passes come from the same pools: reset once for the frame
+	if (!secondaryCommandPools.empty())
+	{
+		for (VkCommandPool commandPool : secondaryCommandPools[currentFrame])
+		{
+			vkResetCommandPool(mainDevice.logicalDevice, commandPool, 0);
+		}
+	}
+
+	// The prepass and the main pass record the same draws, with their own pipeline. Nothing but
+	// secondary command buffers can go between their subpasses: one GPU zone for the render pass.
+	uint32_t renderPassZone = 0;
+	auto recordDraws = [&](const RenderGraph::PassContext& context, uint32_t drawPass, VkPipeline pipeline, const char* zoneName)
+	{
+		if (context.subpass == 0) renderPassZone = gpuProfiler.beginZone(commandBuffer, profilerSlot, zoneName);
+
+		// Enough draws to keep several threads busy? A GPU driven frame has a few commands to record only.
+		uint32_t chunkCount = std::min(jobSystem.getThreadCount(),
+			(totalDraws + MIN_DRAWS_PER_CHUNK - 1) / MIN_DRAWS_PER_CHUNK);
+
+		if (gpuDrivenFrame)
+		{
+			context.beginRenderPass(VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			bindGlobalDescriptors(commandBuffer);
+			setViewportAndScissor(commandBuffer);
+			for (uint32_t d = 0; d < drawSettings.drawCount; ++d)
+			{
+				// Instances come from the culling results, not from a bindless buffer
+				DrawConstants drawConstants{ d, BindlessDescriptors::NO_INDEX };
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(drawConstants), &drawConstants);
+				recordIndirectDraws(commandBuffer, cullFrame, mesh, drawSettings.instanceCount);
+			}
+			if (drawPass == DRAW_PASS_MAIN) recordParticleDraw(commandBuffer);
+		}
+		else if (chunkCount <= 1)
+		{
+			// Begin render pass (or its next subpass)
+			// All draw commands inline (no secondary command buffers)
+			context.beginRenderPass(VK_SUBPASS_CONTENTS_INLINE);
+
+			// Bind pipeline to be used in render pass, you could switch pipelines
+			// for different subpasses
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			bindGlobalDescriptors(commandBuffer);
+			setViewportAndScissor(commandBuffer);
+
+			// Buffers to read the vertices, the instances and the indices from
+			VkBuffer vertexBuffers[]{ mesh.getVertexBuffer(), instanceBuffer.getBuffer() };
+			VkDeviceSize offsets[]{ 0, 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, mesh.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+			// Execute pipeline
+			// Draw the mesh indices, with no offset. Instance allow you to draw several
+			// instances with one draw call. Per draw GPU zones for the main pass only.
+			for (uint32_t d = 0; d < totalDraws; ++d)
+			{
+				const InstanceRange& range = drawRanges[d % drawRanges.size()];
+				uint32_t drawZone = drawPass == DRAW_PASS_MAIN ? gpuProfiler.beginZone(commandBuffer, profilerSlot, "Draw", static_cast<int32_t>(d)) : 0;
+				DrawConstants drawConstants{ d, instanceBufferBindlessIndices[drawSettings.instanceBufferIndex] };
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(drawConstants), &drawConstants);
+				vkCmdDrawIndexed(commandBuffer, mesh.getIndexCount(), range.instanceCount, 0, 0, range.firstInstance);
+				if (drawPass == DRAW_PASS_MAIN) gpuProfiler.endZone(commandBuffer, profilerSlot, drawZone);
+			}
+			if (drawPass == DRAW_PASS_MAIN) recordParticleDraw(commandBuffer);
+		}
+		else
+		{
+			// The render pass content comes from secondary command buffers only
+			context.beginRenderPass(VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+			// What the secondary command buffers continue
+			VkCommandBufferInheritanceInfo inheritanceInfo{};
+			inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			inheritanceInfo.renderPass = context.renderPassBegin.renderPass;
+			inheritanceInfo.subpass = context.subpass;
+			inheritanceInfo.framebuffer = context.renderPassBegin.framebuffer;
+
+			// The draws are shared out, the first chunks take the remainder. One job per chunk,
+			// an exception thrown by one of them comes back out of parallelFor.
+			uint32_t drawsPerChunk = totalDraws / chunkCount;
+			uint32_t remainder = totalDraws % chunkCount;
+			jobSystem.parallelFor(chunkCount, 1, [&](uint32_t firstChunk, uint32_t lastChunk)
+			{
+				for (uint32_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+				{
+					uint32_t firstDraw = chunk * drawsPerChunk + std::min(chunk, remainder);
+					recordDrawChunk(chunk, drawPass, pipeline, firstDraw, drawsPerChunk + (chunk < remainder ? 1 : 0), inheritanceInfo);
+				}
+			});
+
+			// The chunks of this draw pass follow each other in the frame's buffers
+			size_t firstBuffer = drawPass * secondaryCommandPools[currentFrame].size();
+			vkCmdExecuteCommands(commandBuffer, chunkCount, secondaryCommandBuffers[currentFrame].data() + firstBuffer);
+		}
+
+		// End render pass, after its last subpass
+		context.endRenderPass();
+		if (context.lastSubpass) gpuProfiler.endZone(commandBuffer, profilerSlot, renderPassZone);
+	};
+
+	// Both draw passes read what the culling wrote
+	auto readCullingResults = [&](RenderGraph::Pass drawPass)
+	{
+		if (!gpuDrivenFrame) return;
+		frameGraph.read(drawPass, visibleInstances, ResourceUsage::VertexRead);
+		frameGraph.read(drawPass, drawCommands, ResourceUsage::IndirectRead);
+		frameGraph.read(drawPass, drawCount, ResourceUsage::IndirectRead);
+	};
+	if (depthPrepass)
+	{
+		readCullingResults(addDepthPrepass(depth, [&](const RenderGraph::PassContext& context)
+		{
+			recordDraws(context, DRAW_PASS_DEPTH_PREPASS, depthPrepassPipeline, "Depth prepass and render pass");
+		}));
+	}
+	readCullingResults(addMainPass(backbuffer, depth, depthPrepass, [&](const RenderGraph::PassContext& context)
+	{
+		recordDraws(context, DRAW_PASS_MAIN, context.subpass == 0 ? graphicsPipeline : afterPrepassPipeline, "Render pass");
+	}));
+	frameGraph.compile();
+
+	// Start recording commands to command buffer
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording to command buffer");
+	}
+	gpuProfiler.beginSlot(commandBuffer, profilerSlot);
+	frameGraph.execute(commandBuffer);
+
+	// Stop recordind to command buffer
+	result = vkEndCommandBuffer(commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to stop recording to command buffer");
+	}
+
+	lastRecordMs = (CpuTracer::nowNs() - recordBeginNs) / 1e6;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::prepareCullFrame(CullFrame& cullFrame, const InstanceBuffer& objects, uint32_t objectCount)
+{
+	// This frame slot was waited on, its buffers can be replaced. They only grow.
+	if (cullFrame.capacity < objectCount)
+	{
+		if (cullFrame.visibleInstances != VK_NULL_HANDLE) memoryAllocator.destroyBuffer(cullFrame.visibleInstances, cullFrame.visibleInstancesAllocation);
+		if (cullFrame.drawCommands != VK_NULL_HANDLE) memoryAllocator.destroyBuffer(cullFrame.drawCommands, cullFrame.drawCommandsAllocation);
+
+		VkBufferCreateInfo bufferCreateInfo{};
+		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		bufferCreateInfo.size = sizeof(InstanceData) * static_cast<VkDeviceSize>(objectCount);
+		bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+		memoryAllocator.createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, cullFrame.visibleInstances, cullFrame.visibleInstancesAllocation);
+
+		// Cleared with vkCmdFillBuffer, so transfer destinations too
+		bufferCreateInfo.size = sizeof(VkDrawIndexedIndirectCommand) * static_cast<VkDeviceSize>(objectCount);
+		bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		memoryAllocator.createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, cullFrame.drawCommands, cullFrame.drawCommandsAllocation);
+
+		if (cullFrame.drawCount == VK_NULL_HANDLE)
+		{
+			bufferCreateInfo.size = sizeof(uint32_t);
+			memoryAllocator.createBuffer(bufferCreateInfo, MemoryUsage::GpuOnly, cullFrame.drawCount, cullFrame.drawCountAllocation);
+		}
+		cullFrame.capacity = objectCount;
+	}
+
+	// A set for this frame only: it goes with the reset of the slot's pools, nothing to free
+	cullFrame.descriptorSet = frameDescriptors.allocate(cullDescriptorSetLayout);
+
+	VkDescriptorBufferInfo bufferInfos[4]{};
+	bufferInfos[0] = { objects.getBuffer(), 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { cullFrame.visibleInstances, 0, VK_WHOLE_SIZE };
+	bufferInfos[2] = { cullFrame.drawCommands, 0, VK_WHOLE_SIZE };
+	bufferInfos[3] = { cullFrame.drawCount, 0, VK_WHOLE_SIZE };
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = cullFrame.descriptorSet;
+	write.dstBinding = 0;
+	write.descriptorCount = 4;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = bufferInfos;
+	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &write, 0, nullptr);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::recordCulling(VkCommandBuffer commandBuffer, CullFrame& cullFrame, const Mesh& mesh, uint32_t objectCount)
+{
+	uint32_t profilerSlot = static_cast<uint32_t>(currentFrame);
+	uint32_t cullingZone = gpuProfiler.beginZone(commandBuffer, profilerSlot, "Culling");
+
+	// The shader counts from zero. Without the count extension every command is drawn: the
+	// ones past the count are cleared so they draw nothing.
+	vkCmdFillBuffer(commandBuffer, cullFrame.drawCount, 0, VK_WHOLE_SIZE, 0);
+	if (cmdDrawIndexedIndirectCount == nullptr)
+	{
+		vkCmdFillBuffer(commandBuffer, cullFrame.drawCommands, 0, VK_WHOLE_SIZE, 0);
+	}
+
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	// Object count, index count, bounding radius: the Culling block of cull.comp
+	struct
+	{
+		uint32_t objectCount;
+		uint32_t indexCount;
+		float boundingRadius;
+	} culling{ objectCount, mesh.getIndexCount(), mesh.getBoundingRadius() };
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullFrame.descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(culling), &culling);
+	vkCmdDispatch(commandBuffer, (objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// The barrier to the draws that read the results is the render graph's
+	gpuProfiler.endZone(commandBuffer, profilerSlot, cullingZone);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::recordIndirectDraws(VkCommandBuffer commandBuffer, const CullFrame& cullFrame, const Mesh& mesh, uint32_t objectCount)
+{
+	// Visible instances replace the instance buffer, each command finds its own with firstInstance
+	VkBuffer vertexBuffers[]{ mesh.getVertexBuffer(), cullFrame.visibleInstances };
+	VkDeviceSize offsets[]{ 0, 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, mesh.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	if (cmdDrawIndexedIndirectCount != nullptr)
+	{
+		// Only the visible objects are drawn
+		cmdDrawIndexedIndirectCount(commandBuffer, cullFrame.drawCommands, 0, cullFrame.drawCount, 0, objectCount, stride);
+	}
+	else if (multiDrawIndirectSupported)
+	{
+		// Every slot is drawn, the cleared ones have no instance
+		vkCmdDrawIndexedIndirect(commandBuffer, cullFrame.drawCommands, 0, objectCount, stride);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < objectCount; ++i)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, cullFrame.drawCommands, i * stride, 1, stride);
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::cullObjects(const InstanceBuffer& objects, const Mesh& mesh, uint32_t objectCount)
+{
+	CPU_ZONE("cullObjects");
+
+	// Kept from frame to frame, the batches only allocate when the object count grows
+	uint32_t batchCount = (objectCount + CULL_BATCH_SIZE - 1) / CULL_BATCH_SIZE;
+	if (cullBatchVisible.size() < batchCount)
+	{
+		cullBatchVisible.resize(batchCount);
+		cullBatchRanges.resize(batchCount);
+	}
+
+	const CullBounds& bounds = objects.getBounds();
+	float radiusScale = mesh.getBoundingRadius();
+	jobSystem.parallelFor(batchCount, 1, [&](uint32_t firstBatch, uint32_t lastBatch)
+	{
+		for (uint32_t batch = firstBatch; batch < lastBatch; ++batch)
+		{
+			uint32_t first = batch * CULL_BATCH_SIZE;
+			uint32_t last = std::min(first + CULL_BATCH_SIZE, objectCount);
+			std::vector<uint32_t>& visible = cullBatchVisible[batch];
+			visible.resize(CULL_BATCH_SIZE);
+			uint32_t visibleCount = frustumCuller.cull(cullingFrustum, bounds, radiusScale, first, last, visible.data());
+
+			std::vector<InstanceRange>& ranges = cullBatchRanges[batch];
+			ranges.clear();
+			for (uint32_t i = 0; i < visibleCount; ++i)
+			{
+				if (!ranges.empty() && ranges.back().firstInstance + ranges.back().instanceCount == visible[i]) ++ranges.back().instanceCount;
+				else ranges.push_back({ visible[i], 1 });
+			}
+		}
+	});
+
+	// A range can go on over the next batch
+	visibleObjectCount = 0;
+	for (uint32_t batch = 0; batch < batchCount; ++batch)
+	{
+		for (const InstanceRange& range : cullBatchRanges[batch])
+		{
+			visibleObjectCount += range.instanceCount;
+			if (!drawRanges.empty() && drawRanges.back().firstInstance + drawRanges.back().instanceCount == range.firstInstance)
+			{
+				drawRanges.back().instanceCount += range.instanceCount;
+			}
+			else
+			{
+				drawRanges.push_back(range);
+			}
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::recordDrawChunk(uint32_t chunk, uint32_t drawPass, VkPipeline pipeline, uint32_t firstDraw, uint32_t drawCount,
+	const VkCommandBufferInheritanceInfo& inheritanceInfo)
+{
+	CPU_ZONE("recordDrawChunk");
+
+	// The pool was reset with the frame, only this chunk's thread uses it
+	uint32_t chunkCount = static_cast<uint32_t>(secondaryCommandPools[currentFrame].size());
+	VkCommandBuffer commandBuffer = secondaryCommandBuffers[currentFrame][drawPass * chunkCount + chunk];
+
+	// Recorded for the inside of the primary command buffer's render pass
+	VkCommandBufferBeginInfo commandBufferBeginInfo{};
+	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	commandBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording to secondary command buffer");
+	}
+
+	// Nothing is inherited but the render pass: bind everything again, dynamic state included
+	const Mesh& mesh = meshes[drawSettings.meshIndex];
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	bindGlobalDescriptors(commandBuffer);
+	setViewportAndScissor(commandBuffer);
+	VkBuffer vertexBuffers[]{ mesh.getVertexBuffer(), instanceBuffers[drawSettings.instanceBufferIndex].getBuffer() };
+	VkDeviceSize offsets[]{ 0, 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, mesh.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+	// No per draw GPU zones here, the profiler is not thread safe
+	uint32_t instanceBuffer = instanceBufferBindlessIndices[drawSettings.instanceBufferIndex];
+	for (uint32_t d = firstDraw; d < firstDraw + drawCount; ++d)
+	{
+		const InstanceRange& range = drawRanges[d % drawRanges.size()];
+		DrawConstants drawConstants{ d, instanceBuffer };
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(drawConstants), &drawConstants);
+		vkCmdDrawIndexed(commandBuffer, mesh.getIndexCount(), range.instanceCount, 0, 0, range.firstInstance);
+	}
+
+	// The particles go with the main pass's last chunk
+	if (drawPass == DRAW_PASS_MAIN && firstDraw + drawCount == drawSettings.drawCount * drawRanges.size()) recordParticleDraw(commandBuffer);
+
+	result = vkEndCommandBuffer(commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to stop recording to secondary command buffer");
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::recordComputeCommands()
+{
+	CPU_ZONE("recordComputeCommands");
+
+	struct
+	{
+		uint32_t particleCount;
+		uint32_t stepCount;
+		float deltaTime;
+	} simulation{ particleCount, particleSteps, 1.0f / 60.0f };
+
+	// On the graphics queue the frames are ordered with barriers. On the compute queue the
+	// semaphores do it, and the graphics stages don't even exist there.
+	bool serial = !isComputeAsync();
+
+	for (uint32_t i = 0; i < computeCommandBuffers.size(); ++i)
+	{
+		// Recorded once, submitted every other frame: with more than 2 frames in flight the
+		// previous submission may still be pending (the semaphores and barriers order them)
+		VkCommandBufferBeginInfo commandBufferBeginInfo{};
+		commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		if (framesInFlight > 2) commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+		VkResult result = vkBeginCommandBuffer(computeCommandBuffers[i], &commandBufferBeginInfo);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to start recording to compute command buffer");
+		}
+
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		if (serial)
+		{
+			// The previous frames read the buffer about to be overwritten
+			vkCmdPipelineBarrier(computeCommandBuffers[i], VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+		}
+
+		vkCmdBindPipeline(computeCommandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+		vkCmdBindDescriptorSets(computeCommandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout,
+			0, 1, &computeDescriptorSets[i], 0, nullptr);
+		vkCmdPushConstants(computeCommandBuffers[i], computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(simulation), &simulation);
+		vkCmdDispatch(computeCommandBuffers[i], (particleCount + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE, 1, 1);
+
+		if (serial)
+		{
+			// Written particles visible to the draws and to the next simulation
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(computeCommandBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		result = vkEndCommandBuffer(computeCommandBuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to stop recording to compute command buffer");
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+uint64_t VulkanRenderer::submitCompute()
+{
+	CPU_ZONE("Submit compute");
+	VkCommandBuffer commandBuffer = computeCommandBuffers[computeFrame++ % 2];
+
+	// The next simulation overwrites what the previous graphics frame read
+	GpuTimeline::Wait previousFrame = gpuTimeline.waitFor(graphicsTimeline, lastParticleFrameValue, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	uint32_t waitCount = lastParticleFrameValue > 0 ? 1 : 0;
+	simulationValues[currentFrame] = gpuTimeline.submit(computeTimeline, &commandBuffer, 1, &previousFrame, waitCount);
+
+	// This frame draws what the previous simulation produced
+	uint64_t previousSimulation = lastSimulationValue;
+	lastSimulationValue = simulationValues[currentFrame];
+	return previousSimulation;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::recordParticleDraw(VkCommandBuffer commandBuffer)
+{
+	if (particleDrawBuffer == VK_NULL_HANDLE) return;
+
+	// Inside a draw pass, its pipeline and descriptors bound. A particle is read like an
+	// instance: position.xyz is its offset, position.w its scale, the velocity its color.
+	static_assert(sizeof(Particle) == sizeof(InstanceData), "Particles are read through the instance binding");
+	const Mesh& mesh = meshes[drawSettings.meshIndex];
+	VkBuffer vertexBuffers[]{ mesh.getVertexBuffer(), particleDrawBuffer };
+	VkDeviceSize offsets[]{ 0, 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, mesh.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+	// Not one of the drawCount draws
+	DrawConstants drawConstants{ drawSettings.drawCount, BindlessDescriptors::NO_INDEX };
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(drawConstants), &drawConstants);
+	vkCmdDrawIndexed(commandBuffer, mesh.getIndexCount(), particleCount, 0, 0, 0);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::draw()
+{
+	CPU_ZONE("draw");
+
+	if (shaderHotReload) reloadChangedShaders();
+
+	// Resized or out of date since the last frame. Nothing to draw into while minimised.
+	if (swapchainOutOfDate && !recreateSwapchain()) return;
+
+	// Where the frame's latency starts: input would be read about now. The pacer first waits
+	// for the display to catch up and for the frame to be due.
+	uint64_t frameBeginTimeNs;
+	{
+		CPU_STALL_ZONE("Frame pacing");
+		frameBeginTimeNs = framePacer.beginFrame(swapchain);
+	}
+
+	// 0. Freeze code until the graphics timeline reached the last frame of this slot. This is
+	// the CPU waiting on the GPU, so it is traced as a stall rather than as work.
+	{
+		CPU_STALL_ZONE("Wait for frame");
+
+		// Frames already done are timed before waiting, the waited one right after
+		takeLatencySamples();
+		gpuTimeline.wait(graphicsTimeline, frameValues[currentFrame]);
+
+		// The simulation submitted with this slot may still run on the compute queue
+		gpuTimeline.wait(computeTimeline, simulationValues[currentFrame]);
+		takeLatencySamples();
+	}
+
+	// Frames are done in submission order: the one waited for and all before it.
+	// What was retired before they were submitted can be destroyed.
+	uint64_t completedFrames = frameNumber + 1 >= framesInFlight ? frameNumber + 1 - framesInFlight : 0;
+	releaseRetiredSwapchains(false);
+	deletionQueue.collect(completedFrames);
+
+	// The frame waited for is done, so its timestamps can be read without waiting, and the
+	// descriptor sets it used can go
+	gpuProfiler.collect();
+	frameDescriptors.beginFrame(static_cast<uint32_t>(currentFrame));
+	uniformRing.beginFrame(static_cast<uint32_t>(currentFrame));
+
+	// Meshes created since the last frame are uploaded before this frame is submitted, on
+	// the same queue, so it can draw them. Finished uploads give their staging memory back.
+	// Same for the bindless descriptors of what was created.
+	uploader.flush();
+	uploader.collect();
+	bindless.flushUpdates();
+
+
+
+	// 1. Get next available image to draw and set a semaphore to signal
+	// when we're finished with the image.
+	uint32_t imageToBeDrawnIndex;
+	VkSemaphore acquireSemaphore = VK_NULL_HANDLE;
+	if (headless)
+	{
+		// No swapchain to ask, we cycle through our offscreen images. The image was last
+		// used framesInFlight + 1 frames ago, the wait above already covered it.
+		imageToBeDrawnIndex = offscreenImageIndex;
+		offscreenImageIndex = (offscreenImageIndex + 1) % static_cast<uint32_t>(swapchainImages.size());
+	}
+	else
+	{
+		CPU_ZONE("Acquire image");
+		acquireSemaphore = gpuTimeline.takeBinarySemaphore();
+		VkResult acquireResult = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint32_t>::max(), acquireSemaphore, VK_NULL_HANDLE, &imageToBeDrawnIndex);
+
+		// Nothing was acquired: try again with a new swapchain. Nothing was submitted for this
+		// slot, the next draw goes straight through the wait. Suboptimal still presents, it is
+		// made again after.
+		if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			gpuTimeline.recycleBinarySemaphore(acquireSemaphore, graphicsTimeline, 0);
+			swapchainOutOfDate = true;
+			return;
+		}
+		if (acquireResult != VK_SUCCESS && acquireResult != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("Failed to acquire a swapchain image");
+		}
+		if (acquireResult == VK_SUBOPTIMAL_KHR) swapchainOutOfDate = true;
+
+		// The image's last present has waited on its semaphore since it was acquired again
+		VkSemaphore& presentSemaphore = presentSemaphores[imageToBeDrawnIndex];
+		if (presentSemaphore != VK_NULL_HANDLE) gpuTimeline.recycleBinarySemaphore(presentSemaphore, graphicsTimeline, 0);
+		presentSemaphore = gpuTimeline.takeBinarySemaphore();
+	}
+
+
+	// 2. Record the frame from scratch, with the current draw settings. What it wrote to the
+	// uniform ring is flushed at once (nothing to do on coherent memory).
+	recordCommands(imageToBeDrawnIndex);
+	uniformRing.flush();
+
+
+
+	// 2.5 Particle simulation. Async: on the compute queue, this frame waits for the previous
+	// simulation only. Serial: recorded in front of the frame, in the same submit.
+	bool simulating = !computeCommandBuffers.empty();
+	uint64_t simulationDone = 0;
+	VkCommandBuffer submittedCommandBuffers[2];
+	uint32_t submittedCount = 0;
+	if (simulating)
+	{
+		if (isComputeAsync()) simulationDone = submitCompute();
+		else submittedCommandBuffers[submittedCount++] = computeCommandBuffers[computeFrame++ % 2];
+	}
+	submittedCommandBuffers[submittedCount++] = commandBuffers[currentFrame];
+
+
+
+	// 3. Submit command buffer to queue for execution, make sure it waits
+	// for the image to be signaled as available before drawing, and
+	// signals when it has finished rendering.
+	// Headless: nothing is acquired nor presented, the timeline is the only synchronisation
+	GpuTimeline::Wait waits[2];
+	uint32_t waitCount = 0;
+	if (!headless)
+	{
+		// Keep doing command buffer until the image is available
+		waits[waitCount].semaphore = acquireSemaphore;
+		waits[waitCount++].stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	}
+	if (simulationDone != 0)
+	{
+		// Particles are only read from the vertex input on
+		waits[waitCount++] = gpuTimeline.waitFor(computeTimeline, simulationDone, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	}
+
+	// The graphics timeline is signaled for the next waits on this slot and the next
+	// simulation, the present semaphore for the presentation
+	VkSemaphore presentSemaphore = headless ? VK_NULL_HANDLE : presentSemaphores[imageToBeDrawnIndex];
+	{
+		CPU_ZONE("Submit");
+		frameValues[currentFrame] = gpuTimeline.submit(graphicsTimeline, submittedCommandBuffers, submittedCount, waits, waitCount, presentSemaphore);
+	}
+
+	// Waited on once this frame started on the GPU, reusable once it is done
+	if (!headless) gpuTimeline.recycleBinarySemaphore(acquireSemaphore, graphicsTimeline, frameValues[currentFrame]);
+	gpuProfiler.submitted(static_cast<uint32_t>(currentFrame), frameNumber++);
+	deletionQueue.setSubmittedFrames(frameNumber);
+	frameBeginNs[currentFrame] = frameBeginTimeNs;
+	if (simulating && isComputeAsync()) lastParticleFrameValue = frameValues[currentFrame];
+
+	if (headless)
+	{
+		// Nothing to show: the frame counts as presented once submitted
+		framePacer.presented(0, frameBeginTimeNs, CpuTracer::nowNs());
+		currentFrame = (currentFrame + 1) % framesInFlight;
+		return;
+	}
+	
+
+
+	// 4. Present image to screen when it has signalled finished rendering
+	VkPresentInfoKHR presentInfo{};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pWaitSemaphores = &presentSemaphore;
+	presentInfo.swapchainCount = 1;
+	
+	// Swapchains to present to
+	presentInfo.pSwapchains = &swapchain;
+	
+	// Index of images in swapchains to present
+	presentInfo.pImageIndices = &imageToBeDrawnIndex;
+
+	// The id the pacer waits on to know when the frame is on screen
+	uint64_t presentId = framePacer.nextPresentId();
+	VkPresentIdKHR presentIdInfo{};
+	presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+	presentIdInfo.swapchainCount = 1;
+	presentIdInfo.pPresentIds = &presentId;
+	if (framePacer.usesPresentWait()) presentInfo.pNext = &presentIdInfo;
+	VkResult result;
+	{
+		CPU_ZONE("Present");
+		result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+	}
+
+	if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)
+	{
+		framePacer.presented(presentId, frameBeginTimeNs, CpuTracer::nowNs());
+	}
+
+	// The frame was submitted either way, its timeline value will be reached: just make a new swapchain
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		swapchainOutOfDate = true;
+	}
+	else if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to present image");
 	}
 
-	currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;
+	currentFrame = (currentFrame + 1) % framesInFlight;
 
 }
 
@@ -679,122 +2286,133 @@ void VulkanRenderer::draw()
 
 void VulkanRenderer::createRenderPass()
 {
-	VkRenderPassCreateInfo renderPassCreateInfo{};
-	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-
-	// Attachement description : describe color buffer output, depth buffer output...
-	// e.g. (location = 0) in the fragment shader is the first attachment
-	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = swapchainImageFormat; // Format to use for attachment
-
-
-	// Number of samples t write for multisampling
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-
-
-	// What to do with attachement before renderer. Here, clear when we start the render pass.
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-
-
-	// What to do with attachement after renderer. Here, store the render pass.
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-
-
-	// What to do with stencil before renderer. Here, don't care, we don't use stencil.
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-
-
-	// What to do with stencil after renderer. Here, don't care, we don't use stencil.
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
-
-	// Framebuffer images will be stored as an image, but image can have different layouts
-	// to give optimal use for certain operations.
-	// Image data layout before render pass starts
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-
+	CPU_ZONE("createRenderPass");
+	frameGraph.init(mainDevice.logicalDevice, memoryAllocator, deletionQueue);
+
+	// The render passes come from the graph: declare the passes like a frame does. They keep
+	// the same attachments (and so the same render passes) every frame. With the prepass, the
+	// main pass is the second subpass of the prepass's render pass.
+	frameGraph.reset();
+	RenderGraph::Resource backbuffer = importBackbuffer(0);
+	RenderGraph::Resource depth = createDepthBuffer();
+	RenderGraph::Pass prepass = addDepthPrepass(depth, nullptr);
+	addMainPass(backbuffer, depth, true, nullptr);
+	frameGraph.compile();
+	depthPrepassRenderPass = frameGraph.getRenderPass(prepass);
+
+	frameGraph.reset();
+	backbuffer = importBackbuffer(0);
+	depth = createDepthBuffer();
+	RenderGraph::Pass mainPass = addMainPass(backbuffer, depth, false, nullptr);
+	frameGraph.compile();
+	renderPass = frameGraph.getRenderPass(mainPass);
+	frameGraph.reset();
+}
 
-	// Image data layout after render pass
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-	renderPassCreateInfo.attachmentCount = 1;
-	renderPassCreateInfo.pAttachments = &colorAttachment;
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// Attachment reference uses an attachment index that refers to index in the attachement list
-	// passed to renderPassCreateInfo
-	VkAttachmentReference colorAttachmentReference{};
-	colorAttachmentReference.attachment = 0;
 
+RenderGraph::Resource VulkanRenderer::importBackbuffer(uint32_t imageIndex)
+{
+	// Its previous contents don't matter. The draw submit waits for the swapchain image at the
+	// color output stage, the transition has to come after it. Offscreen images are never
+	// presented, they are left ready to be copied back instead.
+	RenderGraph::Resource backbuffer = frameGraph.importImage("Backbuffer", swapchainImages[imageIndex].image,
+		swapchainImages[imageIndex].imageView, swapchainImageFormat, swapchainExtent, VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	frameGraph.markOutput(backbuffer);
+	return backbuffer;
+}
 
-	// Layout of the subpass (between initial and final layout)
-	colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// Subpass description, will reference attachements
-	VkSubpassDescription subpass{};
 
+RenderGraph::Pass VulkanRenderer::addMainPass(RenderGraph::Resource backbuffer, RenderGraph::Resource depth, bool afterPrepass,
+	RenderGraph::RecordFunction record)
+{
+	// After a prepass: its second subpass, the depth never leaves the render pass
+	RenderGraph::Pass mainPass = afterPrepass ? frameGraph.addGraphicsSubpass("Main", std::move(record))
+		: frameGraph.addGraphicsPass("Main", std::move(record));
 
-	// Pipeline type the subpass will be bound to. Could be compute pipeline, or nvidia raytracing...
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentReference;
-	renderPassCreateInfo.subpassCount = 1;
-	renderPassCreateInfo.pSubpasses = &subpass;
+	VkClearValue clearValue{};
+	clearValue.color = { { 0.6f, 0.65f, 0.4f, 1.0f } };
+	frameGraph.writeCleared(mainPass, backbuffer, ResourceUsage::ColorAttachment, clearValue);
 
+	// After a prepass the depth is already there. Still written: the depth test passes for the
+	// nearest fragment only, which writes the value the prepass left.
+	if (afterPrepass)
+	{
+		frameGraph.write(mainPass, depth, ResourceUsage::DepthAttachment);
+	}
+	else
+	{
+		VkClearValue depthClearValue{};
+		depthClearValue.depthStencil = { reversedZ ? 0.0f : 1.0f, 0 };
+		frameGraph.writeCleared(mainPass, depth, ResourceUsage::DepthAttachment, depthClearValue);
+	}
+	return mainPass;
+}
 
-	// Subpass dependencies: transitions between subpasses + from the last subpass
-	// to what happens after
-	// Need to determine when layout transitions occur using subpass dependencies.
-	// Will define implicitly layout transitions.
-	std::array<VkSubpassDependency, 2> subpassDependencies;
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// -- From layout undefined to color attachment optimal
-	// ---- Transition must happens after
-	// External means from outside the subpasses
-	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL
-		
-		;
-	// Which stage of the pipeline has to happen before
-	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 
+void VulkanRenderer::chooseDepthFormat()
+{
+	CPU_ZONE("chooseDepthFormat");
 
-	// ---- But must happens before
-	// Conversion should happen before the first subpass starts
-	subpassDependencies[0].dstSubpass = 0;
-	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	// Float first: most precise, and reversed-Z needs it to pay off. Stencil is not used,
+	// formats with stencil are only taken when there is nothing better.
+	const VkFormat candidates[]{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM };
+	for (VkFormat candidate : candidates)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, candidate, &properties);
+		if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+		{
+			depthFormat = candidate;
 
+			// Views and barriers of a depth stencil image have to cover both aspects
+			bool hasStencil = candidate == VK_FORMAT_D32_SFLOAT_S8_UINT || candidate == VK_FORMAT_D24_UNORM_S8_UINT;
+			depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+			return;
+		}
+	}
+	throw std::runtime_error("No depth format supported");
+}
 
-	// ...and before the color attachment attempts to read or write
-	subpassDependencies[0].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// No dependency flag
-	subpassDependencies[0].dependencyFlags = 0;
 
+RenderGraph::Resource VulkanRenderer::createDepthBuffer()
+{
+	// The depth lives and dies inside one render pass (the prepass and the main pass are its
+	// subpasses): transient attachment, never stored, a tiler keeps it in tile memory
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	return frameGraph.createImage("Depth", depthFormat, swapchainExtent, usage, depthAspect);
+}
 
-	// -- From layout color attachment optimal to image layout present
-	// ---- Transition must happens after
-	subpassDependencies[1].srcSubpass = 0;
-	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependencies[1].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// ---- But must happens before
-	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	subpassDependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	subpassDependencies[1].dependencyFlags = 0;
 
-	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
-	renderPassCreateInfo.pDependencies = subpassDependencies.data();
-	VkResult result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &renderPass);
+RenderGraph::Pass VulkanRenderer::addDepthPrepass(RenderGraph::Resource depth, RenderGraph::RecordFunction record)
+{
+	RenderGraph::Pass prepass = frameGraph.addGraphicsPass("Depth prepass", std::move(record));
 
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Could not create render pass.");
-	}
+	VkClearValue depthClearValue{};
+	depthClearValue.depthStencil = { reversedZ ? 0.0f : 1.0f, 0 };
+	frameGraph.writeCleared(prepass, depth, ResourceUsage::DepthAttachment, depthClearValue);
+	return prepass;
 }
 
 
@@ -804,32 +2422,76 @@ void VulkanRenderer::createRenderPass()
 
 void VulkanRenderer::createSynchronisation()
 {
-	imagesAvailable.resize(MAX_FRAME_DRAWS);
-	rendersFinished.resize(MAX_FRAME_DRAWS);
-	drawFences.resize(MAX_FRAME_DRAWS);
+	CPU_ZONE("createSynchronisation");
+	// The device targets Vulkan 1.1: timeline semaphores and synchronization2 are extensions,
+	// their functions are loaded by their KHR names
+	VkDevice device = mainDevice.logicalDevice;
+	PFN_vkWaitSemaphores waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphores>(vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR"));
+	PFN_vkGetSemaphoreCounterValue getCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(
+		vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR"));
+	PFN_vkQueueSubmit2 queueSubmit2 = nullptr;
+	if (synchronization2Supported)
+	{
+		queueSubmit2 = reinterpret_cast<PFN_vkQueueSubmit2>(vkGetDeviceProcAddr(device, "vkQueueSubmit2KHR"));
+	}
+	if (waitSemaphores == nullptr || getCounterValue == nullptr)
+	{
+		throw std::runtime_error("Failed to load the timeline semaphore functions");
+	}
+	gpuTimeline.init(device, waitSemaphores, getCounterValue, queueSubmit2);
 
-	// Semaphore creation info
-	VkSemaphoreCreateInfo semaphoreCreateInfo{};
-	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-	// That's all !
+	// The same timeline if compute runs on the graphics queue. Uploads add theirs.
+	graphicsTimeline = gpuTimeline.addQueue(graphicsQueue);
+	computeTimeline = gpuTimeline.addQueue(computeQueue);
+
+	// Value 0 is where every timeline starts: nothing to wait for
+	frameValues.assign(framesInFlight, 0);
+	simulationValues.assign(framesInFlight, 0);
+	frameBeginNs.assign(framesInFlight, 0);
+}
 
 
-	// Fence creation info
-	VkFenceCreateInfo fenceCreateInfo{};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
 
-	// Fence starts open
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	for (size_t i = 0; i < MAX_FRAME_DRAWS; ++i)
+void VulkanRenderer::createDescriptors()
+{
+	CPU_ZONE("createDescriptors");
+	frameDescriptors.init(mainDevice.logicalDevice, framesInFlight);
+
+	// As many buffers and textures as the device takes in an update-after-bind set, up to ours.
+	// Combined image samplers count as sampled images and as samplers, everything counts
+	// towards the total of all pools.
+	uint32_t maxBuffers = MAX_BINDLESS_BUFFERS;
+	uint32_t maxTextures = MAX_BINDLESS_TEXTURES;
+	if (descriptorIndexingSupported)
 	{
-		if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imagesAvailable[i]) != VK_SUCCESS 
-			|| vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &rendersFinished[i]) != VK_SUCCESS 
-			|| vkCreateFence(mainDevice.logicalDevice, &fenceCreateInfo, nullptr, &drawFences[i]) != VK_SUCCESS)
+		VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+		indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+		VkPhysicalDeviceProperties2 properties2{};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &indexingProperties;
+		vkGetPhysicalDeviceProperties2(mainDevice.physicalDevice, &properties2);
+
+		maxBuffers = std::min({ maxBuffers, indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+		maxTextures = std::min({ maxTextures, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+			indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers });
+		uint32_t allPools = indexingProperties.maxUpdateAfterBindDescriptorsInAllPools;
+		if (static_cast<uint64_t>(maxBuffers) + maxTextures > allPools)
 		{
-			throw std::runtime_error("Failed to create semaphores nad fences");
+			maxBuffers = std::min(maxBuffers, allPools / 2);
+			maxTextures = std::min(maxTextures, allPools - maxBuffers);
 		}
 	}
+	bindless.init(mainDevice.logicalDevice, deletionQueue, descriptorIndexingSupported, maxBuffers, maxTextures);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+	uniformRing.init(mainDevice.logicalDevice, memoryAllocator, deviceProperties.limits, framesInFlight);
 }
 
 
@@ -839,10 +2501,11 @@ void VulkanRenderer::createSynchronisation()
 
 void VulkanRenderer::createSwapchain()
 {
+	CPU_ZONE("createSwapchain");
 	// We will pick best settings for the swapchain
 	SwapchainDetails swapchainDetails = getSwapchainDetails(mainDevice.physicalDevice);
 	VkSurfaceFormatKHR surfaceFormat = chooseBestSurfaceFormat(swapchainDetails.formats);
-	VkPresentModeKHR presentationMode = chooseBestPresentationMode(swapchainDetails.presentationModes);
+	presentMode = chooseBestPresentationMode(swapchainDetails.presentationModes);
 	VkExtent2D extent = chooseSwapExtent(swapchainDetails.surfaceCapabilities);
 
 
@@ -852,13 +2515,17 @@ void VulkanRenderer::createSwapchain()
 	swapchainCreateInfo.surface = surface;
 	swapchainCreateInfo.imageFormat = surfaceFormat.format;
 	swapchainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
-	swapchainCreateInfo.presentMode = presentationMode;
+	swapchainCreateInfo.presentMode = presentMode;
 	swapchainCreateInfo.imageExtent = extent;
 
 
 	// Minimal number of image in our swapchain.
-	// We will use one more than the minimum to enable triple-buffering.
+	// One more than the minimum to enable triple-buffering, enough for every frame in flight to
+	// have its image when going for throughput, the minimum when going for latency (fewer
+	// images queued ahead of the display).
 	uint32_t imageCount = swapchainDetails.surfaceCapabilities.minImageCount + 1;
+	if (presentPolicy == PresentPolicy::Throughput) imageCount = std::max(imageCount, framesInFlight + 1);
+	if (presentPolicy == PresentPolicy::LowLatency) imageCount = std::max(swapchainDetails.surfaceCapabilities.minImageCount, 2u);
 	if (swapchainDetails.surfaceCapabilities.maxImageCount > 0 // Not limitless
 		&& swapchainDetails.surfaceCapabilities.maxImageCount < imageCount)
 	{
@@ -901,16 +2568,39 @@ void VulkanRenderer::createSwapchain()
 	}
 
 
-	// When you want to pass old swapchain responsibilities when destroying it,
-	// e.g. when you want to resize window, use this
-	swapchainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+	// When recreating, the old swapchain hands its resources over to the new one. It is
+	// retired: images already acquired can still be presented, no new ones can be.
+	VkSwapchainKHR oldSwapchain = swapchain;
+	swapchainCreateInfo.oldSwapchain = oldSwapchain;
 
 	// Create swapchain
-	VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice, &swapchainCreateInfo, nullptr, &swapchain);
+	VkSwapchainKHR newSwapchain = VK_NULL_HANDLE;
+	VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice, &swapchainCreateInfo, nullptr, &newSwapchain);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create swapchain");
 	}
+	swapchain = newSwapchain;
+
+	// Frames in flight may still render into the old images, and the display may still show
+	// them: the old views, the framebuffers made with them and the old swapchain go once
+	// its presents are done. The old images' present semaphores go back to the pool with
+	// them, they won't be acquired again.
+	if (oldSwapchain != VK_NULL_HANDLE)
+	{
+		RetiredSwapchain retired;
+		retired.swapchain = oldSwapchain;
+		for (const SwapchainImage& image : swapchainImages) retired.views.push_back(image.imageView);
+		retired.presentSemaphores = presentSemaphores;
+		retired.lastPresentId = framePacer.getLastPresentId();
+		frameGraph.retireImageViews(retired.views);
+		framePacer.swapchainChanged();
+
+		// Without present_wait nothing tells when a present is done: the frames are all there is
+		if (framePacer.usesPresentWait()) retiredSwapchains.push_back(retired);
+		else retireSwapchain(retired);
+		swapchainImages.clear();
+	}
 
 	// Store for later use
 	swapchainImageFormat = surfaceFormat.format;
@@ -933,6 +2623,227 @@ void VulkanRenderer::createSwapchain()
 		swapchainImages.push_back(swapchainImage);
 	}
 
+	// Taken from the pool when each image is first acquired
+	presentSemaphores.assign(swapchainImages.size(), VK_NULL_HANDLE);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::retireSwapchain(const RetiredSwapchain& retired)
+{
+	// Frames submitted until now may still render into its images
+	VkDevice device = mainDevice.logicalDevice;
+	deletionQueue.push([this, device, retired]()
+	{
+		for (VkImageView view : retired.views) vkDestroyImageView(device, view, nullptr);
+		vkDestroySwapchainKHR(device, retired.swapchain, nullptr);
+		for (VkSemaphore semaphore : retired.presentSemaphores)
+		{
+			if (semaphore != VK_NULL_HANDLE) gpuTimeline.recycleBinarySemaphore(semaphore, graphicsTimeline, 0);
+		}
+	});
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::releaseRetiredSwapchains(bool all)
+{
+	// A present made after the swapchain was retired is on screen: the display is done with
+	// every present before it, the old swapchain's last ones included
+	while (!retiredSwapchains.empty() && (all || framePacer.getShownPresentId() > retiredSwapchains.front().lastPresentId))
+	{
+		retireSwapchain(retiredSwapchains.front());
+		retiredSwapchains.pop_front();
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+bool VulkanRenderer::recreateSwapchain()
+{
+	CPU_ZONE("recreateSwapchain");
+
+	// Minimised: the surface has no size, a swapchain can't be made. Try again next frame.
+	SwapchainDetails swapchainDetails = getSwapchainDetails(mainDevice.physicalDevice);
+	VkExtent2D extent = chooseSwapExtent(swapchainDetails.surfaceCapabilities);
+	if (extent.width == 0 || extent.height == 0) return false;
+
+	// Same surface, same formats: the render passes and pipelines stay compatible. The graph
+	// makes the depth buffer and framebuffers again at the new size when it compiles.
+	createSwapchain();
+	swapchainOutOfDate = false;
+	return true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::bindGlobalDescriptors(VkCommandBuffer commandBuffer)
+{
+	// Sets 0 and 1 of every graphics pipeline, they stay bound across pipeline changes. The
+	// only descriptor sets a draw pass binds.
+	VkDescriptorSet bindlessSet = bindless.getSet();
+	if (bindlessSet != VK_NULL_HANDLE)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &bindlessSet, 0, nullptr);
+	}
+	VkDescriptorSet ringSet = uniformRing.getSet();
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &ringSet, 1, &frameConstantsOffset);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::setViewportAndScissor(VkCommandBuffer commandBuffer)
+{
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)swapchainExtent.width;
+	viewport.height = (float)swapchainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	// Reversed-Z: clip z 0 lands on depth 1 and the other way round. Vulkan allows a min
+	// depth greater than the max depth, the shaders don't change.
+	if (reversedZ) std::swap(viewport.minDepth, viewport.maxDepth);
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	// Everything outside is cut
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent = swapchainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::framebufferResizeCallback(GLFWwindow* window, int /*width*/, int /*height*/)
+{
+	// Some platforms never report the swapchain out of date on resize, don't count on it
+	VulkanRenderer* renderer = static_cast<VulkanRenderer*>(glfwGetWindowUserPointer(window));
+	renderer->swapchainOutOfDate = true;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createFramePacer()
+{
+	CPU_ZONE("createFramePacer");
+
+	// Keeps the target frame rate set before init
+	framePacer.init(mainDevice.logicalDevice, waitForPresent);
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::chooseFramesInFlight()
+{
+	// Each frame in flight is a frame of latency the CPU can run ahead by. Throughput wants
+	// the GPU never starved, latency wants the CPU to wait for the frame before starting the
+	// next one.
+	switch (presentPolicy)
+	{
+	case PresentPolicy::Balanced: framesInFlight = 2; break;
+	case PresentPolicy::Throughput: framesInFlight = MAX_FRAMES_IN_FLIGHT; break;
+	case PresentPolicy::LowLatency: framesInFlight = 1; break;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::takeLatencySamples()
+{
+	// One counter read for every slot
+	uint64_t nowNs = CpuTracer::nowNs();
+	uint64_t completedValue = gpuTimeline.getCompletedValue(graphicsTimeline);
+	for (uint32_t i = 0; i < framesInFlight; ++i)
+	{
+		if (frameBeginNs[i] == 0 || frameValues[i] > completedValue) continue;
+
+		lastLatencyMs = (nowNs - frameBeginNs[i]) / 1e6;
+		latencyTotalMs += lastLatencyMs;
+		++latencySamples;
+		frameBeginNs[i] = 0;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::resetLatencyStats()
+{
+	lastLatencyMs = 0.0;
+	latencyTotalMs = 0.0;
+	latencySamples = 0;
+}
+
+
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+void VulkanRenderer::createOffscreenTargets()
+{
+	CPU_ZONE("createOffscreenTargets");
+	// Without a surface we choose format and size ourselves. R8G8B8A8 UNORM has to be
+	// supported as a color attachment by every Vulkan implementation.
+	swapchainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	swapchainExtent = headlessExtent;
+
+	for (uint32_t i = 0; i < framesInFlight + 1; ++i)
+	{
+		VkImageCreateInfo imageCreateInfo{};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.format = swapchainImageFormat;
+		imageCreateInfo.extent = { swapchainExtent.width, swapchainExtent.height, 1 };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+		// Optimal tiling: the image is only read back through copies
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+
+		// Rendered to like a swapchain image, then can be copied out
+		imageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		// Backed by device local memory
+		SwapchainImage offscreenImage{};
+		memoryAllocator.createImage(imageCreateInfo, MemoryUsage::GpuOnly, offscreenImage.image, offscreenImage.allocation);
+
+		offscreenImage.imageView = createImageView(offscreenImage.image, swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+		swapchainImages.push_back(offscreenImage);
+	}
 }
 
 
@@ -970,6 +2881,7 @@ VkSurfaceFormatKHR VulkanRenderer::chooseBestSurfaceFormat(const std::vector<VkS
 
 void VulkanRenderer::setupDebugMessenger()
 {
+	CPU_ZONE("setupDebugMessenger");
 	if (!enableValidationLayers) return;
 	VkDebugUtilsMessengerCreateInfoEXT createInfo;
 	populateDebugMessengerCreateInfo(createInfo);
@@ -987,12 +2899,22 @@ void VulkanRenderer::setupDebugMessenger()
 
 VkPresentModeKHR VulkanRenderer::chooseBestPresentationMode(const std::vector<VkPresentModeKHR>& presentationModes)
 {
-	// We will use mail box presentation mode
-	for (const auto& presentationMode : presentationModes)
+	// Balanced and throughput: mailbox, never blocks and doesn't tear. Throughput then takes
+	// immediate over waiting on the display. Low latency takes immediate first: the frame goes
+	// out as soon as it is done, tearing is the price.
+	std::vector<VkPresentModeKHR> preferred;
+	switch (presentPolicy)
 	{
-		if (presentationMode == VK_PRESENT_MODE_MAILBOX_KHR)
+	case PresentPolicy::Balanced: preferred = { VK_PRESENT_MODE_MAILBOX_KHR }; break;
+	case PresentPolicy::Throughput: preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR }; break;
+	case PresentPolicy::LowLatency: preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR }; break;
+	}
+
+	for (VkPresentModeKHR candidate : preferred)
+	{
+		if (std::find(presentationModes.begin(), presentationModes.end(), candidate) != presentationModes.end())
 		{
-			return presentationMode;
+			return candidate;
 		}
 	}
 
@@ -1040,6 +2962,7 @@ VkExtent2D VulkanRenderer::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surf
 
 void VulkanRenderer::createInstance()
 {
+	CPU_ZONE("createInstance");
 
 	/*															  -- 1 --																*/
 
@@ -1244,26 +3167,35 @@ void VulkanRenderer::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreat
 
 void VulkanRenderer::createLogicalDevice()
 {
+	CPU_ZONE("createLogicalDevice");
 /*															-- 1 --															*/
 //																															//
 //													// P.D GOT QUEUES INFO													//
 //																															//
 	QueueFamilyIndices indices = getQueueFamilies(mainDevice.physicalDevice);
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily };
+
+	// Vulkan needs to know how to handle multiple queues. It uses priorities.
+	// 1 is the highest priority. Uploads come after drawing and compute.
+	// Queues of a family are created together, up to the highest index used.
+	std::map<int, std::vector<float>> queuePriorities;
+	queuePriorities[indices.graphicsFamily].assign(1, 1.0f);
+	queuePriorities[indices.presentationFamily].resize(1, 1.0f);
+
+	std::vector<float>& transferPriorities = queuePriorities[indices.transferFamily];
+	transferPriorities.resize(std::max(transferPriorities.size(), static_cast<size_t>(indices.transferQueueIndex + 1)), 0.5f);
+
+	std::vector<float>& computePriorities = queuePriorities[indices.computeFamily];
+	computePriorities.resize(std::max(computePriorities.size(), static_cast<size_t>(indices.computeQueueIndex + 1)), 1.0f);
 
 	// Queues the logical device needs to create and info to do so.
-	for (int queueFamilyIndex : queueFamilyIndices)
+	for (const auto& family : queuePriorities)
 	{
 		VkDeviceQueueCreateInfo queueCreateInfo{};
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-		queueCreateInfo.queueCount = 1;
-		float priority = 1.0f;
-
-		// Vulkan needs to know how to handle multiple queues. It uses priorities.
-		// 1 is the highest priority.
-		queueCreateInfo.pQueuePriorities = &priority;
+		queueCreateInfo.queueFamilyIndex = family.first;
+		queueCreateInfo.queueCount = static_cast<uint32_t>(family.second.size());
+		queueCreateInfo.pQueuePriorities = family.second.data();
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 //																															//
@@ -1290,8 +3222,117 @@ void VulkanRenderer::createLogicalDevice()
 //																															//
 //													 // L.D EXTENSIONS INFO													//
 //																															//
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	std::vector<const char*> requiredDeviceExtensions = getRequiredDeviceExtensions();
+
+	// Optional: lets the culling pass give the draw count to the GPU directly
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, extensions.data());
+	bool drawIndirectCountSupported = false;
+	bool synchronization2Extension = false;
+	bool presentIdExtension = false;
+	bool presentWaitExtension = false;
+	bool descriptorIndexingExtension = false;
+	for (const auto& extension : extensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+		{
+			drawIndirectCountSupported = true;
+			requiredDeviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+		synchronization2Extension |= strcmp(extension.extensionName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0;
+		presentIdExtension |= strcmp(extension.extensionName, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0;
+		presentWaitExtension |= strcmp(extension.extensionName, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0;
+		descriptorIndexingExtension |= strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0;
+	}
+
+	// Optional: the frame pacer learns when frames reach the screen. Both extensions and both
+	// features, or CPU timing. Nothing is presented headless.
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+	presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+	VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+	presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+	presentIdFeatures.pNext = &presentWaitFeatures;
+	bool presentWaitSupported = false;
+	if (!headless && presentIdExtension && presentWaitExtension)
+	{
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &presentIdFeatures;
+		vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &features2);
+		presentWaitSupported = presentIdFeatures.presentId == VK_TRUE && presentWaitFeatures.presentWait == VK_TRUE;
+	}
+	// Optional: submits go through vkQueueSubmit2KHR, see GpuTimeline
+	VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+	synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+	if (synchronization2Extension)
+	{
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &synchronization2Features;
+		vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &features2);
+	}
+	synchronization2Supported = synchronization2Features.synchronization2 == VK_TRUE;
+
+	// Optional: the bindless set, see BindlessDescriptors. Runtime sized arrays of storage
+	// buffers and sampled images, written after being bound and partially bound. Without, the
+	// set is empty.
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	if (descriptorIndexingExtension)
+	{
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &indexingFeatures;
+		vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &features2);
+	}
+	descriptorIndexingSupported = indexingFeatures.runtimeDescriptorArray == VK_TRUE
+		&& indexingFeatures.descriptorBindingPartiallyBound == VK_TRUE
+		&& indexingFeatures.descriptorBindingUpdateUnusedWhilePending == VK_TRUE
+		&& indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind == VK_TRUE
+		&& indexingFeatures.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE;
+
+	// Only what the set uses, and non uniform indexing (an index that differs within a draw)
+	// when the device has it
+	VkPhysicalDeviceDescriptorIndexingFeatures enabledIndexingFeatures{};
+	enabledIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	enabledIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	enabledIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	enabledIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	enabledIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	enabledIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	enabledIndexingFeatures.shaderStorageBufferArrayNonUniformIndexing = indexingFeatures.shaderStorageBufferArrayNonUniformIndexing;
+	enabledIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = indexingFeatures.shaderSampledImageArrayNonUniformIndexing;
+
+	// Extension features are enabled by chaining them, next to pEnabledFeatures. Timeline
+	// semaphores were checked when the device was picked.
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	timelineFeatures.timelineSemaphore = VK_TRUE;
+	deviceCreateInfo.pNext = &timelineFeatures;
+	if (synchronization2Supported)
+	{
+		requiredDeviceExtensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+		synchronization2Features.pNext = &timelineFeatures;
+		deviceCreateInfo.pNext = &synchronization2Features;
+	}
+	if (descriptorIndexingSupported)
+	{
+		requiredDeviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		enabledIndexingFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+		deviceCreateInfo.pNext = &enabledIndexingFeatures;
+	}
+	if (presentWaitSupported)
+	{
+		requiredDeviceExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+		requiredDeviceExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		presentWaitFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+		deviceCreateInfo.pNext = &presentIdFeatures;
+	}
+
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(requiredDeviceExtensions.size());
+	deviceCreateInfo.ppEnabledExtensionNames = requiredDeviceExtensions.data();
 //																															//
 //																															//
 //																															//
@@ -1299,7 +3340,16 @@ void VulkanRenderer::createLogicalDevice()
 //																															//
 //														 // FEATURES														//
 //																															//
-	VkPhysicalDeviceFeatures deviceFeatures{};					// For now, no device features (tessellation etc.)
+	VkPhysicalDeviceFeatures supportedFeatures{};
+	vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &supportedFeatures);
+
+	// GPU driven drawing needs firstInstance in indirect commands, it is how a draw finds its
+	// instance. Without multiDrawIndirect the commands are drawn one call each.
+	VkPhysicalDeviceFeatures deviceFeatures{};
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	gpuDrivenSupported = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+	multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 //																															//
 //																															//
@@ -1322,6 +3372,19 @@ void VulkanRenderer::createLogicalDevice()
 //																															//
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
+	vkGetDeviceQueue(mainDevice.logicalDevice, indices.transferFamily, indices.transferQueueIndex, &transferQueue);
+	vkGetDeviceQueue(mainDevice.logicalDevice, indices.computeFamily, indices.computeQueueIndex, &computeQueue);
+
+	if (drawIndirectCountSupported)
+	{
+		cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+			vkGetDeviceProcAddr(mainDevice.logicalDevice, "vkCmdDrawIndexedIndirectCountKHR"));
+	}
+	if (presentWaitSupported)
+	{
+		waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+			vkGetDeviceProcAddr(mainDevice.logicalDevice, "vkWaitForPresentKHR"));
+	}
 }
 
 
@@ -1366,6 +3429,7 @@ SwapchainDetails VulkanRenderer::getSwapchainDetails(VkPhysicalDevice device)
 
 void VulkanRenderer::getPhysicalDevice()
 {
+	CPU_ZONE("getPhysicalDevice");
 	// Get the number of physical devices then populate the physical device vector
 	uint32_t deviceCount = 0;
 	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -1380,6 +3444,7 @@ void VulkanRenderer::getPhysicalDevice()
 	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
 	// Get device valid for what we want to do
+	mainDevice.physicalDevice = VK_NULL_HANDLE;
 	for (const auto& device : devices)
 	{
 		if (checkDeviceSuitable(device))
@@ -1388,6 +3453,11 @@ void VulkanRenderer::getPhysicalDevice()
 			break;
 		}
 	}
+
+	if (mainDevice.physicalDevice == VK_NULL_HANDLE)
+	{
+		throw std::runtime_error("Can't find a GPU suitable for the renderer");
+	}
 }
 
 
@@ -1411,15 +3481,29 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 	QueueFamilyIndices indices = getQueueFamilies(device);
 	bool extensionSupported = checkDeviceExtensionSupport(device);
 
-	bool swapchainValid = false;
+	// The extension alone is not enough, the feature has to be there too
+	bool timelineSupported = false;
 	if (extensionSupported)
+	{
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &timelineFeatures;
+		vkGetPhysicalDeviceFeatures2(device, &features2);
+		timelineSupported = timelineFeatures.timelineSemaphore == VK_TRUE;
+	}
+
+	// Headless mode has no swapchain to validate
+	bool swapchainValid = headless;
+	if (extensionSupported && !headless)
 	{
 		SwapchainDetails swapchainDetails = getSwapchainDetails(device);
 		swapchainValid = !swapchainDetails.presentationModes.empty() && !swapchainDetails.formats.empty();
 	}
 
 
-	return indices.isValid() && extensionSupported && swapchainValid;
+	return indices.isValid() && extensionSupported && timelineSupported && swapchainValid;
 }
 
 
@@ -1429,6 +3513,12 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 
 bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice device)
 {
+	std::vector<const char*> requiredDeviceExtensions = getRequiredDeviceExtensions();
+	if (requiredDeviceExtensions.empty())
+	{
+		return true;
+	}
+
 	uint32_t extensionCount = 0;
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 	if (extensionCount == 0)
@@ -1440,7 +3530,7 @@ bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice device)
 	std::vector<VkExtensionProperties> extensions(extensionCount);
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
 
-	for (const auto& deviceExtension : deviceExtensions)
+	for (const auto& deviceExtension : requiredDeviceExtensions)
 	{
 		bool hasExtension = false;
 		for (const auto& extension : extensions)
@@ -1515,18 +3605,71 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
 			indices.graphicsFamily = i;
 		}
 
-		// Check if queue family support presentation
-		VkBool32 presentationSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
-		if (queueFamily.queueCount > 0 && presentationSupport)
+		// Check if queue family support presentation. Headless mode never presents,
+		// the graphics family stands in for it.
+		if (headless)
 		{
-			indices.presentationFamily = i;
+			indices.presentationFamily = indices.graphicsFamily;
+		}
+		else
+		{
+			VkBool32 presentationSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+			if (queueFamily.queueCount > 0 && presentationSupport)
+			{
+				indices.presentationFamily = i;
+			}
 		}
 
 		if (indices.isValid()) break;
 		++i;
 	}
 
+	if (!indices.isValid()) return indices;
+
+	// Compute families without graphics run their own queues on the GPU, the work there
+	// overlaps the render passes instead of waiting its turn on the graphics queue
+	uint32_t graphicsQueueCount = queueFamilies[indices.graphicsFamily].queueCount;
+	for (uint32_t family = 0; family < queueFamilyCount; ++family)
+	{
+		VkQueueFlags flags = queueFamilies[family].queueFlags;
+		if (queueFamilies[family].queueCount > 0 && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			indices.computeFamily = static_cast<int>(family);
+			indices.computeQueueIndex = 0;
+			break;
+		}
+	}
+
+	// Transfer-only families are the copy engines, they run beside the graphics queue.
+	// Graphics and compute families can copy too, but don't say so in their flags.
+	for (uint32_t family = 0; family < queueFamilyCount; ++family)
+	{
+		VkQueueFlags flags = queueFamilies[family].queueFlags;
+		if (queueFamilies[family].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) &&
+			!(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			indices.transferFamily = static_cast<int>(family);
+			indices.transferQueueIndex = 0;
+			break;
+		}
+	}
+
+	// No copy engine: a second graphics queue still lets uploads overlap drawing
+	uint32_t nextGraphicsQueue = 1;
+	if (indices.transferFamily < 0)
+	{
+		indices.transferFamily = indices.graphicsFamily;
+		indices.transferQueueIndex = static_cast<int>(std::min(nextGraphicsQueue++, graphicsQueueCount - 1));
+	}
+
+	// Same for compute, sharing the last queue when there are not enough of them
+	if (indices.computeFamily < 0)
+	{
+		indices.computeFamily = indices.graphicsFamily;
+		indices.computeQueueIndex = static_cast<int>(std::min(nextGraphicsQueue++, graphicsQueueCount - 1));
+	}
+
 	return indices;
 }
 
@@ -1537,10 +3680,11 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
 
 std::vector<const char*> VulkanRenderer::getRequiredExtensions()
 {
+	// Headless mode doesn't need any surface extension (and GLFW may not even be initialised)
 	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
+	const char** glfwExtensions = nullptr;
 
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	if (!headless) glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
 	//										   ^			   ^				  ^
 	//									   ,___|			   |______,___________|
@@ -1565,5 +3709,19 @@ std::vector<const char*> VulkanRenderer::getRequiredExtensions()
 }
 
 
+/*------------------------------------------------------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------------------------------------------------------*/
+
+
+std::vector<const char*> VulkanRenderer::getRequiredDeviceExtensions()
+{
+	// Frames and queues are synchronised with timeline semaphores. Swapchain is only needed
+	// when we present to a window.
+	std::vector<const char*> extensions{ VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+	if (!headless) extensions.insert(extensions.end(), deviceExtensions.begin(), deviceExtensions.end());
+	return extensions;
+}
+
+
 /*------------------------------------------------------------------------------------------------------------------------*/
 /*------------------------------------------------------------------------------------------------------------------------*/
@@ -4,6 +4,24 @@
 
 #include <GLFW/glfw3.h>
 #include "VulkanUtilities.h"
+#include "GpuProfiler.h"
+#include "CpuTracer.h"
+#include "PipelineCache.h"
+#include "AssetArchive.h"
+#include "ShaderCompiler.h"
+#include "ShaderWatcher.h"
+#include "Mesh.h"
+#include "InstanceBuffer.h"
+#include "JobSystem.h"
+#include "FrustumCuller.h"
+#include "RenderGraph.h"
+#include "DeletionQueue.h"
+#include "FramePacer.h"
+#include "GpuTimeline.h"
+#include "DescriptorAllocator.h"
+#include "BindlessDescriptors.h"
+#include "UniformRing.h"
+#include <deque>
 #include <stdexcept>
 
 struct 
@@ -27,66 +45,443 @@ public:
 	~VulkanRenderer();
 
 	int init(GLFWwindow* windowP);
+
+	// Same as init, but without window or surface: frames are rendered into a ring of
+	// device-local images owned by the renderer (render nodes, CI boxes, benchmarks)
+	int initHeadless(uint32_t width, uint32_t height);
 	bool checkInstanceExtensionSupport(const std::vector<const char*>& checkExtensions);
 	
 	void clean();
 
-private:
+	// -- Draw -- //
+	void draw();
+	// ---------- //
+
+	// What is recorded in the command buffers. Can be changed at any time, the next frame
+	// is recorded with it.
+	void setDrawSettings(const DrawSettings& settings);
+
+	// CPU time spent recording the last frame's command buffer
+	double getLastRecordMs() const { return lastRecordMs; }
+
+	// Threads of the job system (command recording, pipeline compilation, asset checks), the
+	// calling thread included. 0 is one per core, 1 runs everything on the calling thread.
+	// Has to be set before init.
+	void setThreadCount(uint32_t count) { threadCount = count; }
+	uint32_t getThreadCount() const { return jobSystem.getThreadCount(); }
+
+	// Block until the GPU has finished all submitted frames
+	void waitIdle();
+
+	std::string getDeviceName();
+
+	// GPU timestamps around the render pass and each draw. Has to be set before init.
+	void setGpuProfilingEnabled(bool enabled) { gpuProfilingEnabled = enabled; }
+	GpuProfiler& getGpuProfiler() { return gpuProfiler; }
+
+	// Upload a mesh and return its index for DrawSettings::meshIndex. The upload is only
+	// submitted with the next frame (or waitIdle): create many meshes, they go in one batch.
+	uint32_t createMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+	// Upload per instance transforms and colors and return their index for
+	// DrawSettings::instanceBufferIndex. A single draw then gives up to instances.size() copies
+	// of the mesh. Uploaded like meshes, with the next frame.
+	uint32_t createInstanceBuffer(const std::vector<InstanceData>& instances);
+
+	// Index of an instance buffer in the bindless set (binding BindlessDescriptors::BUFFER_BINDING),
+	// for shaders that find their instances themselves. NO_INDEX without descriptor indexing.
+	uint32_t getInstanceBufferBindlessIndex(uint32_t instanceBufferIndex) const { return instanceBufferBindlessIndices[instanceBufferIndex]; }
+
+	// Descriptors: per frame sets from pools reset in bulk, and the bindless set
+	bool isDescriptorIndexingSupported() const { return bindless.isSupported(); }
+	const BindlessDescriptors::Stats& getBindlessStats() const { return bindless.getStats(); }
+	uint32_t getDescriptorPoolCount() const { return frameDescriptors.getPoolCount(); }
+
+	// Per frame constants (FrameConstants) live in a persistently mapped ring, bound with a
+	// dynamic offset. Per draw constants (DrawConstants) are push constants.
+	const UniformRing::Stats& getUniformRingStats() const { return uniformRing.getStats(); }
+
+	// Copies to device local buffers, submitted with the next frame. Runs on the transfer queue
+	// when the device has a spare one.
+	StagingUploader& getUploader() { return uploader; }
+
+	// Device memory of every buffer and image the renderer creates
+	MemoryAllocator& getMemoryAllocator() { return memoryAllocator; }
+
+	// Particles moved by a compute shader each frame and drawn by the main pass as small copies
+	// of the draw settings' mesh, 0 for none. With async compute they are simulated on the
+	// compute queue, beside the render pass; without, on the graphics queue before it. Async
+	// needs a queue other than the graphics one. Has to be set before init.
+	void setParticleSimulation(uint32_t particleCount, uint32_t stepsPerFrame = 1);
+	void setAsyncCompute(bool enabled) { asyncCompute = enabled; }
+	bool isComputeAsync() const { return asyncCompute && computeQueue != graphicsQueue; }
+
+	// GPU driven drawing: every frame a compute pass culls the instances of the draw settings'
+	// instance buffer (instanceCount objects) against the screen and writes one indirect draw
+	// per visible object, then a single call draws them. The CPU cost of a frame no longer
+	// depends on the object count. drawCount still repeats the draw, the indirect one here,
+	// so frames stay comparable with the other modes. Can be changed at any time (the culling
+	// pipeline is made with the first GPU driven frame), has no effect on devices without
+	// drawIndirectFirstInstance.
+	void setGpuDriven(bool enabled) { gpuDriven = enabled; }
+	bool isGpuDriven() const { return gpuDriven && gpuDrivenSupported; }
+
+	// CPU culling: before recording, the instances drawn are tested against the clip volume
+	// on the job threads (SIMD, see FrustumCuller) and only the visible ones are recorded, one
+	// draw call per run of consecutive visible instances. Ignored for GPU driven frames.
+	void setCpuCulling(bool enabled) { cpuCulling = enabled; }
+	bool isCpuCulling() const { return cpuCulling; }
+	uint32_t getVisibleObjectCount() const { return visibleObjectCount; } // Left by the last frame's CPU culling, instanceCount without
+	FrustumCuller& getFrustumCuller() { return frustumCuller; }
+
+	// Every frame has a depth buffer: a transient image of the render graph, in lazily allocated
+	// memory when the device has it and never stored. Reversed-Z maps near to 1 and far to 0,
+	// which spreads the float precision evenly over distance. Has to be set before init.
+	void setReversedZ(bool enabled) { reversedZ = enabled; }
+	bool isReversedZ() const { return reversedZ; }
+	VkFormat getDepthFormat() const { return depthFormat; }
+
+	// Depth prepass: the frame's draws are first recorded depth only, then shaded with the depth
+	// test rejecting every hidden fragment before its fragment shader runs. Pays off when the
+	// fragments cost more than drawing the geometry twice. Can be changed at any time.
+	void setDepthPrepass(bool enabled) { depthPrepass = enabled; }
+	bool isDepthPrepass() const { return depthPrepass; }
+
+	// Frame pacing: the policy picks the present mode, the swapchain image count and the frames
+	// in flight. Headless only the frames in flight apply, nothing is presented. Has to be set
+	// before init.
+	void setPresentPolicy(PresentPolicy policy) { presentPolicy = policy; }
+	PresentPolicy getPresentPolicy() const { return presentPolicy; }
+	uint32_t getFramesInFlight() const { return framesInFlight; }
+	VkPresentModeKHR getPresentMode() const { return presentMode; }
+	uint32_t getSwapchainImageCount() const { return static_cast<uint32_t>(swapchainImages.size()); }
+
+	// Latency of a frame: from the start of its draw() to the CPU seeing its timeline value
+	// reached, i.e. done on the GPU and handed to the presentation engine. Measured at the start of each
+	// draw(), so to within a frame.
+	double getLastLatencyMs() const { return lastLatencyMs; }
+	double getAverageLatencyMs() const { return latencySamples > 0 ? latencyTotalMs / latencySamples : 0.0; }
+	void resetLatencyStats();
+
+	// Present feedback (latency and jitter histograms) and pacing to a target frame rate, see
+	// FramePacer. Uses present_id/present_wait when the device has them. Headless, the submit
+	// stands in for the present.
+	FramePacer& getFramePacer() { return framePacer; }
+
+	// The frame is built as a render graph (see RenderGraph): passes, barriers and memory of the last frame
+	const RenderGraph::Stats& getRenderGraphStats() const { return frameGraph.getStats(); }
+
+	// Rebuild the pipelines whose GLSL sources changed on disk, checked at the start of each
+	// draw(). Needs a build with ENABLE_RUNTIME_SHADER_COMPILER. Has to be set before init.
+	void setShaderHotReload(bool enabled) { shaderHotReload = enabled; }
+	void reloadChangedShaders();
+
+	// Packed assets, see AssetArchive. Without archive, assets are read from loose files in rsc/.
+	// Has to be set before init.
+	void setAssetArchivePath(const std::string& path) { assetArchivePath = path; }
+
+	// Where the pipeline cache is loaded from at init and saved to at clean. Has to be set before init.
+	void setPipelineCachePath(const std::string& path) { pipelineCachePath = path; }
+	bool isPipelineCacheWarm() const { return pipelineCache.wasLoaded(); }
 
-	std::vector<VkSemaphore> imagesAvailable;
-	std::vector<VkSemaphore> rendersFinished;
-	std::vector<VkFence> drawFences;
+private:
 
-	VkSemaphore imageAvailable;
-	VkSemaphore renderFinished;
+	// -- Jobs -- //
+	// Created first, every other stage can use it. The thread calling init is thread 0.
+	uint32_t threadCount = 0;
+	JobSystem jobSystem;
+	void createJobSystem();
+	// ------------ //
+
+	// -- Assets -- //
+	std::string assetArchivePath = "rsc/assets.pak";
+	AssetArchive assetArchive;
+	void loadAssetArchive();
+	// -------------- //
+
+	// -- Memory -- //
+	MemoryAllocator memoryAllocator;
+	void createMemoryAllocator();
+
+	// Objects retired while frames in flight may still use them, destroyed once those are done
+	DeletionQueue deletionQueue;
+	// -------------- //
+
+	// -- Geometry -- //
+	StagingUploader uploader;
+	std::vector<Mesh> meshes;
+	std::vector<InstanceBuffer> instanceBuffers;
+	std::vector<uint32_t> instanceBufferBindlessIndices; // Per instance buffer
+	void createUploader();
+	void createMeshes();
+	// ---------------- //
+
+	// -- Descriptors -- //
+	// Sets used by a single frame (the culling pass's) come from the pools of its frame in
+	// flight, reset in bulk once the slot's last frame is done. What lives longer goes in the
+	// bindless set: set 0 of the graphics pipeline layout, bound once per command buffer, found
+	// by index in the shaders. Set 1 is the uniform ring, bound with the offset of the frame's
+	// constants. Draws bind no descriptor set, they push their constants.
+	static const uint32_t MAX_BINDLESS_BUFFERS = 16384; // Lowered to the device's update-after-bind limits
+	static const uint32_t MAX_BINDLESS_TEXTURES = 16384;
+	bool descriptorIndexingSupported = false; // VK_EXT_descriptor_indexing, with update-after-bind
+	DescriptorAllocator frameDescriptors;
+	BindlessDescriptors bindless;
+	UniformRing uniformRing;
+	uint32_t frameConstantsOffset = 0; // The recorded frame's FrameConstants in the ring
+	void createDescriptors();
+	void bindGlobalDescriptors(VkCommandBuffer commandBuffer);
+	// ----------------- //
+
+	// -- Shaders -- //
+	// Pipelines that can be rebuilt on their own when one of their shaders changes
+	enum PipelineId : uint32_t
+	{
+		GRAPHICS_PIPELINE_ID,
+		COMPUTE_PIPELINE_ID,
+		CULL_PIPELINE_ID
+	};
+	bool shaderHotReload = false;
+	ShaderCompiler shaderCompiler;
+	ShaderWatcher shaderWatcher;
+	void createShaderCompiler();
+	std::mutex shaderWatcherMutex; // Pipelines are compiled side by side at init
+	void createPipelines();
+	void rebuildGraphicsPipeline();
+	void rebuildComputePipeline();
+	void rebuildCullPipeline();
+	// --------------- //
+
+	// -- Compute -- //
+	// Frame N simulates from the state of frame N-1 into the other particle buffer. With async
+	// compute the graphics frame N waits for the simulation N-1, and simulation N waits for the
+	// graphics frame N-1 (the next simulation overwrites what it read): a frame of latency,
+	// but the simulation runs beside the render pass. The main pass draws each particle as an
+	// instance of the draw settings' mesh, reading the particle buffer as its instance stream.
+	static const uint32_t PARTICLE_GROUP_SIZE = 256; // local_size_x of particles.comp
+	uint32_t particleCount = 0;
+	uint32_t particleSteps = 1;
+	bool asyncCompute = true;
+	VkQueue computeQueue = VK_NULL_HANDLE;
+	VkBuffer particleBuffers[2]{};
+	MemoryAllocation particleAllocations[2];
+	VkDescriptorSetLayout computeDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool computeDescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet computeDescriptorSets[2]{}; // Set i writes particleBuffers[i]
+	VkPipelineLayout computePipelineLayout = VK_NULL_HANDLE;
+	VkPipeline computePipeline = VK_NULL_HANDLE;
+	VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> computeCommandBuffers; // One per destination buffer
+	uint64_t computeFrame = 0;
+	uint64_t lastSimulationValue = 0; // Compute timeline value the next frame draws, 0 before the first simulation
+	uint64_t lastParticleFrameValue = 0; // Graphics timeline value of the last frame that drew particles
+	VkBuffer particleDrawBuffer = VK_NULL_HANDLE; // Read by the frame being recorded, null without particles
+	void createComputePipeline();
+	void createParticles();
+	void createComputeCommandBuffers();
+	void recordComputeCommands();
+	uint64_t submitCompute(); // Returns the compute value the graphics submit has to wait on, 0 for none
+	void recordParticleDraw(VkCommandBuffer commandBuffer);
+	// ------------- //
+
+	// -- GPU driven drawing -- //
+	// Culling runs at the start of the frame's command buffer, on the graphics queue. Without
+	// vkCmdDrawIndexedIndirectCount, every command slot is drawn and the unused ones are zeroed.
+	static const uint32_t CULL_GROUP_SIZE = 64; // local_size_x of cull.comp
+	bool gpuDriven = false;
+	bool gpuDrivenSupported = false; // Indirect draws with firstInstance, to find each object's instance
+	bool multiDrawIndirectSupported = false;
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr; // VK_KHR_draw_indirect_count
+	VkDescriptorSetLayout cullDescriptorSetLayout = VK_NULL_HANDLE; // Its sets come from frameDescriptors
+	VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline cullPipeline = VK_NULL_HANDLE;
+	std::vector<CullFrame> cullFrames; // One per frame in flight
+	void createCullPipeline();
+	void createCullFrames();
+	void prepareCullFrame(CullFrame& cullFrame, const InstanceBuffer& objects, uint32_t objectCount);
+	void recordCulling(VkCommandBuffer commandBuffer, CullFrame& cullFrame, const Mesh& mesh, uint32_t objectCount);
+	void recordIndirectDraws(VkCommandBuffer commandBuffer, const CullFrame& cullFrame, const Mesh& mesh, uint32_t objectCount);
+	// ------------------------ //
+
+	// -- CPU culling -- //
+	// Objects are culled in batches, one job each. A batch packs its visible indices, then
+	// turns them into ranges; the ranges of all batches are joined into drawRanges.
+	static const uint32_t CULL_BATCH_SIZE = 16384;
+	bool cpuCulling = false;
+	FrustumCuller frustumCuller;
+	Frustum cullingFrustum = Frustum::clipSpace();
+	std::vector<std::vector<uint32_t>> cullBatchVisible; // [batch]
+	std::vector<std::vector<InstanceRange>> cullBatchRanges; // [batch]
+	uint32_t visibleObjectCount = 0;
+	void cullObjects(const InstanceBuffer& objects, const Mesh& mesh, uint32_t objectCount);
+	// ----------------- //
+
+	// -- Pipeline cache -- //
+	std::string pipelineCachePath = "pipeline_cache.bin";
+	PipelineCache pipelineCache;
+	void createPipelineCache();
+	// -------------------- //
+
+	// -- GPU profiling -- //
+	bool gpuProfilingEnabled = false;
+	GpuProfiler gpuProfiler;
+	static const uint32_t MAX_GPU_ZONES = 64; // Per command buffer
+	uint64_t frameNumber = 0;
+	void createGpuProfiler();
+	// ------------------- //
+
+	DrawSettings drawSettings;
 
-	const int MAX_FRAME_DRAWS = 2;
 	int currentFrame = 0;
 
+	// -- Synchronisation -- //
+	// One timeline semaphore per queue, no fences. A frame slot can be recorded again once the
+	// graphics queue reached the value its last frame was submitted with, and the compute queue
+	// the value of the simulation submitted beside it. Acquire and present semaphores come
+	// from the timeline's pool.
+	bool synchronization2Supported = false; // vkQueueSubmit2KHR, vkQueueSubmit otherwise
+	GpuTimeline gpuTimeline;
+	GpuTimeline::Queue graphicsTimeline = 0;
+	GpuTimeline::Queue computeTimeline = 0;
+	std::vector<uint64_t> frameValues; // Per frame in flight
+	std::vector<uint64_t> simulationValues; // Per frame in flight
+	std::vector<VkSemaphore> presentSemaphores; // Per swapchain image, back to the pool when the image is acquired again
+	void createSynchronisation();
+	// --------------------- //
+
+	// -- Frame pacing -- //
+	// Frames in flight are chosen at init from the policy, everything per frame in flight is
+	// sized with it
+	static const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+	PresentPolicy presentPolicy = PresentPolicy::Balanced;
+	uint32_t framesInFlight = 2;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR; // Of the swapchain
+	std::vector<uint64_t> frameBeginNs; // Per frame in flight, 0 once its latency was taken
+	double lastLatencyMs = 0.0;
+	double latencyTotalMs = 0.0;
+	uint64_t latencySamples = 0;
+	void chooseFramesInFlight();
+	void takeLatencySamples();
+	FramePacer framePacer;
+	PFN_vkWaitForPresentKHR waitForPresent = nullptr; // Null without present_id/present_wait
+	void createFramePacer();
+	// ------------------ //
+
 	GLFWwindow* window;
-	VkInstance instance;
+	VkInstance instance = VK_NULL_HANDLE;
+
+	// -- Headless mode -- //
+	bool headless = false;
+	VkExtent2D headlessExtent{};
+
+	// One more offscreen image than frames in flight, so an image is never rendered while in flight
+	uint32_t offscreenImageIndex = 0;
+	void createOffscreenTargets();
+	// ------------------- //
+
+	int initVulkan();
 
 	VkQueue presentationQueue;
 	VkQueue graphicsQueue;
+	VkQueue transferQueue; // Uploads, may be graphicsQueue
 
-	VkSurfaceKHR surface;
-	VkSwapchainKHR swapchain;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 
 	VkFormat swapchainImageFormat;
 	VkExtent2D swapchainExtent;
 
-	VkPipelineLayout pipelineLayout;
-
-	std::vector<VkFramebuffer> swapchainFramebuffers;
-	void createFramebuffers();
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
 
-	VkCommandPool graphicsCommandPool;
+	// One transient pool per frame in flight, reset as a whole before the frame is recorded
+	std::vector<VkCommandPool> graphicsCommandPools;
 	void createGraphicsCommandPool();
 
+	// One per frame in flight, recorded again every frame in draw()
 	std::vector<VkCommandBuffer> commandBuffers;
 	void createGraphicsCommandBuffers();
 
-	void recordCommands();
-
-	// -- Draw -- //
-	void draw();
-	// ---------- //
-
+	double lastRecordMs = 0.0;
+	std::vector<InstanceRange> drawRanges; // Drawn by each of the drawCount calls, in order
+	void recordCommands(uint32_t imageIndex);
+
+	// -- Multi-threaded recording -- //
+	// Big frames are split in chunks of draws, each recorded into a secondary command buffer
+	// by a job. The primary command buffer only executes them. Every chunk has its own pool
+	// per frame in flight: pools can't be used by two threads at once.
+	static const uint32_t MIN_DRAWS_PER_CHUNK = 256; // Below, a thread costs more than it saves
+	static const uint32_t DRAW_PASS_DEPTH_PREPASS = 0; // The depth prepass and the main pass record the same draws,
+	static const uint32_t DRAW_PASS_MAIN = 1; // each into its own secondary command buffers
+	static const uint32_t DRAW_PASS_COUNT = 2;
+	std::vector<std::vector<VkCommandPool>> secondaryCommandPools; // [frame in flight][chunk]
+	std::vector<std::vector<VkCommandBuffer>> secondaryCommandBuffers; // [frame in flight][draw pass * chunk count + chunk]
+	void createSecondaryCommandBuffers();
+	void recordDrawChunk(uint32_t chunk, uint32_t drawPass, VkPipeline pipeline, uint32_t firstDraw, uint32_t drawCount,
+		const VkCommandBufferInheritanceInfo& inheritanceInfo);
+	// -------------------------------- //
+
+	// -- Render graph -- //
+	// Declared again each frame in recordCommands. The main pass's render pass and the
+	// framebuffers belong to the graph, renderPass is the one pipelines are made with.
+	RenderGraph frameGraph;
 	void createRenderPass();
-	VkRenderPass renderPass;
-
-
-	void createSynchronisation();
-
-
-	VkPipeline graphicsPipeline;
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	RenderGraph::Resource importBackbuffer(uint32_t imageIndex);
+	RenderGraph::Pass addMainPass(RenderGraph::Resource backbuffer, RenderGraph::Resource depth, bool afterPrepass, RenderGraph::RecordFunction record);
+	// ------------------ //
+
+	// -- Depth -- //
+	// The prepass (depth only, vertex shader only pipeline) and the main pass are the two subpasses
+	// of one render pass: the depth goes from one to the other in tile memory, never stored.
+	bool reversedZ = false;
+	bool depthPrepass = false;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	VkImageAspectFlags depthAspect = 0;
+	VkRenderPass depthPrepassRenderPass = VK_NULL_HANDLE; // Both subpasses, owned by the graph
+	VkPipeline depthPrepassPipeline = VK_NULL_HANDLE; // Made with graphicsPipeline, from the same vertex shader
+	VkPipeline afterPrepassPipeline = VK_NULL_HANDLE; // graphicsPipeline for the main pass's subpass
+	void chooseDepthFormat();
+	RenderGraph::Resource createDepthBuffer();
+	RenderGraph::Pass addDepthPrepass(RenderGraph::Resource depth, RenderGraph::RecordFunction record);
+	// ----------- //
+
+
+	VkPipeline graphicsPipeline = VK_NULL_HANDLE;
 
 	std::vector<SwapchainImage> swapchainImages;
 
 	void createSwapchain();
+
+	// -- Swapchain recreation -- //
+	// On resize, or when acquire or present say the swapchain no longer matches the surface,
+	// the next draw makes a new one from the old one. Nothing waits: the old swapchain and
+	// its views go to the deletion queue. While minimised (zero extent) frames are skipped.
+	// With present_wait the old swapchain first waits for a later present to be shown, so
+	// its own last presents are known to be done; without it, for its frames only.
+	struct RetiredSwapchain
+	{
+		VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+		std::vector<VkImageView> views;
+		std::vector<VkSemaphore> presentSemaphores;
+		uint64_t lastPresentId = 0; // Presented on it or before it
+	};
+	std::deque<RetiredSwapchain> retiredSwapchains; // Waiting for a present after them to be shown
+	bool swapchainOutOfDate = false;
+	bool recreateSwapchain();
+	void retireSwapchain(const RetiredSwapchain& retired);
+	void releaseRetiredSwapchains(bool all);
+	void setViewportAndScissor(VkCommandBuffer commandBuffer);
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+	// -------------------------- //
+
 	void createSurface();
 	void createGraphicsPipeline();
 	VkShaderModule createShaderModule(const std::vector<char>& code);
+	VkShaderModule createShaderModule(const char* code, size_t codeSize);
+
+	// Compiled from rsc/<sourceName> when the runtime compiler is built in. Otherwise the
+	// precompiled spirvName, from the asset archive when there is one, from rsc/ if not.
+	VkShaderModule loadShaderModule(const std::string& sourceName, const std::string& spirvName, PipelineId pipeline);
 
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
 
@@ -94,7 +489,7 @@ private:
 	VkPresentModeKHR chooseBestPresentationMode(const std::vector<VkPresentModeKHR>& presentationModes);
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities);
 
-	VkDebugUtilsMessengerEXT debugMessenger;
+	VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
 	void setupDebugMessenger();
 
 	void createInstance();
@@ -121,4 +516,5 @@ private:
 	QueueFamilyIndices getQueueFamilies(VkPhysicalDevice device);
 
 	std::vector<const char*> getRequiredExtensions();
+	std::vector<const char*> getRequiredDeviceExtensions();
 };
\ No newline at end of file
@@ -3,12 +3,23 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include "MemoryAllocator.h"
 
 struct QueueFamilyIndices
 {
 	int graphicsFamily = -1; // Location of Graphics Queue Family
 	int presentationFamily = -1; // Location of PResentation Queue Family
 
+	// Where uploads run: a transfer-only family (DMA engine) if there is one, else a second
+	// queue of the graphics family, else the graphics queue itself. Optional, always found.
+	int transferFamily = -1;
+	int transferQueueIndex = 0;
+
+	// Where compute runs beside drawing: a compute family without graphics (async compute) if
+	// there is one, else another queue of the graphics family, else the graphics queue itself.
+	int computeFamily = -1;
+	int computeQueueIndex = 0;
+
 	bool isValid()
 	{
 		return graphicsFamily >= 0 && presentationFamily >= 0;
@@ -31,6 +42,96 @@ struct SwapchainImage
 {
 	VkImage image;
 	VkImageView imageView;
+
+	// Only used in headless mode, where the renderer owns the image memory
+	MemoryAllocation allocation;
+};
+
+
+struct Vertex
+{
+	float position[3];
+	float color[3];
+};
+
+
+// Per instance vertex input (binding 1, instance rate), see rsc/Shader/shader.vert.
+// The mesh is scaled then moved by offset, its vertex colors are multiplied by color.
+struct InstanceData
+{
+	float offset[3];
+	float scale;
+	float color[4]; // Alpha unused
+};
+
+
+// Simulated by the compute shader, matches the std430 layout of rsc/Shader/particles.comp
+struct Particle
+{
+	float position[4];
+	float velocity[4];
+};
+
+
+// What the culling pass of a frame in flight writes (GPU driven drawing). The buffers grow
+// with the object count, and are only touched once the frame's timeline value has been waited on.
+struct CullFrame
+{
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE; // This frame's, from the frame descriptor pools
+	uint32_t capacity = 0; // Objects the buffers below have room for
+
+	VkBuffer visibleInstances = VK_NULL_HANDLE; // Visible objects, packed
+	MemoryAllocation visibleInstancesAllocation;
+	VkBuffer drawCommands = VK_NULL_HANDLE; // VkDrawIndexedIndirectCommand per visible object
+	MemoryAllocation drawCommandsAllocation;
+	VkBuffer drawCount = VK_NULL_HANDLE; // Number of draw commands written
+	MemoryAllocation drawCountAllocation;
+};
+
+
+// Consecutive instances drawn by one call, what CPU culling leaves of an instance buffer
+struct InstanceRange
+{
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+
+struct DrawSettings
+{
+	uint32_t drawCount = 1; // Draw calls recorded per frame
+	uint32_t instanceCount = 1; // Instances drawn by each call, at most the instance buffer's count
+	uint32_t meshIndex = 0; // Mesh drawn, 0 is the default triangle
+	uint32_t instanceBufferIndex = 0; // Per instance data, 0 is a single untransformed instance
+	float tint[4] = { 1.0f, 1.0f, 1.0f, 1.0f }; // Multiplies the color of everything drawn
+};
+
+
+// Constants of the graphics shaders for a whole frame, written to the uniform ring
+// (the Frame block of shader.vert, std140)
+struct FrameConstants
+{
+	float tint[4];
+	uint32_t frameNumber;
+	uint32_t padding[3];
+};
+
+
+// Constants of the graphics shaders for one draw, pushed before it (the Draw push constant
+// block of shader.vert)
+struct DrawConstants
+{
+	uint32_t drawIndex; // In the frame's draw pass
+	uint32_t instanceBuffer; // Bindless index of the instance buffer read, BindlessDescriptors::NO_INDEX if none
+};
+
+
+// What the swapchain and the frames in flight are tuned for, see VulkanRenderer::setPresentPolicy
+enum class PresentPolicy
+{
+	Balanced,	// Mailbox when there is one, a spare swapchain image, 2 frames in flight
+	Throughput,	// Never wait on the display: mailbox or immediate, 3 frames in flight to keep the GPU fed
+	LowLatency	// Input to screen as short as possible: immediate or mailbox, fewest images, 1 frame in flight
 };
 
 
@@ -13,7 +13,7 @@ void initWindow(string wName = "Vulkan", const int width = 800, const int height
 		// Initialize GLFW
 		glfwInit();
 		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);  // Glfw won't work with opengl
-		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
 		window = glfwCreateWindow(width, height, wName.c_str(), nullptr, nullptr);
 }
@@ -25,7 +25,34 @@ void clean()
 }
 
 
-int main() {
+// Asset packing: VulkanTest --pack <archive> <root directory> <asset>...
+// e.g. VulkanTest --pack rsc/assets.pak rsc Shader/vert.spv Shader/frag.spv
+int packAssets(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		std::cerr << "Usage: VulkanTest --pack <archive> <root directory> <asset>..." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<string> names(argv + 4, argv + argc);
+	try
+	{
+		AssetArchive::pack(argv[2], argv[3], names);
+	}
+	catch (const std::runtime_error& e)
+	{
+		printf("ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+	std::cout << "Packed " << names.size() << " assets into " << argv[2] << std::endl;
+	return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char* argv[]) {
+
+	if (argc > 1 && string(argv[1]) == "--pack") return packAssets(argc, argv);
 
 	initWindow();
 	if (vulkanRenderer.init(window) == EXIT_FAILURE) return EXIT_FAILURE;
@@ -33,9 +60,20 @@ int main() {
 	while (!glfwWindowShouldClose(window))
 	{
 		glfwPollEvents();
+		try
+		{
+			vulkanRenderer.draw();
+		}
+		catch (const std::runtime_error& e)
+		{
+			printf("ERROR: %s\n", e.what());
+			break;
+		}
 	}
 
 
+	// While the window is still there: the swapchain and the surface go first
+	vulkanRenderer.clean();
 	clean();
 	return 0;
 }
\ No newline at end of file
@@ -1,3 +1,5 @@
 C:/VulkanSDK/1.3.275.0/Bin/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.3.275.0/Bin/glslangValidator.exe -V shader.frag
+C:/VulkanSDK/1.3.275.0/Bin/glslangValidator.exe -V particles.comp -o particles.spv
+C:/VulkanSDK/1.3.275.0/Bin/glslangValidator.exe -V cull.comp -o cull.spv
 pause
\ No newline at end of file
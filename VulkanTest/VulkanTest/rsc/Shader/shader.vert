@@ -1,24 +1,29 @@
 #version 450
 
-// Output colors for vertex shader
-layout(location = 0) out vec3 fragColor;
+// Vertex attributes, from the vertex buffer (see Vertex in VulkanUtilities.h)
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 color;
+
+// Instance attributes, from the instance buffer (see InstanceData in VulkanUtilities.h)
+layout(location = 2) in vec4 instanceTransform; // xyz: offset, w: scale
+layout(location = 3) in vec4 instanceColor;
 
-// Triangle vertex positions
-// (will be put to vertex buffer later)
-vec3 positions[3] = vec3[](
-    vec3(0.0, -0.4, 0.0),
-    vec3(0.4, 0.4, 0.0),
-    vec3(-0.4, 0.4, 0.0)
-);
+// Per frame, from the uniform ring (see FrameConstants in VulkanUtilities.h). Set 0 is the bindless set.
+layout(set = 1, binding = 0) uniform Frame {
+    vec4 tint;
+    uint frameNumber;
+} frame;
 
-// Colors
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+// Per draw (see DrawConstants in VulkanUtilities.h)
+layout(push_constant) uniform Draw {
+    uint drawIndex;
+    uint instanceBuffer; // Bindless index, ~0 if none
+} draw;
+
+// Output colors for vertex shader
+layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 1.0);
-    fragColor = colors[gl_VertexIndex];
-}
+    gl_Position = vec4(position * instanceTransform.w + instanceTransform.xyz, 1.0);
+    fragColor = color * instanceColor.rgb * frame.tint.rgb;
+}
\ No newline at end of file